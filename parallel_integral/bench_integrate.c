@@ -0,0 +1,657 @@
+#include "integrate.h"
+#include "integrate_kernels.h"
+#include "cpu_freq.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <sys/utsname.h>
+
+/*
+ * Scaling benchmark of the pool (production) path: every kernel x
+ * placement x thread count runs reps times after a warm-up.
+ * Reports median and percentiles of wall time, steps/s per core and
+ * parallel efficiency against the smallest thread count.
+ */
+
+#ifndef BENCH_CFLAGS
+#define BENCH_CFLAGS "unknown"
+#endif
+#ifndef BENCH_KERNELS_CFLAGS
+#define BENCH_KERNELS_CFLAGS "unknown"
+#endif
+
+#define BENCH_REPS 7
+#define BENCH_STEPS (1UL << 28)
+#define BENCH_TOLERANCE 0.1
+#define BENCH_EXIT_REGRESSION 2
+#define BENCH_MAX_KERNELS 8
+
+struct bench_opts {
+	const struct integrate_kernel *kernels[BENCH_MAX_KERNELS];
+	int n_kernels;
+	int placements[CPU_PLACE_COUNT];
+	int n_placements;
+	cpu_set_t threads; /* thread counts as a set */
+	int reps;
+	size_t n_steps;
+	int csv;
+	const char *baseline;
+	double tolerance;
+	int counters;
+	int freq;
+};
+
+struct bench_result {
+	const char *kernel;
+	int placement;
+	int n_threads;
+	double median;
+	double p10;
+	double p90;
+	double min;
+	double rate; /* steps/s of median */
+	double efficiency;
+	struct perf_sample perf; /* sum of timed reps */
+	int freq_source;
+	double ghz; /* mean of used cpus over timed reps, NAN if unknown */
+	double steps_per_cycle; /* median rate over summary cpu frequency */
+};
+
+static int parse_kernels(const char *arg, struct bench_opts *opts)
+{
+	opts->n_kernels = 0;
+	if (!strcmp(arg, "all")) {
+		for (const struct integrate_kernel *k = integrate_kernels;
+		     k->name && opts->n_kernels < BENCH_MAX_KERNELS; k++) {
+			if (k->supported())
+				opts->kernels[opts->n_kernels++] = k;
+		}
+		return 0;
+	}
+
+	char buf[256];
+	snprintf(buf, sizeof(buf), "%s", arg);
+	for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+		const struct integrate_kernel *k = integrate_kernel_find(tok);
+		if (!k || opts->n_kernels == BENCH_MAX_KERNELS) {
+			fprintf(stderr, "Error: kernel %s unsupported\n", tok);
+			return -1;
+		}
+		opts->kernels[opts->n_kernels++] = k;
+	}
+	return 0;
+}
+
+static int parse_placements(const char *arg, struct bench_opts *opts)
+{
+	char buf[256];
+	snprintf(buf, sizeof(buf), "%s", arg);
+	opts->n_placements = 0;
+	for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+		int policy = cpu_place_parse(tok);
+		if (policy < 0 || opts->n_placements == CPU_PLACE_COUNT)
+			return -1;
+		opts->placements[opts->n_placements++] = policy;
+	}
+	return 0;
+}
+
+/*
+ * argv: [-k kernel,..|all] [-p placement,..] [-t threads list]
+ *       [-r reps] [-n n_steps] [-o json|csv] [-b baseline.csv [-x tol]]
+ *       [-c] (perf counters) [-F] (frequency sampling)
+ * Exits with BENCH_EXIT_REGRESSION if the baseline is not met, 1 on errors
+ */
+static int process_args(int argc, char *argv[], struct bench_opts *opts,
+			struct cpu_budget *budget)
+{
+	parse_kernels("all", opts);
+	opts->placements[0] = CPU_PLACE_SMT_LAST;
+	opts->n_placements = 1;
+	CPU_ZERO(&opts->threads);
+	for (int i = 1; i <= budget->n_cpus; i++)
+		CPU_SET(i, &opts->threads);
+	opts->reps = BENCH_REPS;
+	opts->n_steps = BENCH_STEPS;
+	opts->csv = 0;
+	opts->baseline = NULL;
+	opts->tolerance = BENCH_TOLERANCE;
+	opts->counters = 0;
+	opts->freq = 0;
+
+	int opt;
+	char *endptr;
+	while ((opt = getopt(argc, argv, "k:p:t:r:n:o:b:x:cF")) != -1) {
+		errno = 0;
+		switch (opt) {
+		case 'k':
+			if (parse_kernels(optarg, opts))
+				return -1;
+			break;
+		case 'p':
+			if (parse_placements(optarg, opts))
+				return -1;
+			break;
+		case 't':
+			if (cpu_list_parse(optarg, &opts->threads))
+				return -1;
+			CPU_CLR(0, &opts->threads);
+			break;
+		case 'r':
+			opts->reps = strtol(optarg, &endptr, 10);
+			if (errno || *endptr != '\0' || opts->reps < 1)
+				return -1;
+			break;
+		case 'n':
+			opts->n_steps = strtoull(optarg, &endptr, 10);
+			if (errno || *endptr != '\0' || opts->n_steps == 0)
+				return -1;
+			break;
+		case 'o':
+			if (strcmp(optarg, "json") && strcmp(optarg, "csv"))
+				return -1;
+			opts->csv = !strcmp(optarg, "csv");
+			break;
+		case 'b':
+			opts->baseline = optarg;
+			break;
+		case 'x':
+			opts->tolerance = strtod(optarg, &endptr);
+			if (errno || *endptr != '\0' || opts->tolerance < 0)
+				return -1;
+			break;
+		case 'c':
+			opts->counters = 1;
+			break;
+		case 'F':
+			opts->freq = 1;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	if (optind != argc || CPU_COUNT(&opts->threads) == 0) {
+		fprintf(stderr, "Error: [-k kernel,..|all] [-p placement,..] "
+				"[-t 1-4,8] [-r reps] [-n n_steps] "
+				"[-o json|csv] [-b baseline.csv [-x tol]] "
+				"[-c] [-F]\n");
+		return -1;
+	}
+	return 0;
+}
+
+static double timespec_sec(struct timespec *ts)
+{
+	return ts->tv_sec + ts->tv_nsec * 1e-9;
+}
+
+static int double_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Linear interpolation between closest ranks of sorted values */
+static double percentile(const double *sorted, int n, double p)
+{
+	double pos = p * (n - 1);
+	int i = pos;
+	if (i + 1 >= n)
+		return sorted[n - 1];
+	return sorted[i] + (pos - i) * (sorted[i + 1] - sorted[i]);
+}
+
+static int bench_one(struct bench_opts *opts, cpu_set_t *cpuset,
+		     struct bench_result *res, double *times)
+{
+	struct cpu_freq *freq = NULL;
+	double *khz = NULL;
+	double khz_sum = 0;
+	int n_freq_cpus = 0;
+
+	struct integrate_pool *pool = integrate_pool_create(res->n_threads,
+							    cpuset);
+	if (!pool)
+		goto handle_err;
+	memset(&res->perf, 0, sizeof(res->perf));
+	if (opts->counters)
+		res->perf.mask = integrate_pool_counters_enable(pool);
+
+	res->freq_source = CPU_FREQ_NONE;
+	if (opts->freq) {
+		cpu_set_t pool_cpus;
+		integrate_pool_cpus(pool, &pool_cpus);
+		freq = cpu_freq_open(&pool_cpus);
+		khz = malloc(sizeof(*khz) * CPU_COUNT(&pool_cpus));
+		if (!freq || !khz) {
+			perror("Error: malloc");
+			goto handle_err;
+		}
+		res->freq_source = cpu_freq_source(freq);
+	}
+
+	struct integrate_job job;
+	integrate_job_init(&job);
+	job.n_steps = opts->n_steps;
+	long double step = integrate_job_step(&job);
+	long double result;
+
+	/* Rep -1 warms up caches, page tables and cpu frequency */
+	for (int rep = -1; rep < opts->reps; rep++) {
+		struct timespec start, end;
+		if (freq && rep >= 0 && cpu_freq_start(freq))
+			goto handle_err;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (integrate_pool_run(pool, job.n_steps, job.from, step,
+				       &job.func, &job.rule, &result) < 0)
+			goto handle_err;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (rep < 0)
+			continue;
+		times[rep] = timespec_sec(&end) - timespec_sec(&start);
+
+		if (freq) {
+			n_freq_cpus = cpu_freq_stop(freq, khz);
+			if (n_freq_cpus < 0)
+				goto handle_err;
+			for (int i = 0; i < n_freq_cpus; i++)
+				khz_sum += khz[i];
+		}
+
+		struct perf_sample perf;
+		if (opts->counters && !integrate_pool_counters(pool, &perf,
+							       NULL, NULL))
+			perf_sample_add(&res->perf, &perf);
+	}
+	integrate_pool_destroy(pool);
+
+	qsort(times, opts->reps, sizeof(*times), double_cmp);
+	res->min = times[0];
+	res->p10 = percentile(times, opts->reps, 0.1);
+	res->median = percentile(times, opts->reps, 0.5);
+	res->p90 = percentile(times, opts->reps, 0.9);
+	res->rate = opts->n_steps / res->median;
+
+	/* Busy cpus at ghz: steps per cycle of all of them */
+	res->ghz = NAN;
+	res->steps_per_cycle = NAN;
+	if (n_freq_cpus > 0 && khz_sum > 0) {
+		double mean_khz = khz_sum / opts->reps / n_freq_cpus;
+		res->ghz = mean_khz * 1e-6;
+		res->steps_per_cycle =
+			res->rate / (mean_khz * 1e3 * n_freq_cpus);
+	}
+
+	if (freq)
+		cpu_freq_close(freq);
+	free(khz);
+	return 0;
+
+handle_err:
+	if (pool)
+		integrate_pool_destroy(pool);
+	if (freq)
+		cpu_freq_close(freq);
+	free(khz);
+	return -1;
+}
+
+/* Machine description for the report */
+struct bench_meta {
+	char host[256];
+	char system[256];
+	char cpu_model[256];
+	char governor[64];
+	char kernel[16];
+};
+
+static void bench_meta_read(struct bench_meta *meta)
+{
+	if (gethostname(meta->host, sizeof(meta->host)))
+		strcpy(meta->host, "unknown");
+
+	struct utsname uts;
+	if (uname(&uts))
+		strcpy(meta->system, "unknown");
+	else
+		snprintf(meta->system, sizeof(meta->system), "%s %s %s",
+			 uts.sysname, uts.release, uts.machine);
+
+	strcpy(meta->cpu_model, "unknown");
+	FILE *file = fopen("/proc/cpuinfo", "r");
+	if (file) {
+		char line[512];
+		while (fgets(line, sizeof(line), file)) {
+			char *val = strchr(line, ':');
+			if (strncmp(line, "model name", 10) || !val)
+				continue;
+			val += 1 + strspn(val + 1, " ");
+			val[strcspn(val, "\n")] = '\0';
+			snprintf(meta->cpu_model, sizeof(meta->cpu_model), "%s",
+				 val);
+			break;
+		}
+		fclose(file);
+	}
+
+	const char *sysfs = getenv("CPU_TOPOLOGY_SYSFS");
+	if (!sysfs)
+		sysfs = CPU_TOPOLOGY_SYSFS;
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path),
+		 "%s/devices/system/cpu/cpu0/cpufreq/scaling_governor", sysfs);
+
+	strcpy(meta->governor, "unknown");
+	file = fopen(path, "r");
+	if (file) {
+		if (fgets(meta->governor, sizeof(meta->governor), file))
+			meta->governor[strcspn(meta->governor, "\n")] = '\0';
+		fclose(file);
+	}
+
+	snprintf(meta->kernel, sizeof(meta->kernel), "%s",
+		 integrate_kernel_select()->name);
+}
+
+/* Counters per run, then ipc, GHz and cycles/ref-cycles (turbo > 1) */
+#define BENCH_PERF_FIELDS (PERF_COUNTER_COUNT + 3)
+
+static const char *const bench_perf_derived[] = { "ipc", "ghz",
+						  "cycles_per_ref" };
+
+static const char *bench_perf_name(int field)
+{
+	if (field < PERF_COUNTER_COUNT)
+		return perf_counter_name(field);
+	return bench_perf_derived[field - PERF_COUNTER_COUNT];
+}
+
+/* 0 for every missing field, vals NAN there */
+static int bench_perf_values(struct bench_result *r, int reps, double *vals)
+{
+	const uint64_t *val = r->perf.val;
+	int n_valid = 0;
+
+	for (int i = 0; i < BENCH_PERF_FIELDS; i++)
+		vals[i] = NAN;
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+		if (r->perf.mask & (1U << i)) {
+			vals[i] = (double)val[i] / reps;
+			n_valid++;
+		}
+	}
+	if (vals[PERF_CYCLES] > 0) {
+		vals[PERF_COUNTER_COUNT] = vals[PERF_INSTRUCTIONS] /
+					   vals[PERF_CYCLES];
+		vals[PERF_COUNTER_COUNT + 2] = vals[PERF_CYCLES] /
+					       vals[PERF_REF_CYCLES];
+	}
+	if (vals[PERF_TASK_CLOCK] > 0)
+		vals[PERF_COUNTER_COUNT + 1] = vals[PERF_CYCLES] /
+					       vals[PERF_TASK_CLOCK];
+	return n_valid;
+}
+
+static void print_json(FILE *out, struct bench_meta *meta,
+		       struct cpu_topology *topo, struct cpu_budget *budget,
+		       struct bench_opts *opts, struct bench_result *res,
+		       int n_res)
+{
+	fprintf(out, "{\n  \"machine\": {\n");
+	fprintf(out, "    \"host\": \"%s\",\n", meta->host);
+	fprintf(out, "    \"system\": \"%s\",\n", meta->system);
+	fprintf(out, "    \"cpu_model\": \"%s\",\n", meta->cpu_model);
+	fprintf(out, "    \"governor\": \"%s\",\n", meta->governor);
+	fprintf(out, "    \"cpus\": %d,\n", topo->n_cpus);
+	fprintf(out, "    \"packages\": %d,\n", topo->max_package_id + 1);
+	fprintf(out, "    \"numa_nodes\": %d,\n", topo->max_node_id + 1);
+	fprintf(out, "    \"cache_kb\": [");
+	for (int l = 1; l < CPU_CACHE_LEVELS; l++)
+		fprintf(out, "%s%zu", l > 1 ? ", " : "",
+			cpu_topology_cache_size(topo, l) >> 10);
+	fprintf(out, "],\n");
+	fprintf(out, "    \"budget_cpus\": %d,\n", budget->n_cpus);
+	fprintf(out, "    \"best_kernel\": \"%s\"\n", meta->kernel);
+	fprintf(out, "  },\n  \"build\": {\n");
+	fprintf(out, "    \"compiler\": \"%s\",\n", __VERSION__);
+	fprintf(out, "    \"cflags\": \"%s\",\n", BENCH_CFLAGS);
+	fprintf(out, "    \"kernels_cflags\": \"%s\"\n", BENCH_KERNELS_CFLAGS);
+	fprintf(out, "  },\n  \"n_steps\": %zu,\n  \"reps\": %d,\n",
+		opts->n_steps, opts->reps);
+	fprintf(out, "  \"results\": [\n");
+	for (int i = 0; i < n_res; i++) {
+		struct bench_result *r = &res[i];
+		fprintf(out,
+			"    {\"kernel\": \"%s\", \"placement\": \"%s\", "
+			"\"threads\": %d, \"median_s\": %.6f, "
+			"\"p10_s\": %.6f, \"p90_s\": %.6f, \"min_s\": %.6f, "
+			"\"steps_per_s\": %.4e, \"steps_per_s_core\": %.4e, "
+			"\"efficiency\": %.4f",
+			r->kernel, cpu_place_name(r->placement), r->n_threads,
+			r->median, r->p10, r->p90, r->min, r->rate,
+			r->rate / r->n_threads, r->efficiency);
+
+		double vals[BENCH_PERF_FIELDS];
+		if (opts->counters && bench_perf_values(r, opts->reps, vals)) {
+			fprintf(out, ", \"counters\": {");
+			const char *sep = "";
+			for (int f = 0; f < BENCH_PERF_FIELDS; f++) {
+				if (isnan(vals[f]))
+					continue;
+				fprintf(out, "%s\"%s\": %.6g", sep,
+					bench_perf_name(f), vals[f]);
+				sep = ", ";
+			}
+			fprintf(out, "}");
+		} else if (opts->counters) {
+			fprintf(out, ", \"counters\": null");
+		}
+		if (opts->freq && !isnan(r->ghz))
+			fprintf(out,
+				", \"freq\": {\"source\": \"%s\", "
+				"\"ghz\": %.4f, \"steps_per_cycle\": %.4f}",
+				cpu_freq_source_name(r->freq_source), r->ghz,
+				r->steps_per_cycle);
+		else if (opts->freq)
+			fprintf(out, ", \"freq\": null");
+		fprintf(out, "}%s\n", i + 1 < n_res ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+}
+
+#define BENCH_CSV_HEADER                                                       \
+	"kernel,placement,threads,median_s,p10_s,p90_s,min_s,steps_per_s,"     \
+	"steps_per_s_core,efficiency"
+
+static void print_csv(FILE *out, struct bench_meta *meta,
+		      struct cpu_topology *topo, struct cpu_budget *budget,
+		      struct bench_opts *opts, struct bench_result *res,
+		      int n_res)
+{
+	fprintf(out, "# host: %s\n# system: %s\n# cpu_model: %s\n",
+		meta->host, meta->system, meta->cpu_model);
+	fprintf(out, "# governor: %s\n# cpus: %d packages: %d nodes: %d "
+		     "budget: %d\n",
+		meta->governor, topo->n_cpus, topo->max_package_id + 1,
+		topo->max_node_id + 1, budget->n_cpus);
+	fprintf(out, "# compiler: %s\n# cflags: %s\n# kernels_cflags: %s\n",
+		__VERSION__, BENCH_CFLAGS, BENCH_KERNELS_CFLAGS);
+	fprintf(out, "# n_steps: %zu reps: %d\n", opts->n_steps, opts->reps);
+	fprintf(out, BENCH_CSV_HEADER);
+	for (int f = 0; opts->counters && f < BENCH_PERF_FIELDS; f++)
+		fprintf(out, ",%s", bench_perf_name(f));
+	fprintf(out, "%s\n", opts->freq ? ",ghz_sampled,steps_per_cycle" : "");
+	for (int i = 0; i < n_res; i++) {
+		struct bench_result *r = &res[i];
+		fprintf(out, "%s,%s,%d,%.6f,%.6f,%.6f,%.6f,%.4e,%.4e,%.4f",
+			r->kernel, cpu_place_name(r->placement), r->n_threads,
+			r->median, r->p10, r->p90, r->min, r->rate,
+			r->rate / r->n_threads, r->efficiency);
+
+		/* Empty fields for counters the kernel refused */
+		double vals[BENCH_PERF_FIELDS];
+		if (opts->counters)
+			bench_perf_values(r, opts->reps, vals);
+		for (int f = 0; opts->counters && f < BENCH_PERF_FIELDS; f++) {
+			if (isnan(vals[f]))
+				fprintf(out, ",");
+			else
+				fprintf(out, ",%.6g", vals[f]);
+		}
+		if (opts->freq && !isnan(r->ghz))
+			fprintf(out, ",%.4f,%.4f", r->ghz, r->steps_per_cycle);
+		else if (opts->freq)
+			fprintf(out, ",,");
+		fprintf(out, "\n");
+	}
+}
+
+/*
+ * Efficiency is hardware-neutral, so it is compared across machines:
+ * a drop by more than tolerance (relative) is a regression.
+ * Returns number of regressions, -1 on error.
+ */
+static int compare_baseline(const char *path, double tolerance,
+			    struct bench_result *res, int n_res)
+{
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		perror("Error: baseline fopen");
+		return -1;
+	}
+
+	int n_regress = 0;
+	char line[512];
+	while (fgets(line, sizeof(line), file)) {
+		char kernel[32], placement[32];
+		int n_threads;
+		double eff;
+		if (line[0] == '#' ||
+		    sscanf(line, "%31[^,],%31[^,],%d,%*f,%*f,%*f,%*f,%*f,%*f,%lf",
+			   kernel, placement, &n_threads, &eff) != 4)
+			continue;
+
+		for (int i = 0; i < n_res; i++) {
+			struct bench_result *r = &res[i];
+			if (strcmp(r->kernel, kernel) ||
+			    strcmp(cpu_place_name(r->placement), placement) ||
+			    r->n_threads != n_threads)
+				continue;
+			if (r->efficiency < eff * (1 - tolerance)) {
+				fprintf(stderr,
+					"Regression: %s %s %d threads: "
+					"efficiency %.3f, baseline %.3f\n",
+					kernel, placement, n_threads,
+					r->efficiency, eff);
+				n_regress++;
+			}
+		}
+	}
+
+	fclose(file);
+	return n_regress;
+}
+
+int main(int argc, char *argv[])
+{
+	struct cpu_topology topo;
+	struct cpu_budget budget;
+	if (get_cpu_topology(&topo)) {
+		fprintf(stderr, "Error: get_cpu_topology\n");
+		exit(EXIT_FAILURE);
+	}
+	if (get_cpu_budget(&topo, &budget)) {
+		fprintf(stderr, "Error: get_cpu_budget: affinity and cgroup "
+				"cpu limits\n");
+		exit(EXIT_FAILURE);
+	}
+	cpu_topology_set_weights(&topo, CPU_WEIGHT_CAPACITY);
+
+	struct bench_opts opts;
+	if (process_args(argc, argv, &opts, &budget)) {
+		fprintf(stderr, "Error: wrong argv\n");
+		exit(EXIT_FAILURE);
+	}
+
+	struct bench_meta meta;
+	bench_meta_read(&meta);
+
+	int n_res = opts.n_kernels * opts.n_placements *
+		    CPU_COUNT(&opts.threads);
+	struct bench_result *res = malloc(sizeof(*res) * n_res);
+	double *times = malloc(sizeof(*times) * opts.reps);
+	if (!res || !times) {
+		perror("Error: malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	struct bench_result *cur = res;
+	for (int k = 0; k < opts.n_kernels; k++) {
+		integrate_kernel_force(opts.kernels[k]);
+		for (int p = 0; p < opts.n_placements; p++) {
+			integrate_set_placement(&topo, opts.placements[p]);
+			struct bench_result *first = cur;
+
+			int n = cpu_set_search_next(0, &opts.threads);
+			for (; n != 0; n = cpu_set_search_next(n, &opts.threads),
+				       cur++) {
+				cur->kernel = opts.kernels[k]->name;
+				cur->placement = opts.placements[p];
+				cur->n_threads = n;
+				if (bench_one(&opts, &budget.cpuset, cur,
+					      times) < 0) {
+					fprintf(stderr, "Error: bench_one\n");
+					exit(EXIT_FAILURE);
+				}
+
+				/* Per thread rate against the first count */
+				cur->efficiency = (cur->rate / n) /
+						  (first->rate /
+						   first->n_threads);
+				fprintf(stderr,
+					"%-7s %-6s %3d threads: %.4fs "
+					"(p10 %.4fs p90 %.4fs) eff %.3f",
+					cur->kernel, cpu_place_name(cur->placement),
+					n, cur->median, cur->p10, cur->p90,
+					cur->efficiency);
+				if (opts.counters)
+					perf_sample_dump(stderr, &cur->perf);
+				if (opts.freq && !isnan(cur->ghz))
+					fprintf(stderr,
+						" %s %.3f GHz %.3f steps/cycle",
+						cpu_freq_source_name(
+							cur->freq_source),
+						cur->ghz, cur->steps_per_cycle);
+				else if (opts.freq)
+					fprintf(stderr, " frequency unknown");
+				fprintf(stderr, "\n");
+			}
+		}
+	}
+
+	if (opts.csv)
+		print_csv(stdout, &meta, &topo, &budget, &opts, res, n_res);
+	else
+		print_json(stdout, &meta, &topo, &budget, &opts, res, n_res);
+
+	int ret = 0;
+	if (opts.baseline) {
+		int n_regress = compare_baseline(opts.baseline,
+						 opts.tolerance, res, n_res);
+		if (n_regress < 0)
+			ret = EXIT_FAILURE;
+		else if (n_regress)
+			ret = BENCH_EXIT_REGRESSION;
+	}
+
+	free(times);
+	free(res);
+	free_cpu_topology(&topo);
+	return ret;
+}
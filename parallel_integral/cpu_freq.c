@@ -0,0 +1,233 @@
+#include "cpu_freq.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#define MSR_IA32_TSC 0x10
+#define MSR_IA32_MPERF 0xe7
+#define MSR_IA32_APERF 0xe8
+
+struct cpu_freq {
+	int source;
+	int n_cpus;
+	int *fd; /* msr or scaling_cur_freq of every cpu */
+
+	/* CPU_FREQ_APERF: counters at start */
+	uint64_t (*start)[3]; /* aperf, mperf, tsc */
+	struct timespec t_start;
+
+	/* CPU_FREQ_SYSFS: sampler thread sums */
+	double *sum_khz;
+	int n_samples;
+	int stop;
+	pthread_t thread;
+};
+
+static int msr_read(int fd, uint32_t reg, uint64_t *val)
+{
+	return pread(fd, val, sizeof(*val), reg) == sizeof(*val) ? 0 : -1;
+}
+
+static int sysfs_read_khz(int fd, double *khz)
+{
+	char buf[32];
+	ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return -1;
+	buf[len] = '\0';
+	*khz = strtod(buf, NULL);
+	return 0;
+}
+
+static int cpu_freq_open_fds(struct cpu_freq *freq, cpu_set_t *set,
+			     int source)
+{
+	const char *sysfs = getenv("CPU_TOPOLOGY_SYSFS");
+	if (!sysfs)
+		sysfs = "/sys";
+
+	int i = 0;
+	for (int cpu = 0; cpu < CPU_SETSIZE && i < freq->n_cpus; cpu++) {
+		if (!CPU_ISSET(cpu, set))
+			continue;
+
+		char path[PATH_MAX];
+		if (source == CPU_FREQ_APERF)
+			snprintf(path, sizeof(path), "/dev/cpu/%d/msr", cpu);
+		else
+			snprintf(path, sizeof(path),
+				 "%s/devices/system/cpu/cpu%d/cpufreq/"
+				 "scaling_cur_freq",
+				 sysfs, cpu);
+
+		freq->fd[i] = open(path, O_RDONLY);
+		uint64_t val;
+		double khz;
+		if (freq->fd[i] < 0 ||
+		    (source == CPU_FREQ_APERF &&
+		     msr_read(freq->fd[i], MSR_IA32_APERF, &val)) ||
+		    (source == CPU_FREQ_SYSFS &&
+		     sysfs_read_khz(freq->fd[i], &khz))) {
+			if (freq->fd[i] >= 0)
+				close(freq->fd[i]);
+			while (i-- > 0)
+				close(freq->fd[i]);
+			return -1;
+		}
+		i++;
+	}
+	return 0;
+}
+
+struct cpu_freq *cpu_freq_open(cpu_set_t *set)
+{
+	struct cpu_freq *freq = calloc(1, sizeof(*freq));
+	if (!freq) {
+		perror("Error: calloc");
+		return NULL;
+	}
+	freq->n_cpus = CPU_COUNT(set);
+	freq->fd = malloc(sizeof(*freq->fd) * freq->n_cpus);
+	freq->start = malloc(sizeof(*freq->start) * freq->n_cpus);
+	freq->sum_khz = malloc(sizeof(*freq->sum_khz) * freq->n_cpus);
+	if (!freq->fd || !freq->start || !freq->sum_khz) {
+		perror("Error: malloc");
+		cpu_freq_close(freq);
+		return NULL;
+	}
+
+	if (!cpu_freq_open_fds(freq, set, CPU_FREQ_APERF))
+		freq->source = CPU_FREQ_APERF;
+	else if (!cpu_freq_open_fds(freq, set, CPU_FREQ_SYSFS))
+		freq->source = CPU_FREQ_SYSFS;
+	else
+		freq->source = CPU_FREQ_NONE;
+	return freq;
+}
+
+void cpu_freq_close(struct cpu_freq *freq)
+{
+	if (freq->source != CPU_FREQ_NONE) {
+		for (int i = 0; i < freq->n_cpus; i++)
+			close(freq->fd[i]);
+	}
+	free(freq->sum_khz);
+	free(freq->start);
+	free(freq->fd);
+	free(freq);
+}
+
+int cpu_freq_source(struct cpu_freq *freq)
+{
+	return freq->source;
+}
+
+const char *cpu_freq_source_name(int source)
+{
+	static const char *const names[] = {
+		[CPU_FREQ_NONE] = "none",
+		[CPU_FREQ_APERF] = "aperf",
+		[CPU_FREQ_SYSFS] = "scaling_cur_freq",
+	};
+	return names[source];
+}
+
+static void cpu_freq_sample(struct cpu_freq *freq)
+{
+	for (int i = 0; i < freq->n_cpus; i++) {
+		double khz;
+		if (!sysfs_read_khz(freq->fd[i], &khz))
+			freq->sum_khz[i] += khz;
+	}
+	freq->n_samples++;
+}
+
+static void *cpu_freq_sampler(void *arg)
+{
+	struct cpu_freq *freq = arg;
+	struct timespec period = { 0, CPU_FREQ_PERIOD_MS * 1000000L };
+
+	while (!__atomic_load_n(&freq->stop, __ATOMIC_ACQUIRE)) {
+		cpu_freq_sample(freq);
+		nanosleep(&period, NULL);
+	}
+	return NULL;
+}
+
+int cpu_freq_start(struct cpu_freq *freq)
+{
+	switch (freq->source) {
+	case CPU_FREQ_APERF:
+		for (int i = 0; i < freq->n_cpus; i++) {
+			if (msr_read(freq->fd[i], MSR_IA32_APERF,
+				     &freq->start[i][0]) ||
+			    msr_read(freq->fd[i], MSR_IA32_MPERF,
+				     &freq->start[i][1]) ||
+			    msr_read(freq->fd[i], MSR_IA32_TSC,
+				     &freq->start[i][2])) {
+				perror("Error: msr read");
+				return -1;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &freq->t_start);
+		return 0;
+	case CPU_FREQ_SYSFS:
+		for (int i = 0; i < freq->n_cpus; i++)
+			freq->sum_khz[i] = 0;
+		freq->n_samples = 0;
+		freq->stop = 0;
+		if (pthread_create(&freq->thread, NULL, cpu_freq_sampler,
+				   freq)) {
+			perror("Error: pthread_create");
+			return -1;
+		}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+int cpu_freq_stop(struct cpu_freq *freq, double *khz)
+{
+	switch (freq->source) {
+	case CPU_FREQ_APERF: {
+		struct timespec t_end;
+		clock_gettime(CLOCK_MONOTONIC, &t_end);
+		double sec = (t_end.tv_sec - freq->t_start.tv_sec) +
+			     (t_end.tv_nsec - freq->t_start.tv_nsec) * 1e-9;
+
+		/* MPERF ticks at TSC rate in C0: khz = tsc rate * A / M */
+		for (int i = 0; i < freq->n_cpus; i++) {
+			uint64_t aperf, mperf, tsc;
+			if (msr_read(freq->fd[i], MSR_IA32_APERF, &aperf) ||
+			    msr_read(freq->fd[i], MSR_IA32_MPERF, &mperf) ||
+			    msr_read(freq->fd[i], MSR_IA32_TSC, &tsc)) {
+				perror("Error: msr read");
+				return -1;
+			}
+			aperf -= freq->start[i][0];
+			mperf -= freq->start[i][1];
+			tsc -= freq->start[i][2];
+			khz[i] = mperf ? (double)tsc / sec * aperf / mperf /
+						 1000
+				       : 0;
+		}
+		return freq->n_cpus;
+	}
+	case CPU_FREQ_SYSFS:
+		__atomic_store_n(&freq->stop, 1, __ATOMIC_RELEASE);
+		pthread_join(freq->thread, NULL);
+		cpu_freq_sample(freq);
+		for (int i = 0; i < freq->n_cpus; i++)
+			khz[i] = freq->sum_khz[i] / freq->n_samples;
+		return freq->n_cpus;
+	default:
+		return 0;
+	}
+}
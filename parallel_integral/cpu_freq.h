@@ -0,0 +1,42 @@
+#ifndef CPU_FREQ_H_
+#define CPU_FREQ_H_
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sched.h>
+
+/*
+ * Effective frequency of cpus over a measured interval, for
+ * frequency-normalized benchmarks. APERF/MPERF (/dev/cpu/N/msr) give
+ * the exact C0 average; scaling_cur_freq (under CPU_TOPOLOGY_SYSFS)
+ * is sampled every CPU_FREQ_PERIOD_MS otherwise.
+ */
+
+#define CPU_FREQ_PERIOD_MS 5
+
+enum cpu_freq_source {
+	CPU_FREQ_NONE,
+	CPU_FREQ_APERF,
+	CPU_FREQ_SYSFS,
+};
+
+struct cpu_freq;
+
+/* Best source readable for every cpu of set, NULL on error */
+struct cpu_freq *cpu_freq_open(cpu_set_t *set);
+void cpu_freq_close(struct cpu_freq *freq);
+
+int cpu_freq_source(struct cpu_freq *freq);
+const char *cpu_freq_source_name(int source);
+
+int cpu_freq_start(struct cpu_freq *freq);
+
+/*
+ * Mean kHz of each cpu of set (cpu id order) since start,
+ * returns their number, 0 with CPU_FREQ_NONE, -1 on error
+ */
+int cpu_freq_stop(struct cpu_freq *freq, double *khz);
+
+#endif /* CPU_FREQ_H_ */
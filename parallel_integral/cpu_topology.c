@@ -10,29 +10,42 @@
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <ctype.h>
+#include <stdarg.h>
 
-int file_read_num(const char *name, int *result)
+/* File content as a string without trailing newline */
+static int file_read_str(const char *name, char *buf, size_t size)
 {
-	char buf[64];
-
 	int fd = open(name, O_RDONLY);
 	if (fd == -1) {
-		perror("Error: file_read_num: open");
+		perror("Error: file_read_str: open");
 		return -1;
 	}
 
-	ssize_t ret = read(fd, buf, sizeof(buf) - 1);
+	ssize_t ret = read(fd, buf, size - 1);
 	if (ret == -1) {
-		perror("Error: file_read_num: read");
+		perror("Error: file_read_str: read");
+		close(fd);
 		return -1;
 	}
 
 	if (close(fd) == -1) {
-		perror("Error: file_read_num: close");
+		perror("Error: file_read_str: close");
 		return -1;
 	}
 
 	buf[ret] = '\0';
+	if (ret && buf[ret - 1] == '\n')
+		buf[ret - 1] = '\0';
+	return 0;
+}
+
+int file_read_num(const char *name, int *result)
+{
+	char buf[64];
+	if (file_read_str(name, buf, sizeof(buf)))
+		return -1;
+
 	errno = 0;
 	long tmp = strtol(buf, NULL, 10);
 	if (errno || tmp < INT_MIN || tmp > INT_MAX) {
@@ -44,76 +57,265 @@ int file_read_num(const char *name, int *result)
 	return 0;
 }
 
-int get_cpu_topology(struct cpu_topology *topo)
+/* "32K", "1M" or plain bytes */
+static int file_read_size(const char *name, size_t *result)
+{
+	char buf[64];
+	if (file_read_str(name, buf, sizeof(buf)))
+		return -1;
+
+	char *endptr;
+	errno = 0;
+	unsigned long long tmp = strtoull(buf, &endptr, 10);
+	if (errno || endptr == buf) {
+		fprintf(stderr, "Error: file_read_size: wrong size\n");
+		return -1;
+	}
+	if (*endptr == 'K')
+		tmp <<= 10;
+	else if (*endptr == 'M')
+		tmp <<= 20;
+	else if (*endptr == 'G')
+		tmp <<= 30;
+
+	*result = tmp;
+	return 0;
+}
+
+/* Into PATH_MAX buf, too long paths are left empty and fail to open */
+static void path_fmt(char *buf, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	int ret = vsnprintf(buf, PATH_MAX, fmt, args);
+	va_end(args);
+	if (ret >= PATH_MAX)
+		buf[0] = '\0';
+}
+
+/* NUMA node of cpu: its nodeN entry, 0 if none */
+static int get_cpu_node(const char *cpu_dir)
+{
+	DIR *dir = opendir(cpu_dir);
+	if (!dir)
+		return 0;
+
+	int node = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (!memcmp(entry->d_name, "node", 4) &&
+		    isdigit(entry->d_name[4])) {
+			node = atoi(entry->d_name + 4);
+			break;
+		}
+	}
+
+	closedir(dir);
+	return node;
+}
+
+/* Data and unified caches of cpu by level, absent ones stay zero */
+static int get_cpu_caches(const char *cpu_dir, struct cpu_cache *cache)
+{
+	char buf[PATH_MAX];
+	char type[32];
+
+	for (int i = 0; i < CPU_CACHE_LEVELS; i++) {
+		cache[i].size = 0;
+		cache[i].domain = -1;
+	}
+
+	for (int i = 0;; i++) {
+		int level, domain;
+		size_t size;
+
+		path_fmt(buf, "%s/cache/index%d/type", cpu_dir, i);
+		if (access(buf, R_OK))
+			break;
+		if (file_read_str(buf, type, sizeof(type)))
+			return -1;
+		if (!strcmp(type, "Instruction"))
+			continue;
+
+		path_fmt(buf, "%s/cache/index%d/level", cpu_dir, i);
+		if (file_read_num(buf, &level))
+			return -1;
+		if (level < 1 || level >= CPU_CACHE_LEVELS)
+			continue;
+
+		path_fmt(buf, "%s/cache/index%d/size", cpu_dir, i);
+		if (file_read_size(buf, &size))
+			return -1;
+
+		/* List is sorted, its first number is the lowest cpu */
+		path_fmt(buf, "%s/cache/index%d/shared_cpu_list", cpu_dir, i);
+		if (file_read_num(buf, &domain))
+			return -1;
+
+		cache[level].size = size;
+		cache[level].domain = domain;
+	}
+
+	return 0;
+}
+
+static int cpu_topology_elem_cmp(const void *a, const void *b)
+{
+	const struct cpu_topology_elem *x = a, *y = b;
+	return x->cpu_id - y->cpu_id;
+}
+
+int get_cpu_topology_at(struct cpu_topology *topo, const char *root)
 {
-	DIR *sysfs_cpudir = opendir("/sys/bus/cpu/devices");
+	char cpu_dir[PATH_MAX];
+	char buf[PATH_MAX];
+
+	if (!root)
+		root = CPU_TOPOLOGY_SYSFS;
+	path_fmt(cpu_dir, "%s/devices/system/cpu", root);
+
+	DIR *sysfs_cpudir = opendir(cpu_dir);
 	if (!sysfs_cpudir) {
-		perror("Error: get_cpu_topology: "
-		       "opendir /sys/bus/cpu/devices");
+		fprintf(stderr, "Error: get_cpu_topology: opendir %s: %s\n",
+			cpu_dir, strerror(errno));
 		return -1;
 	}
 
 	struct dirent *entry;
-	char buf[512];
-	int n_cpu = 0;
+	int max_cpus = 0;
+	topo->cpu = NULL;
+	topo->n_cpus = 0;
 	topo->max_package_id = 0;
 	topo->max_core_id = 0;
 	topo->max_cpu_id = 0;
+	topo->max_node_id = 0;
+	topo->llc_level = 0;
 	errno = 0;
 
 	while ((entry = readdir(sysfs_cpudir)) != NULL) {
-		if (!memcmp(entry->d_name, "cpu", 3)) {
-			int cpu_id, core_id, package_id;
-
-			cpu_id = atoi(entry->d_name + 3);
-
-			sprintf(buf,
-				"/sys/bus/cpu/devices/%s/topology/"
-				"core_id",
-				entry->d_name);
-			if (file_read_num(buf, &core_id)) {
-				fprintf(stderr, "Error: get_cpu_topology: "
-						"core_id read failed\n");
+		if (memcmp(entry->d_name, "cpu", 3) ||
+		    !isdigit(entry->d_name[3]))
+			continue;
+
+		if (topo->n_cpus == max_cpus) {
+			max_cpus = max_cpus ? max_cpus * 2 : 64;
+			struct cpu_topology_elem *cpu = realloc(
+				topo->cpu, sizeof(*topo->cpu) * max_cpus);
+			if (!cpu) {
+				perror("Error: get_cpu_topology: realloc");
 				goto handle_err;
 			}
+			topo->cpu = cpu;
+		}
 
-			sprintf(buf,
-				"/sys/bus/cpu/devices/%s/topology/"
-				"physical_package_id",
-				entry->d_name);
-			if (file_read_num(buf, &package_id)) {
-				fprintf(stderr, "Error: get_cpu_topology: "
-						"package_id read failed\n");
-				goto handle_err;
-			}
+		struct cpu_topology_elem *cpu = &topo->cpu[topo->n_cpus];
+		char elem_dir[PATH_MAX];
+		path_fmt(elem_dir, "%s/%s", cpu_dir, entry->d_name);
+		cpu->cpu_id = atoi(entry->d_name + 3);
+
+		path_fmt(buf, "%s/topology/core_id", elem_dir);
+		if (file_read_num(buf, &cpu->core_id)) {
+			fprintf(stderr, "Error: get_cpu_topology: "
+					"core_id read failed\n");
+			goto handle_err;
+		}
+
+		path_fmt(buf, "%s/topology/physical_package_id", elem_dir);
+		if (file_read_num(buf, &cpu->package_id)) {
+			fprintf(stderr, "Error: get_cpu_topology: "
+					"package_id read failed\n");
+			goto handle_err;
+		}
 
-			topo->cpu[n_cpu].package_id = package_id;
-			topo->cpu[n_cpu].core_id = core_id;
-			topo->cpu[n_cpu].cpu_id = cpu_id;
-			n_cpu++;
-
-			if (package_id > topo->max_package_id)
-				topo->max_package_id = package_id;
-			if (core_id > topo->max_core_id)
-				topo->max_core_id = core_id;
-			if (cpu_id > topo->max_cpu_id)
-				topo->max_cpu_id = cpu_id;
+		path_fmt(buf, "%s/cpu_capacity", elem_dir);
+		cpu->capacity = 1024;
+		if (!access(buf, R_OK) && file_read_num(buf, &cpu->capacity))
+			goto handle_err;
+
+		path_fmt(buf, "%s/cpufreq/cpuinfo_max_freq", elem_dir);
+		cpu->max_freq = 0;
+		if (!access(buf, R_OK) && file_read_num(buf, &cpu->max_freq))
+			goto handle_err;
+		cpu->weight = 1024;
+
+		if (get_cpu_caches(elem_dir, cpu->cache)) {
+			fprintf(stderr, "Error: get_cpu_topology: "
+					"cache read failed\n");
+			goto handle_err;
 		}
+		cpu->node_id = get_cpu_node(elem_dir);
+
+		for (int l = 1; l < CPU_CACHE_LEVELS; l++) {
+			if (cpu->cache[l].size && l > topo->llc_level)
+				topo->llc_level = l;
+		}
+		if (cpu->package_id > topo->max_package_id)
+			topo->max_package_id = cpu->package_id;
+		if (cpu->core_id > topo->max_core_id)
+			topo->max_core_id = cpu->core_id;
+		if (cpu->cpu_id > topo->max_cpu_id)
+			topo->max_cpu_id = cpu->cpu_id;
+		if (cpu->node_id > topo->max_node_id)
+			topo->max_node_id = cpu->node_id;
+		topo->n_cpus++;
+
+		/* Probing of absent files is not an error */
+		errno = 0;
 	}
 
 	if (errno) {
 		perror("Error: get_cpu_topology: readdir");
 		goto handle_err;
 	}
+	if (topo->n_cpus == 0) {
+		fprintf(stderr, "Error: get_cpu_topology: no cpus in %s\n",
+			cpu_dir);
+		goto handle_err;
+	}
+
+	/* LLC domain: sharing cpus of the last level, package otherwise */
+	for (int i = 0; i < topo->n_cpus; i++) {
+		struct cpu_topology_elem *cpu = &topo->cpu[i];
+		int domain = topo->llc_level ?
+				     cpu->cache[topo->llc_level].domain : -1;
+		cpu->llc_id = domain < 0 ? cpu->package_id : domain;
+	}
+	qsort(topo->cpu, topo->n_cpus, sizeof(*topo->cpu),
+	      cpu_topology_elem_cmp);
 
 	closedir(sysfs_cpudir);
 	return 0;
 
 handle_err:
+	free(topo->cpu);
+	topo->cpu = NULL;
 	closedir(sysfs_cpudir);
 	return -1;
 }
 
+int get_cpu_topology(struct cpu_topology *topo)
+{
+	return get_cpu_topology_at(topo, getenv("CPU_TOPOLOGY_SYSFS"));
+}
+
+void free_cpu_topology(struct cpu_topology *topo)
+{
+	free(topo->cpu);
+	topo->cpu = NULL;
+	topo->n_cpus = 0;
+}
+
+size_t cpu_topology_cache_size(struct cpu_topology *topo, int level)
+{
+	size_t size = 0;
+	for (int i = 0; i < topo->n_cpus; i++) {
+		size_t cur = topo->cpu[i].cache[level].size;
+		if (cur && (!size || cur < size))
+			size = cur;
+	}
+	return size;
+}
+
 int dump_cpu_topology(FILE *stream, struct cpu_topology *topo)
 {
 	fprintf(stream, "--- dump_cpu_topology: ---\n");
@@ -121,11 +323,22 @@ int dump_cpu_topology(FILE *stream, struct cpu_topology *topo)
 	fprintf(stream, "max_package_id: %3.3d\n", topo->max_package_id);
 	fprintf(stream, "max_core_id:    %3.3d\n", topo->max_core_id);
 	fprintf(stream, "max_cpu_id:     %3.3d\n", topo->max_cpu_id);
+	fprintf(stream, "max_node_id:    %3.3d\n", topo->max_node_id);
+	fprintf(stream, "llc_level:      %d\n", topo->llc_level);
 
-	for (int i = 0; i < topo->max_cpu_id + 1; i++) {
+	for (int i = 0; i < topo->n_cpus; i++) {
 		fprintf(stream, "cpu[%d]: ", i);
 		fprintf(stream, ".package_id: %3.3d ", topo->cpu[i].package_id);
 		fprintf(stream, ".core_id: %3.3d ", topo->cpu[i].core_id);
+		fprintf(stream, ".node_id: %3.3d ", topo->cpu[i].node_id);
+		fprintf(stream, ".llc_id: %3.3d ", topo->cpu[i].llc_id);
+		fprintf(stream, ".capacity: %4d ", topo->cpu[i].capacity);
+		fprintf(stream, ".weight: %4d ", topo->cpu[i].weight);
+		for (int l = 1; l < CPU_CACHE_LEVELS; l++) {
+			if (topo->cpu[i].cache[l].size)
+				fprintf(stream, ".l%d: %zuK ", l,
+					topo->cpu[i].cache[l].size >> 10);
+		}
 		fprintf(stream, ".cpu_id: %3.3d\n", topo->cpu[i].cpu_id);
 	}
 
@@ -137,7 +350,7 @@ int one_cpu_per_core_cpu_topology(struct cpu_topology *topo, cpu_set_t *cpuset)
 {
 	int n_packages = topo->max_package_id + 1;
 	int n_cores = topo->max_core_id + 1;
-	int n_cpus = topo->max_cpu_id + 1;
+	int n_cpus = topo->n_cpus;
 	int assoc_cpu_s = n_packages * n_cores;
 
 	/* assoc_cpu[n_packages][n_cores] */
@@ -191,6 +404,468 @@ int cpu_set_search_next(int cpu, cpu_set_t *set)
 void get_full_cpuset(struct cpu_topology *topo, cpu_set_t *set)
 {
 	CPU_ZERO(set);
-	for (int i = 0; i < topo->max_cpu_id + 1; i++)
+	for (int i = 0; i < topo->n_cpus; i++)
 		CPU_SET(topo->cpu[i].cpu_id, set);
 }
+
+static const char *cpu_place_names[CPU_PLACE_COUNT] = {
+	[CPU_PLACE_LINEAR] = "linear", [CPU_PLACE_CORE] = "core",
+	[CPU_PLACE_SMT_LAST] = "smt",  [CPU_PLACE_NUMA] = "numa",
+	[CPU_PLACE_LLC] = "llc",
+};
+
+int cpu_place_parse(const char *str)
+{
+	for (int i = 0; i < CPU_PLACE_COUNT; i++) {
+		if (!strcmp(cpu_place_names[i], str))
+			return i;
+	}
+	fprintf(stderr, "Error: unknown placement %s\n", str);
+	return -1;
+}
+
+const char *cpu_place_name(int policy)
+{
+	return cpu_place_names[policy];
+}
+
+/* Sort key of a cpu, compared lexicographically */
+struct cpu_place_key {
+	int key[5];
+};
+
+static int cpu_place_key_cmp(const void *a, const void *b)
+{
+	const struct cpu_place_key *x = a, *y = b;
+	for (int i = 0; i < 5; i++) {
+		if (x->key[i] != y->key[i])
+			return x->key[i] < y->key[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+/* SMT rank of a cpu: number of its allowed siblings with lower ids */
+static int cpu_smt_rank(struct cpu_topology *topo, cpu_set_t *set,
+			struct cpu_topology_elem *cpu)
+{
+	int rank = 0;
+	for (int i = 0; i < topo->n_cpus; i++) {
+		struct cpu_topology_elem *other = &topo->cpu[i];
+		if (CPU_ISSET(other->cpu_id, set) &&
+		    other->cpu_id < cpu->cpu_id &&
+		    other->package_id == cpu->package_id &&
+		    other->core_id == cpu->core_id)
+			rank++;
+	}
+	return rank;
+}
+
+int cpu_topology_order(struct cpu_topology *topo, int policy, cpu_set_t *set,
+		       int *order)
+{
+	int n_cpus = topo->n_cpus;
+	struct cpu_place_key *keys = malloc(sizeof(*keys) * n_cpus);
+	int *ranks = malloc(sizeof(*ranks) * n_cpus);
+	if (!keys || !ranks) {
+		perror("Error: cpu_topology_order: malloc");
+		free(keys);
+		free(ranks);
+		return -1;
+	}
+
+	for (int i = 0; i < n_cpus; i++)
+		ranks[i] = cpu_smt_rank(topo, set, &topo->cpu[i]);
+
+	int n = 0;
+	for (int i = 0; i < n_cpus; i++) {
+		struct cpu_topology_elem *cpu = &topo->cpu[i];
+		if (!CPU_ISSET(cpu->cpu_id, set))
+			continue;
+
+		/* Same rank cpus of the node before it */
+		int node_pos = 0;
+		for (int j = 0; j < n_cpus; j++) {
+			struct cpu_topology_elem *other = &topo->cpu[j];
+			if (CPU_ISSET(other->cpu_id, set) &&
+			    other->cpu_id < cpu->cpu_id &&
+			    other->node_id == cpu->node_id &&
+			    ranks[j] == ranks[i])
+				node_pos++;
+		}
+
+		int *key = keys[n].key;
+		key[0] = key[1] = key[2] = key[3] = 0;
+		switch (policy) {
+		case CPU_PLACE_CORE:
+			if (ranks[i])
+				continue;
+			break;
+		case CPU_PLACE_SMT_LAST:
+			key[0] = ranks[i];
+			break;
+		case CPU_PLACE_NUMA:
+			key[0] = ranks[i];
+			key[1] = node_pos;
+			key[2] = cpu->node_id;
+			break;
+		case CPU_PLACE_LLC:
+			key[0] = ranks[i];
+			key[1] = cpu->node_id;
+			key[2] = cpu->llc_id;
+			key[3] = cpu->cache[2].domain;
+			break;
+		}
+		key[4] = cpu->cpu_id;
+		n++;
+	}
+
+	qsort(keys, n, sizeof(*keys), cpu_place_key_cmp);
+	for (int i = 0; i < n; i++)
+		order[i] = keys[i].key[4];
+
+	free(ranks);
+	free(keys);
+	return n;
+}
+
+static const char *cpu_weight_names[CPU_WEIGHT_COUNT] = {
+	[CPU_WEIGHT_EQUAL] = "equal",
+	[CPU_WEIGHT_CAPACITY] = "capacity",
+	[CPU_WEIGHT_FREQ] = "freq",
+	[CPU_WEIGHT_CALIBRATE] = "calibrate",
+};
+
+int cpu_weight_parse(const char *str)
+{
+	for (int i = 0; i < CPU_WEIGHT_COUNT; i++) {
+		if (!strcmp(cpu_weight_names[i], str))
+			return i;
+	}
+	fprintf(stderr, "Error: unknown weights %s\n", str);
+	return -1;
+}
+
+void cpu_topology_set_weights(struct cpu_topology *topo, int source)
+{
+	int max = 0;
+	for (int i = 0; i < topo->n_cpus; i++) {
+		struct cpu_topology_elem *cpu = &topo->cpu[i];
+		int val = source == CPU_WEIGHT_CAPACITY ? cpu->capacity :
+			  source == CPU_WEIGHT_FREQ     ? cpu->max_freq :
+							  0;
+		if (val > max)
+			max = val;
+	}
+
+	for (int i = 0; i < topo->n_cpus; i++) {
+		struct cpu_topology_elem *cpu = &topo->cpu[i];
+		int val = source == CPU_WEIGHT_CAPACITY ? cpu->capacity :
+			  source == CPU_WEIGHT_FREQ     ? cpu->max_freq :
+							  0;
+		/* Unknown for some cpu: treat it as the fastest */
+		cpu->weight = (max && val) ? (long long)val * 1024 / max : 1024;
+		if (cpu->weight < 1)
+			cpu->weight = 1;
+	}
+}
+
+struct cpu_topology_elem *cpu_topology_find(struct cpu_topology *topo,
+					    int cpu_id)
+{
+	int lo = 0, hi = topo->n_cpus;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (topo->cpu[mid].cpu_id < cpu_id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < topo->n_cpus && topo->cpu[lo].cpu_id == cpu_id)
+		return &topo->cpu[lo];
+	return NULL;
+}
+
+int cpu_list_parse(const char *str, cpu_set_t *set)
+{
+	CPU_ZERO(set);
+	while (*str && *str != '\n') {
+		char *endptr;
+		long from = strtol(str, &endptr, 10);
+		long to = from;
+		if (endptr == str || from < 0)
+			goto handle_err;
+		if (*endptr == '-') {
+			str = endptr + 1;
+			to = strtol(str, &endptr, 10);
+			if (endptr == str || to < from)
+				goto handle_err;
+		}
+		for (long cpu = from; cpu <= to && cpu < CPU_SETSIZE; cpu++)
+			CPU_SET(cpu, set);
+
+		str = endptr;
+		if (*str == ',')
+			str++;
+		else if (*str && *str != '\n')
+			goto handle_err;
+	}
+	return 0;
+
+handle_err:
+	fprintf(stderr, "Error: cpu_list_parse: wrong cpu list\n");
+	return -1;
+}
+
+/* Path of the process cgroup: v2 if controller is NULL, -1 if none */
+static int cgroup_self_path(const char *controller, char *path)
+{
+	FILE *file = fopen("/proc/self/cgroup", "r");
+	if (!file)
+		return -1;
+
+	char line[PATH_MAX + 64];
+	int found = -1;
+	while (found && fgets(line, sizeof(line), file)) {
+		line[strcspn(line, "\n")] = '\0';
+		char *ctrls = strchr(line, ':');
+		char *cg_path = ctrls ? strchr(ctrls + 1, ':') : NULL;
+		if (!cg_path)
+			continue;
+		*ctrls++ = '\0';
+		*cg_path++ = '\0';
+
+		if (!controller) {
+			found = (strcmp(line, "0") || *ctrls) ? -1 : 0;
+		} else {
+			for (char *tok = strtok(ctrls, ","); tok && found;
+			     tok = strtok(NULL, ","))
+				found = strcmp(tok, controller) ? -1 : 0;
+		}
+		if (!found)
+			snprintf(path, PATH_MAX, "%s", cg_path);
+	}
+
+	fclose(file);
+	return found;
+}
+
+/* Cgroup dir one level up, 0 at the mount root */
+static int cgroup_parent(char *dir, size_t root_len)
+{
+	char *slash = strrchr(dir + root_len, '/');
+	if (!slash)
+		return 0;
+	*slash = '\0';
+	return 1;
+}
+
+/* Smallest quota / period of the cgroup and its ancestors */
+static double cgroup_quota(const char *root, const char *path, int v2)
+{
+	char dir[PATH_MAX];
+	char buf[PATH_MAX];
+	char str[64];
+	double quota = 0;
+
+	path_fmt(dir, "%s%s", root, strcmp(path, "/") ? path : "");
+	do {
+		long long q = -1, period = 0;
+		if (v2) {
+			path_fmt(buf, "%s/cpu.max", dir);
+			if (access(buf, R_OK) || file_read_str(buf, str,
+							       sizeof(str)))
+				continue;
+			if (sscanf(str, "%lld %lld", &q, &period) != 2)
+				q = -1; /* "max" */
+		} else {
+			int tmp;
+			path_fmt(buf, "%s/cpu.cfs_quota_us", dir);
+			if (access(buf, R_OK) || file_read_num(buf, &tmp))
+				continue;
+			q = tmp;
+			path_fmt(buf, "%s/cpu.cfs_period_us", dir);
+			if (file_read_num(buf, &tmp))
+				continue;
+			period = tmp;
+		}
+
+		if (q > 0 && period > 0 && (!quota || (double)q / period < quota))
+			quota = (double)q / period;
+	} while (cgroup_parent(dir, strlen(root)));
+
+	return quota;
+}
+
+/* Nearest cpuset of the cgroup and its ancestors, -1 if none */
+static int cgroup_cpuset(const char *root, const char *path, const char *name,
+			 cpu_set_t *set)
+{
+	char dir[PATH_MAX];
+	char buf[PATH_MAX];
+	char str[8192];
+
+	path_fmt(dir, "%s%s", root, strcmp(path, "/") ? path : "");
+	do {
+		path_fmt(buf, "%s/%s", dir, name);
+		if (access(buf, R_OK) || file_read_str(buf, str, sizeof(str)))
+			continue;
+		if (str[0] == '\0')
+			continue;
+		return cpu_list_parse(str, set);
+	} while (cgroup_parent(dir, strlen(root)));
+
+	return -1;
+}
+
+int get_cpu_budget(struct cpu_topology *topo, struct cpu_budget *budget)
+{
+	get_full_cpuset(topo, &budget->cpuset);
+	budget->quota = 0;
+
+	cpu_set_t tmp;
+	if (sched_getaffinity(0, sizeof(tmp), &tmp) == -1) {
+		perror("Error: get_cpu_budget: sched_getaffinity");
+		return -1;
+	}
+	CPU_AND(&budget->cpuset, &budget->cpuset, &tmp);
+
+	const char *sysfs = getenv("CPU_TOPOLOGY_SYSFS");
+	char root[PATH_MAX];
+	char path[PATH_MAX];
+	if (!sysfs)
+		sysfs = CPU_TOPOLOGY_SYSFS;
+
+	/* v2 is mounted at fs/cgroup, or at fs/cgroup/unified if hybrid */
+	path_fmt(root, "%s/fs/cgroup/cgroup.controllers", sysfs);
+	int v2_root = !access(root, R_OK);
+	path_fmt(root, "%s/fs/cgroup%s", sysfs, v2_root ? "" : "/unified");
+
+	if (!cgroup_self_path(NULL, path)) {
+		budget->quota = cgroup_quota(root, path, 1);
+		if (!cgroup_cpuset(root, path, "cpuset.cpus.effective", &tmp))
+			CPU_AND(&budget->cpuset, &budget->cpuset, &tmp);
+	}
+
+	if (!v2_root && !cgroup_self_path("cpu", path)) {
+		path_fmt(root, "%s/fs/cgroup/cpu", sysfs);
+		double quota = cgroup_quota(root, path, 0);
+		if (quota && (!budget->quota || quota < budget->quota))
+			budget->quota = quota;
+	}
+	if (!v2_root && !cgroup_self_path("cpuset", path)) {
+		path_fmt(root, "%s/fs/cgroup/cpuset", sysfs);
+		if (!cgroup_cpuset(root, path, "cpuset.effective_cpus", &tmp))
+			CPU_AND(&budget->cpuset, &budget->cpuset, &tmp);
+	}
+
+	if (CPU_COUNT(&budget->cpuset) == 0) {
+		fprintf(stderr, "Error: get_cpu_budget: no cpus allowed\n");
+		return -1;
+	}
+
+	/* Whole cpus only: a partial one would be throttled */
+	budget->n_cpus = CPU_COUNT(&budget->cpuset);
+	if (budget->quota && budget->quota < budget->n_cpus)
+		budget->n_cpus = budget->quota < 1 ? 1 : (int)budget->quota;
+
+	return 0;
+}
+
+void dump_cpu_budget(FILE *stream, struct cpu_budget *budget)
+{
+	fprintf(stream, "cpu budget: %d cpus of %d allowed, quota: ",
+		budget->n_cpus, CPU_COUNT(&budget->cpuset));
+	if (budget->quota)
+		fprintf(stream, "%.2f\n", budget->quota);
+	else
+		fprintf(stream, "max\n");
+}
+
+/************************** Selfcheck *******************************/
+
+/*
+ * CPU_TOPOLOGY_FIXTURE: 2 packages = NUMA nodes = L3 domains, 2 cores
+ * each, 2 SMT siblings per core (cpu n and n + 4). L1d 32K and L2 1M
+ * per core, L3 16M per package. Package 1 runs at half the capacity.
+ */
+struct cpu_topology_expect {
+	int package_id;
+	int core_id;
+	int node_id;
+	int llc_id;
+	int capacity;
+	int max_freq;
+};
+
+static const struct cpu_topology_expect cpu_topology_fixture[] = {
+	{ 0, 0, 0, 0, 1024, 3000000 }, { 0, 1, 0, 0, 1024, 3000000 },
+	{ 1, 0, 1, 2, 512, 2000000 },  { 1, 1, 1, 2, 512, 2000000 },
+	{ 0, 0, 0, 0, 1024, 3000000 }, { 0, 1, 0, 0, 1024, 3000000 },
+	{ 1, 0, 1, 2, 512, 2000000 },  { 1, 1, 1, 2, 512, 2000000 },
+};
+
+#define CPU_TOPOLOGY_CHECK(cond)                                               \
+	do {                                                                   \
+		if (!(cond)) {                                                 \
+			fprintf(stream, "topology %s: FAILED %s\n", root,     \
+				#cond);                                        \
+			n_failed++;                                            \
+		}                                                              \
+	} while (0)
+
+int cpu_topology_selfcheck(FILE *stream, const char *root)
+{
+	struct cpu_topology topo;
+	if (get_cpu_topology_at(&topo, root)) {
+		fprintf(stream, "topology %s: read FAILED\n", root);
+		return -1;
+	}
+
+	int n_failed = 0;
+	int n_cpus = sizeof(cpu_topology_fixture) /
+		     sizeof(cpu_topology_fixture[0]);
+	CPU_TOPOLOGY_CHECK(topo.n_cpus == n_cpus);
+	CPU_TOPOLOGY_CHECK(topo.max_package_id == 1);
+	CPU_TOPOLOGY_CHECK(topo.max_core_id == 1);
+	CPU_TOPOLOGY_CHECK(topo.max_node_id == 1);
+	CPU_TOPOLOGY_CHECK(topo.llc_level == 3);
+	CPU_TOPOLOGY_CHECK(cpu_topology_cache_size(&topo, 1) == 32 << 10);
+	CPU_TOPOLOGY_CHECK(cpu_topology_cache_size(&topo, 2) == 1 << 20);
+	CPU_TOPOLOGY_CHECK(cpu_topology_cache_size(&topo, 3) == 16 << 20);
+
+	for (int i = 0; i < topo.n_cpus && i < n_cpus; i++) {
+		const struct cpu_topology_expect *exp =
+			&cpu_topology_fixture[i];
+		struct cpu_topology_elem *cpu = &topo.cpu[i];
+		CPU_TOPOLOGY_CHECK(cpu->cpu_id == i);
+		CPU_TOPOLOGY_CHECK(cpu->package_id == exp->package_id);
+		CPU_TOPOLOGY_CHECK(cpu->core_id == exp->core_id);
+		CPU_TOPOLOGY_CHECK(cpu->node_id == exp->node_id);
+		CPU_TOPOLOGY_CHECK(cpu->llc_id == exp->llc_id);
+		CPU_TOPOLOGY_CHECK(cpu->capacity == exp->capacity);
+		CPU_TOPOLOGY_CHECK(cpu->max_freq == exp->max_freq);
+		CPU_TOPOLOGY_CHECK(cpu->cache[1].domain == i % 4);
+		CPU_TOPOLOGY_CHECK(cpu->cache[2].domain == i % 4);
+	}
+
+	/* Capacity weights: package 1 gets half the work */
+	cpu_topology_set_weights(&topo, CPU_WEIGHT_CAPACITY);
+	for (int i = 0; i < topo.n_cpus && i < n_cpus; i++) {
+		CPU_TOPOLOGY_CHECK(topo.cpu[i].weight ==
+				   cpu_topology_fixture[i].capacity);
+	}
+
+	/* Placement: physical cores first, siblings after them */
+	cpu_set_t set;
+	get_full_cpuset(&topo, &set);
+	int order[CPU_SETSIZE];
+	int n = cpu_topology_order(&topo, CPU_PLACE_SMT_LAST, &set, order);
+	CPU_TOPOLOGY_CHECK(n == n_cpus);
+	for (int i = 0; i < n && i < n_cpus; i++)
+		CPU_TOPOLOGY_CHECK((order[i] < 4) == (i < 4));
+
+	fprintf(stream, "topology %s: %s (%d cpus)\n", root,
+		n_failed ? "FAILED" : "ok", topo.n_cpus);
+	free_cpu_topology(&topo);
+	return n_failed ? -1 : 0;
+}
@@ -6,24 +6,51 @@
 #endif
 
 #include <sched.h>
+#include <stddef.h>
 #include <stdio.h>
 
+/* Default sysfs root, CPU_TOPOLOGY_SYSFS env overrides it */
+#define CPU_TOPOLOGY_SYSFS "/sys"
+
+/* Data and unified caches by level, [0] unused */
+#define CPU_CACHE_LEVELS 5
+
+struct cpu_cache {
+	size_t size; /* 0 if absent */
+	int domain; /* lowest cpu id of shared_cpu_list */
+};
+
 struct cpu_topology_elem {
 	int package_id;
 	int core_id;
 	int cpu_id;
+	int node_id; /* NUMA node, 0 without NUMA */
+	int llc_id; /* last level cache domain, package_id if unknown */
+	int capacity; /* cpu_capacity, 1024 if unknown */
+	int max_freq; /* cpufreq cpuinfo_max_freq in kHz, 0 if unknown */
+	int weight; /* relative throughput, 1024 for the fastest cpu */
+	struct cpu_cache cache[CPU_CACHE_LEVELS];
 };
 
 struct cpu_topology {
-	struct cpu_topology_elem cpu[CPU_SETSIZE - 1];
+	struct cpu_topology_elem *cpu; /* n_cpus, in cpu id order */
+	int n_cpus;
 	int max_package_id;
 	int max_core_id;
 	int max_cpu_id;
+	int max_node_id;
+	int llc_level; /* 0 if caches are unknown */
 };
 
+/* Reads <root>/devices/system/cpu, root NULL: default */
+int get_cpu_topology_at(struct cpu_topology *topo, const char *root);
 int get_cpu_topology(struct cpu_topology *topo);
+void free_cpu_topology(struct cpu_topology *topo);
 int dump_cpu_topology(FILE *stream, struct cpu_topology *topo);
 
+/* Smallest size of a cache level among cpus, 0 if unknown */
+size_t cpu_topology_cache_size(struct cpu_topology *topo, int level);
+
 /* Set cores in cpuset, not used in project */
 int one_cpu_per_core_cpu_topology(struct cpu_topology *topo, cpu_set_t *cpuset);
 
@@ -33,4 +60,61 @@ int cpu_set_search_next(int cpu, cpu_set_t *set);
 /* Convert topo to cpuset */
 void get_full_cpuset(struct cpu_topology *topo, cpu_set_t *set);
 
+/* Thread placement: order in which cpus of a cpuset are taken */
+enum cpu_place {
+	CPU_PLACE_LINEAR, /* cpu id order */
+	CPU_PLACE_CORE, /* one cpu per physical core, no SMT siblings */
+	CPU_PLACE_SMT_LAST, /* all physical cores, then their siblings */
+	CPU_PLACE_NUMA, /* cores round-robin over NUMA nodes, siblings last */
+	CPU_PLACE_LLC, /* LLC domains one by one, L2 ones inside, siblings last */
+	CPU_PLACE_COUNT
+};
+
+/* "linear", "core", "smt", "numa", "llc"; -1 if unknown */
+int cpu_place_parse(const char *str);
+const char *cpu_place_name(int policy);
+
+/* Cpus of set in placement order, returns their number */
+int cpu_topology_order(struct cpu_topology *topo, int policy, cpu_set_t *set,
+		       int *order);
+
+/* Source of cpu weights */
+enum cpu_weight {
+	CPU_WEIGHT_EQUAL,
+	CPU_WEIGHT_CAPACITY, /* cpu_capacity */
+	CPU_WEIGHT_FREQ, /* cpuinfo_max_freq */
+	CPU_WEIGHT_CALIBRATE, /* short run on every cpu, see integrate.h */
+	CPU_WEIGHT_COUNT
+};
+
+/* "equal", "capacity", "freq", "calibrate"; -1 if unknown */
+int cpu_weight_parse(const char *str);
+
+/* Capacity or frequency weights, equal ones if the source is absent */
+void cpu_topology_set_weights(struct cpu_topology *topo, int source);
+
+/* Cpu by id, NULL if absent */
+struct cpu_topology_elem *cpu_topology_find(struct cpu_topology *topo,
+					    int cpu_id);
+
+/* "0-3,8,10-11" */
+int cpu_list_parse(const char *str, cpu_set_t *set);
+
+/* Cpus the process may use and how many of them it may keep busy */
+struct cpu_budget {
+	cpu_set_t cpuset; /* topology & sched affinity & cgroup cpuset */
+	double quota; /* cgroup cpu.max in cpus, 0 if unlimited */
+	int n_cpus; /* cpus in cpuset, capped by quota, at least 1 */
+};
+
+/* Cgroup v2, or v1 cpu and cpuset controllers, under the sysfs root */
+int get_cpu_budget(struct cpu_topology *topo, struct cpu_budget *budget);
+void dump_cpu_budget(FILE *stream, struct cpu_budget *budget);
+
+/* Recorded sysfs tree of the selfcheck, relative to the source dir */
+#define CPU_TOPOLOGY_FIXTURE "testdata/sysfs_2node_smt"
+
+/* Parses the CPU_TOPOLOGY_FIXTURE tree at root, checks what it read */
+int cpu_topology_selfcheck(FILE *stream, const char *root);
+
 #endif /* CPU_TOPOLOGY_H_ */
@@ -0,0 +1,592 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "dump_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <strings.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+enum log_arg_type {
+	LOG_ARG_NONE, /* %% or unsupported, printed as is */
+	LOG_ARG_INT,
+	LOG_ARG_UINT,
+	LOG_ARG_DBL,
+	LOG_ARG_LDBL,
+	LOG_ARG_STR,
+	LOG_ARG_PTR,
+};
+
+enum log_arg_len {
+	LOG_LEN_NONE,
+	LOG_LEN_HH,
+	LOG_LEN_H,
+	LOG_LEN_L,
+	LOG_LEN_LL,
+	LOG_LEN_Z,
+	LOG_LEN_J,
+	LOG_LEN_T,
+	LOG_LEN_BIG_L,
+};
+
+/* One conversion, text rewritten for the stored arg type */
+struct log_spec {
+	char text[32];
+	int n_star; /* '*' width and precision args before the value */
+	int type;
+	int len;
+};
+
+union log_arg {
+	long long i;
+	unsigned long long u;
+	double d;
+	long double ld;
+	const void *p;
+	size_t str; /* offset in log_record.str */
+};
+
+struct log_record {
+	const char *fmt;
+	uint64_t ts;
+	int n_args;
+	union log_arg args[DUMP_LOG_MAX_ARGS];
+	char str[DUMP_LOG_STR_MAX];
+};
+
+enum log_ring_state {
+	LOG_RING_USED,
+	LOG_RING_EXITED, /* owner gone, records left to flush */
+	LOG_RING_FREE, /* flushed, another thread may take it */
+};
+
+/* Single producer (own thread), single consumer (flush under lock) */
+struct log_ring {
+	uint64_t head;
+	uint64_t tail;
+	uint64_t dropped;
+	int state;
+
+	/* Token bucket of the producer */
+	double tokens;
+	uint64_t last_ns;
+
+	struct log_record rec[DUMP_LOG_RING];
+};
+
+static struct log_ring *log_rings[DUMP_LOG_MAX_THREADS];
+static int log_n_rings;
+static __thread struct log_ring *log_ring_self;
+static __thread int log_ring_failed;
+
+static int log_level = DUMP_LOG_LVL_DEBUG;
+static int log_rate = DUMP_LOG_RATE;
+static int log_sync; /* no flusher thread: format in place */
+
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_key; /* ring, handed back at thread exit */
+static int log_key_ok;
+static pthread_mutex_t log_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t log_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* p is after '%', returns the conversion char */
+static const char *log_spec_parse(const char *p, struct log_spec *spec)
+{
+	const char *start = p;
+	spec->n_star = 0;
+	spec->len = LOG_LEN_NONE;
+
+	p += strspn(p, "-+ #0");
+	if (*p == '*') {
+		spec->n_star++;
+		p++;
+	}
+	p += strspn(p, "0123456789");
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			spec->n_star++;
+			p++;
+		}
+		p += strspn(p, "0123456789");
+	}
+	const char *width_end = p;
+
+	if (p[0] == 'h' && p[1] == 'h')
+		spec->len = LOG_LEN_HH, p += 2;
+	else if (p[0] == 'l' && p[1] == 'l')
+		spec->len = LOG_LEN_LL, p += 2;
+	else if (*p == 'h')
+		spec->len = LOG_LEN_H, p++;
+	else if (*p == 'l')
+		spec->len = LOG_LEN_L, p++;
+	else if (*p == 'z')
+		spec->len = LOG_LEN_Z, p++;
+	else if (*p == 'j')
+		spec->len = LOG_LEN_J, p++;
+	else if (*p == 't')
+		spec->len = LOG_LEN_T, p++;
+	else if (*p == 'L')
+		spec->len = LOG_LEN_BIG_L, p++;
+
+	const char *suffix = "";
+	switch (*p) {
+	case 'd':
+	case 'i':
+		spec->type = LOG_ARG_INT;
+		suffix = "ll";
+		break;
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'o':
+		spec->type = LOG_ARG_UINT;
+		suffix = "ll";
+		break;
+	case 'c':
+		spec->type = LOG_ARG_INT;
+		break;
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		spec->type = spec->len == LOG_LEN_BIG_L ? LOG_ARG_LDBL :
+							  LOG_ARG_DBL;
+		suffix = spec->len == LOG_LEN_BIG_L ? "L" : "";
+		break;
+	case 's':
+		spec->type = LOG_ARG_STR;
+		break;
+	case 'p':
+		spec->type = LOG_ARG_PTR;
+		break;
+	default:
+		spec->type = LOG_ARG_NONE;
+		spec->n_star = 0;
+		if (*p == '\0')
+			p--;
+		return p;
+	}
+
+	int n = snprintf(spec->text, sizeof(spec->text), "%%%.*s%s%c",
+			 (int)(width_end - start), start, suffix, *p);
+	if (n >= (int)sizeof(spec->text))
+		spec->type = LOG_ARG_NONE;
+	return p;
+}
+
+static void log_capture(struct log_record *rec, va_list ap)
+{
+	size_t str_used = 0;
+	int n = 0;
+
+	for (const char *p = rec->fmt; *p; p++) {
+		if (*p != '%')
+			continue;
+		struct log_spec spec;
+		p = log_spec_parse(p + 1, &spec);
+		if (spec.type == LOG_ARG_NONE)
+			continue;
+		if (n + spec.n_star + 1 > DUMP_LOG_MAX_ARGS)
+			break;
+
+		for (int s = 0; s < spec.n_star; s++)
+			rec->args[n++].i = va_arg(ap, int);
+
+		union log_arg *arg = &rec->args[n++];
+		switch (spec.type) {
+		case LOG_ARG_INT:
+			switch (spec.len) {
+			case LOG_LEN_HH:
+				arg->i = (signed char)va_arg(ap, int);
+				break;
+			case LOG_LEN_H:
+				arg->i = (short)va_arg(ap, int);
+				break;
+			case LOG_LEN_L:
+				arg->i = va_arg(ap, long);
+				break;
+			case LOG_LEN_LL:
+				arg->i = va_arg(ap, long long);
+				break;
+			case LOG_LEN_Z:
+				arg->i = va_arg(ap, ssize_t);
+				break;
+			case LOG_LEN_J:
+				arg->i = va_arg(ap, intmax_t);
+				break;
+			case LOG_LEN_T:
+				arg->i = va_arg(ap, ptrdiff_t);
+				break;
+			default:
+				arg->i = va_arg(ap, int);
+			}
+			break;
+		case LOG_ARG_UINT:
+			switch (spec.len) {
+			case LOG_LEN_HH:
+				arg->u = (unsigned char)va_arg(ap, unsigned);
+				break;
+			case LOG_LEN_H:
+				arg->u = (unsigned short)va_arg(ap, unsigned);
+				break;
+			case LOG_LEN_L:
+				arg->u = va_arg(ap, unsigned long);
+				break;
+			case LOG_LEN_LL:
+				arg->u = va_arg(ap, unsigned long long);
+				break;
+			case LOG_LEN_Z:
+				arg->u = va_arg(ap, size_t);
+				break;
+			case LOG_LEN_J:
+				arg->u = va_arg(ap, uintmax_t);
+				break;
+			case LOG_LEN_T:
+				arg->u = va_arg(ap, ptrdiff_t);
+				break;
+			default:
+				arg->u = va_arg(ap, unsigned);
+			}
+			break;
+		case LOG_ARG_DBL:
+			arg->d = va_arg(ap, double);
+			break;
+		case LOG_ARG_LDBL:
+			arg->ld = va_arg(ap, long double);
+			break;
+		case LOG_ARG_PTR:
+			arg->p = va_arg(ap, void *);
+			break;
+		case LOG_ARG_STR: {
+			const char *str = va_arg(ap, const char *);
+			if (!str)
+				str = "(null)";
+			size_t len = strnlen(str, DUMP_LOG_STR_MAX - 1 -
+							  str_used);
+			memcpy(rec->str + str_used, str, len);
+			rec->str[str_used + len] = '\0';
+			arg->str = str_used;
+			str_used += len + 1;
+			if (str_used > DUMP_LOG_STR_MAX - 1)
+				str_used = DUMP_LOG_STR_MAX - 1;
+			break;
+		}
+		}
+	}
+	rec->n_args = n;
+}
+
+#define LOG_SNPRINTF(buf, size, spec, star, val)                               \
+	((spec)->n_star == 0 ?                                                 \
+		 snprintf(buf, size, (spec)->text, val) :                      \
+	 (spec)->n_star == 1 ?                                                 \
+		 snprintf(buf, size, (spec)->text, (int)(star)[0].i, val) :    \
+		 snprintf(buf, size, (spec)->text, (int)(star)[0].i,           \
+			  (int)(star)[1].i, val))
+
+static void log_format(const struct log_record *rec, char *buf, size_t size)
+{
+	size_t pos = 0;
+	int n = 0;
+
+	for (const char *p = rec->fmt; *p && pos + 1 < size; p++) {
+		if (*p != '%') {
+			buf[pos++] = *p;
+			continue;
+		}
+		const char *start = p;
+		struct log_spec spec;
+		p = log_spec_parse(p + 1, &spec);
+		if (spec.type == LOG_ARG_NONE ||
+		    n + spec.n_star + 1 > rec->n_args) {
+			/* %% prints '%', unsupported ones as is */
+			size_t len = p[0] == '%' && p == start + 1 ?
+					     1 :
+					     (size_t)(p - start + 1);
+			if (len > size - 1 - pos)
+				len = size - 1 - pos;
+			memcpy(buf + pos, p[0] == '%' ? p : start, len);
+			pos += len;
+			continue;
+		}
+
+		const union log_arg *star = &rec->args[n];
+		const union log_arg *arg = &rec->args[n + spec.n_star];
+		n += spec.n_star + 1;
+
+		char *dst = buf + pos;
+		size_t left = size - pos;
+		int ret = 0;
+		switch (spec.type) {
+		case LOG_ARG_INT:
+			ret = spec.text[strlen(spec.text) - 1] == 'c' ?
+				      LOG_SNPRINTF(dst, left, &spec, star,
+						   (int)arg->i) :
+				      LOG_SNPRINTF(dst, left, &spec, star, arg->i);
+			break;
+		case LOG_ARG_UINT:
+			ret = LOG_SNPRINTF(dst, left, &spec, star, arg->u);
+			break;
+		case LOG_ARG_DBL:
+			ret = LOG_SNPRINTF(dst, left, &spec, star, arg->d);
+			break;
+		case LOG_ARG_LDBL:
+			ret = LOG_SNPRINTF(dst, left, &spec, star, arg->ld);
+			break;
+		case LOG_ARG_PTR:
+			ret = LOG_SNPRINTF(dst, left, &spec, star, arg->p);
+			break;
+		case LOG_ARG_STR:
+			ret = LOG_SNPRINTF(dst, left, &spec, star,
+					   rec->str + arg->str);
+			break;
+		}
+		if (ret > 0)
+			pos += (size_t)ret < left ? (size_t)ret : left - 1;
+	}
+	buf[pos] = '\0';
+}
+
+/* Oldest records of all threads first */
+static void log_drain(void)
+{
+	int n_rings = __atomic_load_n(&log_n_rings, __ATOMIC_ACQUIRE);
+	if (n_rings > DUMP_LOG_MAX_THREADS)
+		n_rings = DUMP_LOG_MAX_THREADS;
+
+	char line[1024];
+	while (1) {
+		struct log_ring *next = NULL;
+		for (int r = 0; r < n_rings; r++) {
+			struct log_ring *ring =
+				__atomic_load_n(&log_rings[r], __ATOMIC_ACQUIRE);
+			if (!ring || ring->tail ==
+					     __atomic_load_n(&ring->head,
+							     __ATOMIC_ACQUIRE))
+				continue;
+			if (!next ||
+			    ring->rec[ring->tail % DUMP_LOG_RING].ts <
+				    next->rec[next->tail % DUMP_LOG_RING].ts)
+				next = ring;
+		}
+		if (!next)
+			break;
+
+		log_format(&next->rec[next->tail % DUMP_LOG_RING], line,
+			   sizeof(line));
+		fputs(line, stderr);
+		__atomic_store_n(&next->tail, next->tail + 1, __ATOMIC_RELEASE);
+	}
+
+	for (int r = 0; r < n_rings; r++) {
+		struct log_ring *ring =
+			__atomic_load_n(&log_rings[r], __ATOMIC_ACQUIRE);
+		uint64_t dropped =
+			ring ? __atomic_exchange_n(&ring->dropped, 0,
+						   __ATOMIC_RELAXED) :
+			       0;
+		if (dropped)
+			fprintf(stderr, "DUMP_LOG: %llu records of thread %d "
+					"dropped\n",
+				(unsigned long long)dropped, r);
+
+		/* Flushed ring of an exited thread is free to reuse */
+		int exited = LOG_RING_EXITED;
+		if (ring && ring->tail == __atomic_load_n(&ring->head,
+							  __ATOMIC_ACQUIRE))
+			__atomic_compare_exchange_n(&ring->state, &exited,
+						    LOG_RING_FREE, 0,
+						    __ATOMIC_RELEASE,
+						    __ATOMIC_RELAXED);
+	}
+	fflush(stderr);
+}
+
+void dump_log_flush(void)
+{
+	pthread_mutex_lock(&log_flush_lock);
+	log_drain();
+	pthread_mutex_unlock(&log_flush_lock);
+}
+
+/* Off the pinned compute cpus its creator may run on */
+static void *log_flusher(void *arg)
+{
+	(void)arg;
+	cpu_set_t all;
+	CPU_ZERO(&all);
+	for (int i = 0; i < CPU_SETSIZE; i++)
+		CPU_SET(i, &all);
+	sched_setaffinity(0, sizeof(all), &all);
+
+	struct timespec period = { 0, DUMP_LOG_FLUSH_MS * 1000000L };
+	while (1) {
+		nanosleep(&period, NULL);
+		dump_log_flush();
+	}
+	return NULL;
+}
+
+/* Thread exit: the flusher frees the ring once it is drained */
+static void log_ring_exit(void *arg)
+{
+	struct log_ring *ring = arg;
+	log_ring_self = NULL;
+	__atomic_store_n(&ring->state, LOG_RING_EXITED, __ATOMIC_RELEASE);
+}
+
+static void log_start(void)
+{
+	static const char *const levels[] = {
+		[DUMP_LOG_LVL_ERROR] = "error",
+		[DUMP_LOG_LVL_WARN] = "warn",
+		[DUMP_LOG_LVL_INFO] = "info",
+		[DUMP_LOG_LVL_DEBUG] = "debug",
+	};
+	const char *env = getenv("INTEGRATE_LOG_LEVEL");
+	for (int i = 0; env && i <= DUMP_LOG_LVL_DEBUG; i++) {
+		if (!strcasecmp(env, levels[i]))
+			log_level = i;
+	}
+	env = getenv("INTEGRATE_LOG_RATE");
+	if (env)
+		log_rate = atoi(env);
+
+	log_key_ok = !pthread_key_create(&log_key, log_ring_exit);
+
+	pthread_attr_t attr;
+	pthread_t thread;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, log_flusher, NULL))
+		log_sync = 1;
+	pthread_attr_destroy(&attr);
+	atexit(dump_log_flush);
+}
+
+void dump_log_set_level(int level)
+{
+	pthread_once(&log_once, log_start);
+	log_level = level;
+}
+
+void dump_log_set_rate(int records_per_sec)
+{
+	pthread_once(&log_once, log_start);
+	log_rate = records_per_sec;
+}
+
+/* Free ring of an exited thread, NULL if none */
+static struct log_ring *log_ring_reuse(void)
+{
+	int n_rings = __atomic_load_n(&log_n_rings, __ATOMIC_ACQUIRE);
+	if (n_rings > DUMP_LOG_MAX_THREADS)
+		n_rings = DUMP_LOG_MAX_THREADS;
+
+	for (int r = 0; r < n_rings; r++) {
+		struct log_ring *ring =
+			__atomic_load_n(&log_rings[r], __ATOMIC_ACQUIRE);
+		int free_state = LOG_RING_FREE;
+		if (ring && __atomic_compare_exchange_n(&ring->state,
+							&free_state,
+							LOG_RING_USED, 0,
+							__ATOMIC_ACQUIRE,
+							__ATOMIC_RELAXED))
+			return ring;
+	}
+	return NULL;
+}
+
+static struct log_ring *log_ring_get(void)
+{
+	if (log_ring_self || log_ring_failed)
+		return log_ring_self;
+
+	struct log_ring *ring = log_key_ok ? log_ring_reuse() : NULL;
+	if (!ring) {
+		int idx = __atomic_fetch_add(&log_n_rings, 1,
+					     __ATOMIC_RELAXED);
+		if (idx < DUMP_LOG_MAX_THREADS)
+			ring = calloc(1, sizeof(*ring));
+		if (!ring) {
+			log_ring_failed = 1;
+			return NULL;
+		}
+		__atomic_store_n(&log_rings[idx], ring, __ATOMIC_RELEASE);
+	}
+	ring->tokens = log_rate;
+	ring->last_ns = log_now();
+
+	if (log_key_ok)
+		pthread_setspecific(log_key, ring);
+	log_ring_self = ring;
+	return ring;
+}
+
+/* Token bucket of rate records per second, burst of one second */
+static int log_rate_allow(struct log_ring *ring, uint64_t now)
+{
+	int rate = log_rate;
+	if (rate <= 0)
+		return 1;
+
+	ring->tokens += (double)(now - ring->last_ns) * rate * 1e-9;
+	ring->last_ns = now;
+	if (ring->tokens > rate)
+		ring->tokens = rate;
+	if (ring->tokens < 1)
+		return 0;
+	ring->tokens -= 1;
+	return 1;
+}
+
+void dump_log(int level, const char *fmt, ...)
+{
+	pthread_once(&log_once, log_start);
+	if (level > log_level)
+		return;
+
+	struct log_ring *ring = log_ring_get();
+	if (!ring)
+		return;
+
+	uint64_t now = log_now();
+	uint64_t head = ring->head;
+	if (!log_rate_allow(ring, now) ||
+	    head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ==
+		    DUMP_LOG_RING) {
+		__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	struct log_record *rec = &ring->rec[head % DUMP_LOG_RING];
+	rec->fmt = fmt;
+	rec->ts = now;
+	va_list ap;
+	va_start(ap, fmt);
+	log_capture(rec, ap);
+	va_end(ap);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	if (log_sync)
+		dump_log_flush();
+}
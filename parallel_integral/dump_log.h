@@ -0,0 +1,39 @@
+#ifndef DUMP_LOG_H_
+#define DUMP_LOG_H_
+
+/*
+ * Asynchronous log: callers store binary records (format pointer and
+ * raw args) in their own lock-free ring, a background thread formats
+ * and writes them to stderr. A full ring drops records, callers never
+ * wait for stderr. Records are flushed at exit. Rings of exited threads
+ * are reused once flushed, DUMP_LOG_MAX_THREADS bounds live threads.
+ *
+ * INTEGRATE_LOG_LEVEL: error, warn, info, debug (default)
+ * INTEGRATE_LOG_RATE: records per second per thread, 0: unlimited
+ */
+
+#define DUMP_LOG_RING 1024
+#define DUMP_LOG_MAX_ARGS 12
+#define DUMP_LOG_STR_MAX 128 /* copied %s text per record */
+#define DUMP_LOG_MAX_THREADS 256
+#define DUMP_LOG_FLUSH_MS 10
+#define DUMP_LOG_RATE 10000
+
+enum dump_log_level {
+	DUMP_LOG_LVL_ERROR,
+	DUMP_LOG_LVL_WARN,
+	DUMP_LOG_LVL_INFO,
+	DUMP_LOG_LVL_DEBUG,
+};
+
+/* Format is kept by pointer: string literals only */
+void dump_log(int level, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+void dump_log_set_level(int level);
+void dump_log_set_rate(int records_per_sec);
+
+/* Write out everything recorded so far */
+void dump_log_flush(void);
+
+#endif /* DUMP_LOG_H_ */
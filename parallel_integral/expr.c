@@ -0,0 +1,755 @@
+#include "expr.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define EXPR_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define EXPR_CLONES
+#endif
+
+/* Independent accumulators of expr_sum_grid */
+#define EXPR_LANES 16
+
+/*************************** SIMD math ******************************/
+
+/*
+ * Branch-free versions of libm functions: the loops over a block in
+ * expr_eval_block vectorize with them for every target clone.
+ * exp clamps to [-708, 709], sin/cos reduce accurately for |x| < 1e6,
+ * log treats denormals as garbage.
+ */
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+ALWAYS_INLINE double as_double(uint64_t u)
+{
+	double d;
+	memcpy(&d, &u, sizeof(d));
+	return d;
+}
+
+ALWAYS_INLINE uint64_t as_uint(double d)
+{
+	uint64_t u;
+	memcpy(&u, &d, sizeof(u));
+	return u;
+}
+
+/* x + MAGIC rounds to integer in the low mantissa bits */
+#define MAGIC 0x1.8p52
+
+#define LN2_HI 0x1.62e42fee00000p-1
+#define LN2_LO 0x1.a39ef35793c76p-33
+#define LOG2E 0x1.71547652b82fep0
+
+ALWAYS_INLINE double vexp(double x)
+{
+	x = x < -708. ? -708. : x;
+	x = x > 709. ? 709. : x;
+
+	/* x = n * ln2 + r, |r| <= ln2 / 2 */
+	double t = x * LOG2E + MAGIC;
+	double n = t - MAGIC;
+	double r = x - n * LN2_HI - n * LN2_LO;
+
+	/* Taylor to r^13 */
+	double p = 1. / 6227020800;
+	p = p * r + 1. / 479001600;
+	p = p * r + 1. / 39916800;
+	p = p * r + 1. / 3628800;
+	p = p * r + 1. / 362880;
+	p = p * r + 1. / 40320;
+	p = p * r + 1. / 5040;
+	p = p * r + 1. / 720;
+	p = p * r + 1. / 120;
+	p = p * r + 1. / 24;
+	p = p * r + 1. / 6;
+	p = p * r + 1. / 2;
+	p = p * r + 1.;
+	p = p * r + 1.;
+
+	uint64_t scale = (as_uint(t) - as_uint(MAGIC) + 1023) << 52;
+	return p * as_double(scale);
+}
+
+#define SQRT2 0x1.6a09e667f3bcdp0
+
+ALWAYS_INLINE double vlog(double x)
+{
+	uint64_t u = as_uint(x);
+	uint64_t e_biased = u >> 52;
+
+	/* x = 2^e * m, m in [sqrt(2)/2, sqrt(2)) */
+	uint64_t mant = u & 0x000fffffffffffffULL;
+	double m = as_double(mant | 0x3ff0000000000000ULL);
+	int big = m > SQRT2;
+	m = big ? m * 0.5 : m;
+	double e = as_double(0x4330000000000000ULL | e_biased) - 0x1p52 - 1023 +
+		   (big ? 1. : 0.);
+
+	/* log(m) = 2 * atanh(s) */
+	double s = (m - 1) / (m + 1);
+	double s2 = s * s;
+	double p = 1. / 21;
+	p = p * s2 + 1. / 19;
+	p = p * s2 + 1. / 17;
+	p = p * s2 + 1. / 15;
+	p = p * s2 + 1. / 13;
+	p = p * s2 + 1. / 11;
+	p = p * s2 + 1. / 9;
+	p = p * s2 + 1. / 7;
+	p = p * s2 + 1. / 5;
+	p = p * s2 + 1. / 3;
+	p = p * s2 + 1.;
+	double res = e * LN2_HI + (2 * s * p + e * LN2_LO);
+
+	res = x == INFINITY ? x : res;
+	res = x == 0 ? -INFINITY : res;
+	return x < 0 || x != x ? NAN : res;
+}
+
+/* Cody-Waite pi/2 split, k * PIO2_1 exact for |k| < 2^20 */
+#define TWO_OVER_PI 0x1.45f306dc9c883p-1
+#define PIO2_1 0x1.921fb54400000p0
+#define PIO2_2 0x1.0b4611a600000p-34
+#define PIO2_3 0x1.3198a2e037073p-69
+
+/* sin(x + q * pi/2) */
+ALWAYS_INLINE double vsin_quadrant(double x, uint64_t q)
+{
+	double t = x * TWO_OVER_PI + MAGIC;
+	double k = t - MAGIC;
+	double r = x - k * PIO2_1 - k * PIO2_2 - k * PIO2_3;
+	q += as_uint(t) - as_uint(MAGIC);
+
+	double r2 = r * r;
+	double s = 1. / 355687428096000;
+	s = s * r2 - 1. / 1307674368000;
+	s = s * r2 + 1. / 6227020800;
+	s = s * r2 - 1. / 39916800;
+	s = s * r2 + 1. / 362880;
+	s = s * r2 - 1. / 5040;
+	s = s * r2 + 1. / 120;
+	s = s * r2 - 1. / 6;
+	s = s * r2 + 1.;
+	s *= r;
+
+	double c = -1. / 6402373705728000;
+	c = c * r2 + 1. / 20922789888000;
+	c = c * r2 - 1. / 87178291200;
+	c = c * r2 + 1. / 479001600;
+	c = c * r2 - 1. / 3628800;
+	c = c * r2 + 1. / 40320;
+	c = c * r2 - 1. / 720;
+	c = c * r2 + 1. / 24;
+	c = c * r2 - 1. / 2;
+	c = c * r2 + 1.;
+
+	double v = (q & 1) ? c : s;
+	return (q & 2) ? -v : v;
+}
+
+ALWAYS_INLINE double vsin(double x)
+{
+	return vsin_quadrant(x, 0);
+}
+
+ALWAYS_INLINE double vcos(double x)
+{
+	return vsin_quadrant(x, 1);
+}
+
+/************************** Evaluator *******************************/
+
+/* Points per block, multiple of EXPR_LANES */
+static int expr_block = EXPR_BLOCK;
+
+void expr_set_cache(size_t l1d_size)
+{
+	/* Stack with scratch, x and y blocks in half of L1d */
+	size_t block = l1d_size / 2 / (sizeof(double) * (EXPR_MAX_STACK + 3));
+	block -= block % EXPR_LANES;
+	if (block < EXPR_LANES)
+		block = EXPR_LANES;
+	if (block > EXPR_BLOCK_MAX)
+		block = EXPR_BLOCK_MAX;
+	expr_block = l1d_size ? block : EXPR_BLOCK;
+}
+
+EXPR_CLONES
+static void expr_eval_block(const struct expr_code *code, const double *x,
+			    double *y, int n)
+{
+	/*
+	 * Stack entries are n apart, working set follows the block. POWI
+	 * scratch is the entry above the top: one more than the max depth.
+	 */
+	double st[(EXPR_MAX_STACK + 1) * EXPR_BLOCK_MAX]
+		__attribute__((aligned(64)));
+	int sp = 0;
+
+	for (int i = 0; i < code->n_ops; i++) {
+		double *a = sp >= 2 ? st + (sp - 2) * n : NULL;
+		double *b = sp >= 1 ? st + (sp - 1) * n : NULL;
+		double *t = st + sp * n;
+		double c;
+		int e;
+
+		switch (code->op[i]) {
+		case EXPR_X:
+			memcpy(t, x, sizeof(*t) * n);
+			sp++;
+			break;
+		case EXPR_CONST:
+			c = code->consts[code->arg[i]];
+			for (int j = 0; j < n; j++)
+				t[j] = c;
+			sp++;
+			break;
+		case EXPR_ADD:
+			for (int j = 0; j < n; j++)
+				a[j] += b[j];
+			sp--;
+			break;
+		case EXPR_SUB:
+			for (int j = 0; j < n; j++)
+				a[j] -= b[j];
+			sp--;
+			break;
+		case EXPR_MUL:
+			for (int j = 0; j < n; j++)
+				a[j] *= b[j];
+			sp--;
+			break;
+		case EXPR_DIV:
+			for (int j = 0; j < n; j++)
+				a[j] /= b[j];
+			sp--;
+			break;
+		case EXPR_POW:
+			for (int j = 0; j < n; j++)
+				a[j] = vexp(b[j] * vlog(a[j]));
+			sp--;
+			break;
+		case EXPR_POWI:
+			/* Square-and-multiply, t is free scratch */
+			e = (int8_t)code->arg[i];
+			for (int j = 0; j < n; j++)
+				t[j] = 1;
+			for (int k = e < 0 ? -e : e; k; k >>= 1) {
+				if (k & 1) {
+					for (int j = 0; j < n; j++)
+						t[j] *= b[j];
+				}
+				for (int j = 0; j < n; j++)
+					b[j] *= b[j];
+			}
+			if (e < 0) {
+				for (int j = 0; j < n; j++)
+					b[j] = 1 / t[j];
+			} else {
+				memcpy(b, t, sizeof(*t) * n);
+			}
+			break;
+		case EXPR_NEG:
+			for (int j = 0; j < n; j++)
+				b[j] = -b[j];
+			break;
+		case EXPR_EXP:
+			for (int j = 0; j < n; j++)
+				b[j] = vexp(b[j]);
+			break;
+		case EXPR_LOG:
+			for (int j = 0; j < n; j++)
+				b[j] = vlog(b[j]);
+			break;
+		case EXPR_SIN:
+			for (int j = 0; j < n; j++)
+				b[j] = vsin(b[j]);
+			break;
+		case EXPR_COS:
+			for (int j = 0; j < n; j++)
+				b[j] = vcos(b[j]);
+			break;
+		case EXPR_SQRT:
+			for (int j = 0; j < n; j++)
+				b[j] = __builtin_sqrt(b[j]);
+			break;
+		case EXPR_ABS:
+			for (int j = 0; j < n; j++)
+				b[j] = __builtin_fabs(b[j]);
+			break;
+		}
+	}
+
+	memcpy(y, st, sizeof(*y) * n);
+}
+
+void expr_eval(const struct expr_code *code, const double *x, double *y,
+	       size_t n)
+{
+	size_t block = expr_block;
+	for (size_t done = 0; done < n; done += block) {
+		size_t len = n - done < block ? n - done : block;
+		expr_eval_block(code, x + done, y + done, len);
+	}
+}
+
+/* Same lane layout as SIMD kernels of integrate_kernels.c */
+EXPR_CLONES
+static void expr_accum_block(double *lanes, const double *y, int n)
+{
+	int j = 0;
+	for (; j + EXPR_LANES <= n; j += EXPR_LANES) {
+		for (int l = 0; l < EXPR_LANES; l++)
+			lanes[l] += y[j + l];
+	}
+	for (int l = 0; j < n; j++, l++)
+		lanes[l] += y[j];
+}
+
+double expr_sum_grid(const struct expr_code *code, double base, double step,
+		     size_t start_step, size_t n_steps)
+{
+	double x[EXPR_BLOCK_MAX] __attribute__((aligned(64)));
+	double y[EXPR_BLOCK_MAX] __attribute__((aligned(64)));
+	int block = expr_block;
+	double lanes[EXPR_LANES] = { 0 };
+
+	size_t cur_step = start_step;
+	while (n_steps) {
+		int len = n_steps < block ? n_steps : block;
+		for (int j = 0; j < len; j++)
+			x[j] = base + (double)(cur_step + j) * step;
+		expr_eval_block(code, x, y, len);
+		expr_accum_block(lanes, y, len);
+		cur_step += len;
+		n_steps -= len;
+	}
+
+	for (int w = EXPR_LANES / 2; w != 0; w /= 2) {
+		for (int l = 0; l < w; l++)
+			lanes[l] += lanes[l + w];
+	}
+	return lanes[0];
+}
+
+/*************************** Compiler *******************************/
+
+struct expr_parser {
+	const char *s;
+	struct expr_code *code;
+	int depth;
+	int max_depth;
+	int nest; /* parser recursion */
+	int err;
+};
+
+static int expr_op_arity(int op)
+{
+	switch (op) {
+	case EXPR_X:
+	case EXPR_CONST:
+		return 0;
+	case EXPR_ADD:
+	case EXPR_SUB:
+	case EXPR_MUL:
+	case EXPR_DIV:
+	case EXPR_POW:
+		return 2;
+	}
+	return 1;
+}
+
+/* Reference semantics for constant folding and selfcheck */
+static double expr_ref_op(int op, double a, double b, int arg)
+{
+	switch (op) {
+	case EXPR_ADD:
+		return a + b;
+	case EXPR_SUB:
+		return a - b;
+	case EXPR_MUL:
+		return a * b;
+	case EXPR_DIV:
+		return a / b;
+	case EXPR_POW:
+		return pow(a, b);
+	case EXPR_POWI:
+		return pow(b, (int8_t)arg);
+	case EXPR_NEG:
+		return -b;
+	case EXPR_EXP:
+		return exp(b);
+	case EXPR_LOG:
+		return log(b);
+	case EXPR_SIN:
+		return sin(b);
+	case EXPR_COS:
+		return cos(b);
+	case EXPR_SQRT:
+		return sqrt(b);
+	case EXPR_ABS:
+		return fabs(b);
+	}
+	return NAN;
+}
+
+static void expr_emit(struct expr_parser *p, int op, int arg)
+{
+	struct expr_code *code = p->code;
+	if (p->err)
+		return;
+
+	/* Fold ops whose operands are all constants */
+	int arity = expr_op_arity(op);
+	if (arity && code->n_ops >= arity) {
+		int folded = 1;
+		for (int i = 1; i <= arity; i++)
+			folded &= code->op[code->n_ops - i] == EXPR_CONST;
+		if (folded) {
+			double b = code->consts[--code->n_consts];
+			double a = 0;
+			if (arity == 2)
+				a = code->consts[--code->n_consts];
+			code->n_ops -= arity;
+			p->depth -= arity;
+
+			code->consts[code->n_consts] =
+				expr_ref_op(op, a, b, arg);
+			op = EXPR_CONST;
+			arg = code->n_consts++;
+		}
+	}
+
+	if (code->n_ops == EXPR_MAX_OPS) {
+		fprintf(stderr, "Error: expr: too many ops\n");
+		p->err = 1;
+		return;
+	}
+	code->op[code->n_ops] = op;
+	code->arg[code->n_ops] = arg;
+	code->n_ops++;
+
+	p->depth += 1 - expr_op_arity(op);
+	if (p->depth > p->max_depth)
+		p->max_depth = p->depth;
+}
+
+static void expr_emit_const(struct expr_parser *p, double val)
+{
+	if (p->err)
+		return;
+	if (p->code->n_consts == EXPR_MAX_CONSTS) {
+		fprintf(stderr, "Error: expr: too many constants\n");
+		p->err = 1;
+		return;
+	}
+	p->code->consts[p->code->n_consts] = val;
+	expr_emit(p, EXPR_CONST, p->code->n_consts++);
+}
+
+static void expr_skip_space(struct expr_parser *p)
+{
+	while (isspace((unsigned char)*p->s))
+		p->s++;
+}
+
+static int expr_accept(struct expr_parser *p, char c)
+{
+	expr_skip_space(p);
+	if (*p->s != c)
+		return 0;
+	p->s++;
+	return 1;
+}
+
+static void expr_error(struct expr_parser *p, const char *msg)
+{
+	if (!p->err)
+		fprintf(stderr, "Error: expr: %s at \"%s\"\n", msg, p->s);
+	p->err = 1;
+}
+
+static void expr_parse_sum(struct expr_parser *p);
+static void expr_parse_unary(struct expr_parser *p);
+
+static const struct {
+	const char *name;
+	int op;
+} expr_funcs[] = {
+	{ "exp", EXPR_EXP },   { "log", EXPR_LOG },   { "sin", EXPR_SIN },
+	{ "cos", EXPR_COS },   { "sqrt", EXPR_SQRT }, { "abs", EXPR_ABS },
+};
+
+static void expr_parse_primary(struct expr_parser *p)
+{
+	expr_skip_space(p);
+
+	if (isdigit((unsigned char)*p->s) || *p->s == '.') {
+		char *endptr;
+		double val = strtod(p->s, &endptr);
+		p->s = endptr;
+		expr_emit_const(p, val);
+		return;
+	}
+
+	if (expr_accept(p, '(')) {
+		expr_parse_sum(p);
+		if (!expr_accept(p, ')'))
+			expr_error(p, "')' expected");
+		return;
+	}
+
+	size_t len = 0;
+	while (isalnum((unsigned char)p->s[len]))
+		len++;
+
+	if (len == 1 && *p->s == 'x') {
+		p->s++;
+		expr_emit(p, EXPR_X, 0);
+		return;
+	}
+	if (len == 2 && !strncmp(p->s, "pi", 2)) {
+		p->s += 2;
+		expr_emit_const(p, 0x1.921fb54442d18p1);
+		return;
+	}
+
+	for (size_t i = 0; i < sizeof(expr_funcs) / sizeof(expr_funcs[0]);
+	     i++) {
+		if (strlen(expr_funcs[i].name) != len ||
+		    strncmp(p->s, expr_funcs[i].name, len))
+			continue;
+		p->s += len;
+		if (!expr_accept(p, '(')) {
+			expr_error(p, "'(' expected");
+			return;
+		}
+		expr_parse_sum(p);
+		if (!expr_accept(p, ')')) {
+			expr_error(p, "')' expected");
+			return;
+		}
+		expr_emit(p, expr_funcs[i].op, 0);
+		return;
+	}
+
+	expr_error(p, "unexpected token");
+}
+
+/* Right-assoc ^, small integer exponents become multiplications */
+static void expr_parse_power(struct expr_parser *p)
+{
+	expr_parse_primary(p);
+	if (!expr_accept(p, '^'))
+		return;
+
+	expr_parse_unary(p);
+	struct expr_code *code = p->code;
+	if (p->err)
+		return;
+
+	int last = code->n_ops - 1;
+	if (code->op[last] == EXPR_CONST) {
+		double e = code->consts[code->arg[last]];
+		if (e >= -64 && e <= 64 && e == (int)e &&
+		    code->arg[last] == code->n_consts - 1) {
+			code->n_ops--;
+			code->n_consts--;
+			p->depth--;
+			expr_emit(p, EXPR_POWI, (uint8_t)(int8_t)e);
+			return;
+		}
+	}
+	expr_emit(p, EXPR_POW, 0);
+}
+
+/*
+ * Parentheses, calls, ^ and signs all recurse through here. Nesting
+ * deeper than EXPR_MAX_OPS can't compile, stop before the C stack does.
+ */
+static void expr_parse_unary(struct expr_parser *p)
+{
+	if (p->nest == EXPR_MAX_OPS) {
+		expr_error(p, "nested too deep");
+		return;
+	}
+	p->nest++;
+
+	if (expr_accept(p, '-')) {
+		expr_parse_unary(p);
+		expr_emit(p, EXPR_NEG, 0);
+	} else if (expr_accept(p, '+')) {
+		expr_parse_unary(p);
+	} else {
+		expr_parse_power(p);
+	}
+
+	p->nest--;
+}
+
+static void expr_parse_product(struct expr_parser *p)
+{
+	expr_parse_unary(p);
+	while (!p->err) {
+		if (expr_accept(p, '*')) {
+			expr_parse_unary(p);
+			expr_emit(p, EXPR_MUL, 0);
+		} else if (expr_accept(p, '/')) {
+			expr_parse_unary(p);
+			expr_emit(p, EXPR_DIV, 0);
+		} else {
+			break;
+		}
+	}
+}
+
+static void expr_parse_sum(struct expr_parser *p)
+{
+	expr_parse_product(p);
+	while (!p->err) {
+		if (expr_accept(p, '+')) {
+			expr_parse_product(p);
+			expr_emit(p, EXPR_ADD, 0);
+		} else if (expr_accept(p, '-')) {
+			expr_parse_product(p);
+			expr_emit(p, EXPR_SUB, 0);
+		} else {
+			break;
+		}
+	}
+}
+
+int expr_compile(const char *str, struct expr_code *code)
+{
+	memset(code, 0, sizeof(*code));
+	struct expr_parser p = { .s = str, .code = code };
+
+	expr_parse_sum(&p);
+	expr_skip_space(&p);
+	if (!p.err && *p.s != '\0')
+		expr_error(&p, "trailing characters");
+	if (!p.err && p.max_depth > EXPR_MAX_STACK)
+		expr_error(&p, "expression too deep");
+
+	return p.err ? -1 : 0;
+}
+
+int expr_check(const struct expr_code *code)
+{
+	if (code->n_ops > EXPR_MAX_OPS || code->n_consts > EXPR_MAX_CONSTS)
+		return -1;
+
+	int depth = 0;
+	for (int i = 0; i < code->n_ops; i++) {
+		int op = code->op[i];
+		if (op >= EXPR_N_OPS)
+			return -1;
+		if (op == EXPR_CONST && code->arg[i] >= code->n_consts)
+			return -1;
+
+		int arity = expr_op_arity(op);
+		if (depth < arity)
+			return -1;
+		depth += 1 - arity;
+		if (depth > EXPR_MAX_STACK)
+			return -1;
+	}
+
+	return depth == 1 ? 0 : -1;
+}
+
+/************************** Selfcheck *******************************/
+
+/* Scalar libm interpreter, the reference for SIMD evaluator */
+static double expr_ref_eval(const struct expr_code *code, double x)
+{
+	double st[EXPR_MAX_STACK];
+	int sp = 0;
+
+	for (int i = 0; i < code->n_ops; i++) {
+		int op = code->op[i];
+		if (op == EXPR_X) {
+			st[sp++] = x;
+		} else if (op == EXPR_CONST) {
+			st[sp++] = code->consts[code->arg[i]];
+		} else if (expr_op_arity(op) == 2) {
+			sp--;
+			st[sp - 1] = expr_ref_op(op, st[sp - 1], st[sp],
+						 code->arg[i]);
+		} else {
+			st[sp - 1] =
+				expr_ref_op(op, 0, st[sp - 1], code->arg[i]);
+		}
+	}
+	return st[0];
+}
+
+/* Evaluator against the reference on 1000 points x, y is scratch */
+static int expr_selfcheck_code(FILE *stream, const char *name,
+			       const struct expr_code *code, const double *x,
+			       double *y)
+{
+	const double rel_tol = 1e-13;
+
+	expr_eval(code, x, y, 1000);
+	double max_err = 0;
+	for (int i = 0; i < 1000; i++) {
+		double ref = expr_ref_eval(code, x[i]);
+		double err = fabs(y[i] - ref);
+		if (fabs(ref) > 1)
+			err /= fabs(ref);
+		if (err > max_err || (err != err && ref == ref))
+			max_err = err;
+	}
+
+	int ok = max_err <= rel_tol;
+	fprintf(stream, "expr %-40s: %s (%d ops, max err %.3g)\n", name,
+		ok ? "ok" : "FAILED", code->n_ops, max_err);
+	return ok ? 0 : -1;
+}
+
+int expr_selfcheck(FILE *stream)
+{
+	static const char *exprs[] = {
+		"2 / (x*x + 1)",   "exp(-x*x) * sin(3*x)", "cos(x) - x^3",
+		"log(1 + x*x)",	   "sqrt(abs(x)) + x^-2",  "(x + 2)^1.5",
+		"exp(x / 10) * cos(20 * x) / (1 + 2^2)",
+	};
+	int n_failed = 0;
+
+	double x[1000], y[1000];
+	for (int i = 0; i < 1000; i++)
+		x[i] = -25 + i * 0.0501;
+
+	for (size_t e = 0; e < sizeof(exprs) / sizeof(exprs[0]); e++) {
+		struct expr_code code;
+		if (expr_compile(exprs[e], &code) || expr_check(&code)) {
+			fprintf(stream, "expr %-40s: compile FAILED\n",
+				exprs[e]);
+			n_failed++;
+			continue;
+		}
+		if (expr_selfcheck_code(stream, exprs[e], &code, x, y) < 0)
+			n_failed++;
+	}
+
+	/* Deepest stack expr_check lets in, POWI needs scratch above it */
+	struct expr_code deep = {};
+	for (int i = 0; i < EXPR_MAX_STACK; i++)
+		deep.op[deep.n_ops++] = EXPR_X;
+	deep.op[deep.n_ops] = EXPR_POWI;
+	deep.arg[deep.n_ops++] = 3;
+	for (int i = 1; i < EXPR_MAX_STACK; i++)
+		deep.op[deep.n_ops++] = EXPR_ADD;
+	if (expr_check(&deep) ||
+	    expr_selfcheck_code(stream, "<max depth> x^3", &deep, x, y) < 0)
+		n_failed++;
+
+	return n_failed ? -1 : 0;
+}
@@ -0,0 +1,66 @@
+#ifndef EXPR_H_
+#define EXPR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* User-supplied integrand f(x), e.g. "exp(-x*x)*sin(3*x)" */
+
+#define EXPR_MAX_OPS 64
+#define EXPR_MAX_CONSTS 16
+#define EXPR_MAX_STACK 8
+
+/* Points per interpreted op, amortizes dispatch: default and limit */
+#define EXPR_BLOCK 256
+#define EXPR_BLOCK_MAX 1024
+
+enum expr_op {
+	EXPR_X,
+	EXPR_CONST, /* arg: index in consts */
+	EXPR_ADD,
+	EXPR_SUB,
+	EXPR_MUL,
+	EXPR_DIV,
+	EXPR_POW,
+	EXPR_POWI, /* arg: int8_t exponent */
+	EXPR_NEG,
+	EXPR_EXP,
+	EXPR_LOG,
+	EXPR_SIN,
+	EXPR_COS,
+	EXPR_SQRT,
+	EXPR_ABS,
+	EXPR_N_OPS
+};
+
+/* Stack bytecode, plain data: shipped to workers byte by byte */
+struct expr_code {
+	uint8_t n_ops;
+	uint8_t n_consts;
+	uint8_t op[EXPR_MAX_OPS];
+	uint8_t arg[EXPR_MAX_OPS];
+	double consts[EXPR_MAX_CONSTS];
+};
+
+/* Grammar: + - * / ^, unary -, x, pi, numbers, exp log sin cos sqrt abs */
+int expr_compile(const char *str, struct expr_code *code);
+
+/* Validate code from untrusted source (network) */
+int expr_check(const struct expr_code *code);
+
+/* y[i] = f(x[i]) */
+void expr_eval(const struct expr_code *code, const double *x, double *y,
+	       size_t n);
+
+/* Sum of f(base + i * step), i in [start_step, +n_steps) */
+double expr_sum_grid(const struct expr_code *code, double base, double step,
+		     size_t start_step, size_t n_steps);
+
+/* Size blocks to L1d, 0: EXPR_BLOCK */
+void expr_set_cache(size_t l1d_size);
+
+/* Compare SIMD math and evaluator with libm */
+int expr_selfcheck(FILE *stream);
+
+#endif /* EXPR_H_ */
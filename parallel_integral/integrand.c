@@ -0,0 +1,139 @@
+#include "integrand.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define INTEGRAND_EVAL(name, n_params, d0, d1, d2, d3, expr)                   \
+	static void integrand_eval_##name(const double *params,                \
+					  const double *xs, double *y,         \
+					  size_t n)                            \
+	{                                                                      \
+		double p0 = params[0], p1 = params[1];                         \
+		double p2 = params[2], p3 = params[3];                         \
+		(void)p0, (void)p1, (void)p2, (void)p3;                        \
+		for (size_t i = 0; i < n; i++) {                               \
+			double x = xs[i];                                      \
+			y[i] = (expr);                                         \
+		}                                                              \
+	}
+
+INTEGRANDS(INTEGRAND_EVAL)
+#undef INTEGRAND_EVAL
+
+const struct integrand_desc integrands[INTEGRAND_COUNT] = {
+#define INTEGRAND_DESC(name, n_params, d0, d1, d2, d3, expr)                   \
+	{ #name, #expr, n_params, { d0, d1, d2, d3 }, integrand_eval_##name },
+	INTEGRANDS(INTEGRAND_DESC)
+#undef INTEGRAND_DESC
+};
+
+int integrand_find(const char *name)
+{
+	for (int i = 0; i < INTEGRAND_COUNT; i++) {
+		if (!strcmp(integrands[i].name, name))
+			return i;
+	}
+	return -1;
+}
+
+void integrand_init(struct integrand *func, int id)
+{
+	func->id = id;
+	func->code = NULL;
+	for (int i = 0; i < INTEGRAND_MAX_PARAMS; i++)
+		func->params[i] = integrands[id].defaults[i];
+}
+
+static int integrand_parse_expr(const char *str, struct integrand *func)
+{
+	struct expr_code *code = malloc(sizeof(*code));
+	if (!code) {
+		perror("Error: malloc");
+		return -1;
+	}
+	if (expr_compile(str, code) < 0) {
+		free(code);
+		return -1;
+	}
+
+	integrand_init(func, INTEGRAND_DEFAULT);
+	func->id = INTEGRAND_EXPR;
+	func->code = code;
+	return 0;
+}
+
+int integrand_parse(const char *str, struct integrand *func)
+{
+	if (!strncmp(str, "expr:", 5))
+		return integrand_parse_expr(str + 5, func);
+
+	char name[INTEGRAND_NAME_MAX];
+	size_t len = strcspn(str, ":");
+	if (len >= sizeof(name)) {
+		fprintf(stderr, "Error: integrand name too long\n");
+		return -1;
+	}
+	memcpy(name, str, len);
+	name[len] = '\0';
+
+	int id = integrand_find(name);
+	if (id < 0) {
+		fprintf(stderr, "Error: unknown integrand %s\n", name);
+		return -1;
+	}
+	integrand_init(func, id);
+
+	if (str[len] == '\0')
+		return 0;
+
+	const char *cur = str + len + 1;
+	for (int i = 0; i < integrands[id].n_params; i++) {
+		char *endptr;
+		errno = 0;
+		func->params[i] = strtod(cur, &endptr);
+		if (errno || endptr == cur) {
+			fprintf(stderr, "Error: wrong integrand param %d\n", i);
+			return -1;
+		}
+		cur = endptr;
+		if (*cur == '\0')
+			return 0;
+		if (*cur != ',')
+			break;
+		cur++;
+	}
+
+	fprintf(stderr, "Error: %s takes %d params\n", name,
+		integrands[id].n_params);
+	return -1;
+}
+
+void integrand_fini(struct integrand *func)
+{
+	if (func->id == INTEGRAND_EXPR)
+		free(func->code);
+	func->code = NULL;
+}
+
+int integrand_check(const struct integrand *func)
+{
+	if (func->id == INTEGRAND_EXPR)
+		return (func->code && !expr_check(func->code)) ? 0 : -1;
+	return (func->id >= 0 && func->id < INTEGRAND_COUNT) ? 0 : -1;
+}
+
+const char *integrand_name(const struct integrand *func)
+{
+	return func->id == INTEGRAND_EXPR ? "expr" : integrands[func->id].name;
+}
+
+void integrand_eval(const struct integrand *func, const double *x, double *y,
+		    size_t n)
+{
+	if (func->id == INTEGRAND_EXPR)
+		expr_eval(func->code, x, y, n);
+	else
+		integrands[func->id].eval(func->params, x, y, n);
+}
@@ -0,0 +1,76 @@
+#ifndef INTEGRAND_H_
+#define INTEGRAND_H_
+
+#include <stddef.h>
+
+#include "expr.h"
+
+#define INTEGRAND_MAX_PARAMS 4
+#define INTEGRAND_NAME_MAX 16
+
+/*
+ * Registry of integrands: X(name, n_params, d0, d1, d2, d3, expr)
+ * expr uses x and p0..p3 only with + - * /, so the same text compiles
+ * for scalars and for every SIMD vector width without calls per point.
+ */
+#define INTEGRANDS(X)                                                          \
+	X(lorentz, 2, 2, 1, 0, 0, p0 / (x * x + p1))                           \
+	X(poly, 4, 0, 0, 0, 1, ((p3 * x + p2) * x + p1) * x + p0)              \
+	X(rational, 4, 1, 0, 1, 1, (p0 * x + p1) / (p2 * x + p3))
+
+enum integrand_id {
+#define INTEGRAND_ENUM(name, ...) INTEGRAND_##name,
+	INTEGRANDS(INTEGRAND_ENUM)
+#undef INTEGRAND_ENUM
+	INTEGRAND_COUNT,
+	/* User expression, not in the registry */
+	INTEGRAND_EXPR = INTEGRAND_COUNT
+};
+
+/* Default: the original 2 / (x^2 + 1) */
+#define INTEGRAND_DEFAULT INTEGRAND_lorentz
+
+/* Integrand of a job: registry id and its parameters */
+struct integrand {
+	int id;
+	double params[INTEGRAND_MAX_PARAMS];
+	struct expr_code *code; /* INTEGRAND_EXPR only */
+};
+
+struct integrand_desc {
+	const char *name;
+	const char *expr;
+	int n_params;
+	double defaults[INTEGRAND_MAX_PARAMS];
+
+	/* y[i] = f(x[i]), for rare non-grid points */
+	void (*eval)(const double *params, const double *x, double *y,
+		     size_t n);
+};
+
+extern const struct integrand_desc integrands[INTEGRAND_COUNT];
+
+/* Registry id by name, -1 if unknown */
+int integrand_find(const char *name);
+
+/* Set id and default params */
+void integrand_init(struct integrand *func, int id);
+
+/*
+ * "name" or "name:p0,p1,...", missing params keep defaults,
+ * or "expr:<f(x)>" compiled to bytecode, release with integrand_fini
+ */
+int integrand_parse(const char *str, struct integrand *func);
+
+void integrand_fini(struct integrand *func);
+
+int integrand_check(const struct integrand *func);
+
+/* "expr" for user expression */
+const char *integrand_name(const struct integrand *func);
+
+/* y[i] = f(x[i]), for rare non-grid points */
+void integrand_eval(const struct integrand *func, const double *x, double *y,
+		    size_t n);
+
+#endif /* INTEGRAND_H_ */
@@ -1,9 +1,15 @@
 #include "integrate.h"
+#include "integrate_kernels.h"
+#include "thread_pool.h"
+#include "integrate_adaptive.h"
+#include "integrate_batch.h"
 #include "signal_except.h"
+#include "perf_counters.h"
 
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <stdint.h>
 #include <pthread.h>
@@ -13,16 +19,34 @@
 #include <errno.h>
 #include <sched.h>
 #include <signal.h>
+#include <time.h>
 
 struct task_container {
 	long double base;
 	long double step_wdth;
-	long double accum;
 
-	size_t start_step;
-	size_t n_steps;
+	/* Own deque of reduction chunks: owner pops front, thieves back */
+	size_t start_chunk;
+	size_t n_chunks;
+	int lock;
 
+	/* Steps of the whole run, chunk partials of it (NULL: dropped) */
+	size_t run_steps;
+	double *partials;
+
+	/* Tasks of the same run, stealing victims */
+	struct task_container **peers;
+	int n_peers;
+	int idx;
+
+	struct integrate_rule rule;
+	struct integrand func;
+	integrate_kernel_t kernel;
 	int cpu;
+	int weight; /* share of the cpu weight, see integrate_place_cpus */
+
+	/* Open on the worker thread, NULL: not counted */
+	struct perf_counters *counters;
 };
 
 /* Aligned task_container to avoid cache bouncing */
@@ -31,75 +55,366 @@ struct task_container_align {
 	uint8_t padding[CACHE_LINE_ALIGN - sizeof(struct task_container)];
 };
 
-void *integrate_task_worker(void *arg)
+/* Chunking tunables, see integrate_set_chunking */
+static size_t chunk_min = INTEGRATE_CHUNK_MIN;
+static int chunk_guided_div = INTEGRATE_CHUNK_GUIDED_DIV;
+
+void integrate_set_chunking(size_t min_chunk, int guided_div)
 {
-	struct task_container *pack = arg;
-	register worker_tmp_t base = pack->base;
-	register worker_tmp_t step_wdth = pack->step_wdth;
-	size_t n_steps = pack->n_steps;
-	register size_t cur_step = pack->start_step;
-	register worker_tmp_t sum = 0;
-
-	DUMP_LOG_DO(worker_tmp_t dump_from = base + cur_step * step_wdth);
-	DUMP_LOG_DO(worker_tmp_t dump_to =
-			    base + (cur_step + pack->n_steps) * step_wdth);
-
-	for (register size_t i = n_steps; i != 0; i--, cur_step++) {
-		register worker_tmp_t x = base + cur_step * step_wdth;
-		sum += INTEGRATE_FUNC(x) * step_wdth;
-	}
+	chunk_min = min_chunk ? min_chunk : 1;
+	chunk_guided_div = guided_div > 0 ? guided_div : 1;
+}
 
-	pack->accum = sum;
+/* Placement, see integrate_set_placement */
+static struct cpu_topology *place_topo;
+static int place_policy = CPU_PLACE_LINEAR;
 
-	DUMP_LOG("worker: from: %lg "
-		 "to: %lg sum: %lg arg: %p\n",
-		 (double)dump_from, (double)dump_to, (double)sum, arg);
+void integrate_set_placement(struct cpu_topology *topo, int policy)
+{
+	place_topo = topo;
+	place_policy = topo ? policy : CPU_PLACE_LINEAR;
+	expr_set_cache(topo ? cpu_topology_cache_size(topo, 1) : 0);
+}
 
-	return NULL;
+static int integrate_cpu_weight(int cpu)
+{
+	struct cpu_topology_elem *elem =
+		place_topo ? cpu_topology_find(place_topo, cpu) : NULL;
+	return elem ? elem->weight : 1024;
 }
 
-void integrate_split_tasks(struct task_container_align *tasks, int n_tasks,
-			   cpu_set_t *cpuset, size_t n_steps, long double base,
-			   long double step)
+/*
+ * Cpu of every task: ~n_tasks / n_cpus tasks on each in placement order.
+ * Tasks of a cpu share its weight.
+ */
+static int integrate_place_cpus(cpu_set_t *cpuset, int n_tasks, int *cpus,
+				int *weights)
 {
-	int n_cpus = CPU_COUNT(cpuset);
+	int order[CPU_SETSIZE];
+	int n_cpus = 0;
+
+	if (place_topo) {
+		n_cpus = cpu_topology_order(place_topo, place_policy, cpuset,
+					    order);
+		if (n_cpus < 0)
+			return -1;
+	} else {
+		int cpu = cpu_set_search_next(-1, cpuset);
+		for (int i = CPU_COUNT(cpuset); i != 0; i--) {
+			order[n_cpus++] = cpu;
+			cpu = cpu_set_search_next(cpu, cpuset);
+		}
+	}
+
+	if (n_cpus == 0) {
+		fprintf(stderr, "Error: no cpus to place threads\n");
+		return -1;
+	}
 	if (n_tasks < n_cpus)
 		n_cpus = n_tasks;
 
-	size_t cur_step = 0;
-	int cur_task = 0;
+	for (int i = 0; i < n_tasks; i++)
+		cpus[i] = order[(long long)i * n_cpus / n_tasks];
+
+	/* Tasks of a cpu are adjacent */
+	for (int i = 0, n; i < n_tasks; i += n) {
+		for (n = 1; i + n < n_tasks && cpus[i + n] == cpus[i]; n++)
+			;
+		int weight = integrate_cpu_weight(cpus[i]) / n;
+		for (int k = i; k < i + n; k++)
+			weights[k] = weight ? weight : 1;
+	}
+	return 0;
+}
+
+int integrate_placement_capacity(cpu_set_t *cpuset, int n_threads)
+{
+	int *cpus = malloc(sizeof(*cpus) * n_threads);
+	int *weights = malloc(sizeof(*weights) * n_threads);
+	int capacity = -1;
+	if (!cpus || !weights) {
+		perror("Error: malloc");
+		goto exit;
+	}
+	if (integrate_place_cpus(cpuset, n_threads, cpus, weights) < 0)
+		goto exit;
+
+	capacity = 0;
+	for (int i = 0; i < n_threads; i++)
+		capacity += weights[i];
+exit:
+	free(weights);
+	free(cpus);
+	return capacity;
+}
+
+static void integrate_calibrate_task(void *arg, int thread_idx)
+{
+	double *rates = arg;
+	struct integrate_rule rule = { INTEGRATE_RULE_RECT, 1 };
+	struct integrand func;
+	integrand_init(&func, INTEGRAND_DEFAULT);
+	integrate_kernel_t kernel = integrate_kernel_get(&func);
+
+	rates[thread_idx] = 0;
+	for (int i = 0; i < INTEGRATE_CALIBRATE_REPS; i++) {
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		volatile double sum =
+			integrate_rule_apply(&rule, kernel, &func, 0, 1e-6, 0,
+					     INTEGRATE_CALIBRATE_STEPS);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		(void)sum;
+
+		double sec = (end.tv_sec - start.tv_sec) +
+			     (end.tv_nsec - start.tv_nsec) * 1e-9;
+		double rate = INTEGRATE_CALIBRATE_STEPS / sec;
+		if (rate > rates[thread_idx])
+			rates[thread_idx] = rate;
+	}
+}
+
+int integrate_calibrate_weights(struct cpu_topology *topo, cpu_set_t *cpuset)
+{
+	int n_cpus = CPU_COUNT(cpuset);
+	int *cpus = malloc(sizeof(*cpus) * n_cpus);
+	double *rates = malloc(sizeof(*rates) * n_cpus);
+	if (!cpus || !rates) {
+		perror("Error: malloc");
+		goto handle_err;
+	}
 
 	int cpu = cpu_set_search_next(-1, cpuset);
-	for (; n_cpus != 0; n_cpus--, cpu = cpu_set_search_next(cpu, cpuset)) {
-		/* Take ~1/n steps and threads per one cpu */
-		size_t cpu_steps = n_steps / n_cpus;
-		int cpu_tasks = n_tasks / n_cpus;
-		n_steps -= cpu_steps;
-		n_tasks -= cpu_tasks;
-
-		for (; cpu_tasks != 0; cpu_tasks--, cur_task++) {
-			struct task_container *ptr = &tasks[cur_task].task;
-			ptr->base = base;
-			ptr->step_wdth = step;
-			ptr->cpu = cpu;
-
-			size_t task_steps = cpu_steps / cpu_tasks;
-
-			ptr->start_step = cur_step;
-			ptr->n_steps = task_steps;
-
-			cur_step += task_steps;
-			cpu_steps -= task_steps;
+	for (int i = 0; i < n_cpus; i++, cpu = cpu_set_search_next(cpu, cpuset))
+		cpus[i] = cpu;
+
+	struct thread_pool *threads = thread_pool_create(n_cpus, cpus);
+	if (!threads) {
+		fprintf(stderr, "Error: thread_pool_create failed\n");
+		goto handle_err;
+	}
+	thread_pool_submit(threads, integrate_calibrate_task, rates);
+	thread_pool_wait(threads);
+	thread_pool_destroy(threads);
+
+	double max = 0;
+	for (int i = 0; i < n_cpus; i++)
+		max = rates[i] > max ? rates[i] : max;
+	for (int i = 0; i < n_cpus; i++) {
+		struct cpu_topology_elem *elem = cpu_topology_find(topo, cpus[i]);
+		if (!elem)
+			continue;
+		elem->weight = rates[i] * 1024 / max;
+		if (elem->weight < 1)
+			elem->weight = 1;
+		DUMP_LOG("cpu %2d: %.3g steps/s, weight %d\n", cpus[i],
+			 rates[i], elem->weight);
+	}
+
+	free(rates);
+	free(cpus);
+	return 0;
+
+handle_err:
+	free(rates);
+	free(cpus);
+	return -1;
+}
+
+static void task_lock(struct task_container *task)
+{
+	while (__atomic_exchange_n(&task->lock, 1, __ATOMIC_ACQUIRE))
+		while (__atomic_load_n(&task->lock, __ATOMIC_RELAXED))
+			;
+}
+
+static void task_unlock(struct task_container *task)
+{
+	__atomic_store_n(&task->lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Guided: chunks shrink with remaining own work, down to chunk_min */
+static int task_pop_chunk(struct task_container *task, size_t *start,
+			  size_t *n)
+{
+	size_t min = (chunk_min + INTEGRATE_REDUCE_CHUNK - 1) /
+		     INTEGRATE_REDUCE_CHUNK;
+
+	task_lock(task);
+	size_t chunk = task->n_chunks / chunk_guided_div;
+	if (chunk < min)
+		chunk = min;
+	if (chunk > task->n_chunks)
+		chunk = task->n_chunks;
+
+	*start = task->start_chunk;
+	*n = chunk;
+	task->start_chunk += chunk;
+	task->n_chunks -= chunk;
+	task_unlock(task);
+
+	return chunk != 0;
+}
+
+/* Move back half of a neighbour's deque into own one */
+static int task_steal(struct task_container *task)
+{
+	for (int i = 1; i < task->n_peers; i++) {
+		struct task_container *victim =
+			task->peers[(task->idx + i) % task->n_peers];
+
+		task_lock(victim);
+		size_t n = victim->n_chunks - victim->n_chunks / 2;
+		victim->n_chunks -= n;
+		size_t start = victim->start_chunk + victim->n_chunks;
+		task_unlock(victim);
+
+		if (n == 0)
+			continue;
+
+		task_lock(task);
+		task->start_chunk = start;
+		task->n_chunks = n;
+		task_unlock(task);
+		return 1;
+	}
+
+	return 0;
+}
+
+void *integrate_task_worker(void *arg)
+{
+	struct task_container *pack = arg;
+	worker_tmp_t base = pack->base;
+	worker_tmp_t step_wdth = pack->step_wdth;
+	DUMP_LOG_DO(size_t dump_chunks = 0);
+	DUMP_LOG_DO(int dump_steals = 0);
+	if (pack->counters)
+		perf_counters_start(pack->counters);
+
+	do {
+		size_t start, n;
+		while (task_pop_chunk(pack, &start, &n)) {
+			uint64_t trace_start = trace_begin();
+			for (size_t c = start; c != start + n; c++) {
+				size_t first = c * INTEGRATE_REDUCE_CHUNK;
+				size_t len = pack->run_steps - first;
+				if (len > INTEGRATE_REDUCE_CHUNK)
+					len = INTEGRATE_REDUCE_CHUNK;
+
+				double part = integrate_rule_apply(
+					&pack->rule, pack->kernel, &pack->func,
+					base, step_wdth, first, len);
+				if (pack->partials)
+					pack->partials[c] = part;
+			}
+			trace_end(TRACE_chunk, trace_start, n);
+			DUMP_LOG_DO(dump_chunks += n);
 		}
+		DUMP_LOG_DO(dump_steals++);
+	} while (task_steal(pack));
+
+	if (pack->counters)
+		perf_counters_stop(pack->counters);
+	DUMP_LOG_DEBUG("worker: chunks: %zu steals: %d arg: %p\n", dump_chunks,
+		 dump_steals - 1, arg);
+
+	return NULL;
+}
+
+/*
+ * Initial deques: contiguous ranges by task weight, rebalanced by
+ * stealing. partials get integrate_reduce_n_chunks(0, n_steps) sums.
+ */
+void integrate_split_tasks(struct task_container **tasks, int n_tasks,
+			   size_t n_steps, double *partials, long double base,
+			   long double step, const struct integrand *func,
+			   const struct integrate_rule *rule)
+{
+	size_t n_chunks = integrate_reduce_n_chunks(0, n_steps);
+	size_t cur_chunk = 0;
+	size_t weight_left = 0;
+	integrate_kernel_t kernel = integrate_kernel_get(func);
+
+	for (int i = 0; i < n_tasks; i++)
+		weight_left += tasks[i]->weight;
+
+	for (int i = 0; i < n_tasks; i++) {
+		struct task_container *ptr = tasks[i];
+		ptr->base = base;
+		ptr->step_wdth = step;
+		ptr->rule = *rule;
+		ptr->func = *func;
+		ptr->kernel = kernel;
+		ptr->lock = 0;
+		ptr->peers = tasks;
+		ptr->n_peers = n_tasks;
+		ptr->idx = i;
+		ptr->run_steps = n_steps;
+		ptr->partials = partials;
+
+		size_t task_chunks =
+			(n_chunks - cur_chunk) * ptr->weight / weight_left;
+		weight_left -= ptr->weight;
+		ptr->start_chunk = cur_chunk;
+		ptr->n_chunks = task_chunks;
+		cur_chunk += task_chunks;
 	}
 }
 
+/* Cache-aligned containers placed on cpuset, one free() releases all */
+static struct task_container **integrate_tasks_alloc(int n_tasks,
+						     cpu_set_t *cpuset)
+{
+	size_t align = sizeof(struct task_container_align);
+	size_t ptrs_size = (sizeof(struct task_container *) * n_tasks +
+			    align - 1) / align * align;
+
+	int *cpus = malloc(sizeof(*cpus) * n_tasks * 2);
+	void *mem = aligned_alloc(align, ptrs_size + align * n_tasks);
+	if (!cpus || !mem) {
+		perror("Error: aligned_alloc");
+		goto handle_err;
+	}
+	int *weights = cpus + n_tasks;
+	if (integrate_place_cpus(cpuset, n_tasks, cpus, weights) < 0)
+		goto handle_err;
+
+	struct task_container **tasks = mem;
+	struct task_container_align *containers =
+		(void *)((char *)mem + ptrs_size);
+	for (int i = 0; i < n_tasks; i++) {
+		tasks[i] = &containers[i].task;
+		tasks[i]->cpu = cpus[i];
+		tasks[i]->weight = weights[i];
+		tasks[i]->counters = NULL;
+	}
+
+	free(cpus);
+	return tasks;
+
+handle_err:
+	free(mem);
+	free(cpus);
+	return NULL;
+}
+
+/* One-shot thread of integrate_multicore */
+static void *integrate_task_thread(void *arg)
+{
+	uint64_t trace_start = trace_begin();
+	integrate_task_worker(arg);
+	trace_end(TRACE_thread, trace_start,
+		  ((struct task_container *)arg)->idx);
+	return NULL;
+}
+
 int set_this_thread_cpu(int cpu)
 {
 	cpu_set_t set_tmp;
 	CPU_ZERO(&set_tmp);
 	CPU_SET(cpu, &set_tmp);
-	DUMP_LOG("setting main   to cpu = %2d\n", cpu);
+	DUMP_LOG_DEBUG("setting main   to cpu = %2d\n", cpu);
 	if (sched_setaffinity(getpid(), sizeof(set_tmp), &set_tmp) == -1) {
 		perror("Error: sched_setaffinity");
 		return -1;
@@ -107,24 +422,24 @@ int set_this_thread_cpu(int cpu)
 	return 0;
 }
 
-int integrate_run_tasks(struct task_container_align *tasks, pthread_t *threads,
+int integrate_run_tasks(struct task_container **tasks, pthread_t *threads,
 			int n_tasks)
 {
 	pthread_attr_t attr;
 	pthread_attr_init(&attr);
 	cpu_set_t cpuset_tmp;
 	for (int i = 0; i < n_tasks; i++) {
-		struct task_container *ptr = &tasks[i].task;
+		struct task_container *ptr = tasks[i];
 		CPU_ZERO(&cpuset_tmp);
 		CPU_SET(ptr->cpu, &cpuset_tmp);
-		DUMP_LOG("setting worker to cpu = %2d\n", ptr->cpu);
+		DUMP_LOG_DEBUG("setting worker to cpu = %2d\n", ptr->cpu);
 		int ret = pthread_attr_setaffinity_np(&attr, sizeof(cpuset_tmp),
 						      &cpuset_tmp);
 		if (ret) {
 			perror("Error: pthread_attr_setaffinity_np");
 			return -1;
 		}
-		ret = pthread_create(&threads[i], &attr, integrate_task_worker,
+		ret = pthread_create(&threads[i], &attr, integrate_task_thread,
 				     ptr);
 		if (ret) {
 			perror("Error: pthread_create");
@@ -158,61 +473,45 @@ int integrate_cancel_tasks(pthread_t *threads, int n_threads)
 	return 0;
 }
 
-long double integrate_accumulate_result(struct task_container_align *tasks,
-					int n_tasks)
-{
-	long double accum = 0;
-	for (int i = 0; i < n_tasks; i++) {
-		accum += tasks[i].task.accum;
-	}
-	return accum;
-}
-
-/* Get unused cpuset */
-void integrate_tasks_unused_cpus(struct task_container_align *tasks,
-				 int n_tasks, cpu_set_t *cpuset,
-				 cpu_set_t *result)
+/* n_threads pinned to cpuset, idle cpus of it stay idle */
+int integrate_multicore(int n_threads, cpu_set_t *cpuset, size_t n_steps,
+			long double base, long double step,
+			const struct integrand *func,
+			const struct integrate_rule *rule, long double *result)
 {
-	CPU_ZERO(result);
-	for (int i = 0; i < CPU_SETSIZE; i++) {
-		if (CPU_ISSET(i, cpuset))
-			CPU_SET(i, result);
-	}
-	for (int i = 0; i < n_tasks; i++)
-		CPU_CLR(tasks[i].task.cpu, result);
-}
+	struct task_container **tasks = NULL;
+	pthread_t *threads = NULL;
+	double *partials = NULL;
 
-/* Good version, but unnecessary for my task */
-/* For real usage please replace _scalable with this function */
-int integrate_multicore(cpu_set_t *cpuset, size_t n_steps, long double base,
-			long double step, long double *result)
-{
 	if (setjmp(sig_exc_buf)) {
 		fprintf(stderr, "Error: signal-exception caught\n");
 		goto handle_err;
 	}
 
-	int n_threads = CPU_COUNT(cpuset);
-
 	/* Allocate cache-aligned task containers */
-	struct task_container_align *tasks =
-		aligned_alloc(sizeof(*tasks), sizeof(*tasks) * n_threads);
-	if (!tasks) {
-		perror("Error: aligned_alloc");
+	tasks = integrate_tasks_alloc(n_threads, cpuset);
+	if (!tasks)
 		goto handle_err;
-	}
 
-	pthread_t *threads = malloc(sizeof(*threads) * n_threads);
+	threads = calloc(sizeof(*threads), n_threads);
 	if (!threads) {
+		perror("Error: calloc");
+		goto handle_err;
+	}
+
+	size_t n_chunks = integrate_reduce_n_chunks(0, n_steps);
+	partials = malloc(sizeof(*partials) * (n_chunks ? n_chunks : 1));
+	if (!partials) {
 		perror("Error: malloc");
 		goto handle_err;
 	}
 
-	/* Split task btw cpus and threads */
-	integrate_split_tasks(tasks, n_threads, cpuset, n_steps, base, step);
+	/* Split task btw threads */
+	integrate_split_tasks(tasks, n_threads, n_steps, partials, base, step,
+			      func, rule);
 
 	/* Move main thread to other cpu */
-	if (set_this_thread_cpu(tasks[0].task.cpu))
+	if (set_this_thread_cpu(tasks[0]->cpu))
 		goto handle_err;
 
 	/* Run non-main tasks */
@@ -220,16 +519,20 @@ int integrate_multicore(cpu_set_t *cpuset, size_t n_steps, long double base,
 		goto handle_err;
 
 	/* Run main task */
-	integrate_task_worker(&tasks[0].task);
+	integrate_task_thread(tasks[0]);
 
 	/* Finish non-main tasks */
+	uint64_t trace_start = trace_begin();
 	if (integrate_join_tasks(threads + 1, n_threads - 1))
 		goto handle_err;
+	trace_end(TRACE_join, trace_start, 0);
 
 	/* Sumary */
-	*result = integrate_accumulate_result(tasks, n_threads);
+	*result = integrate_reduce(partials, n_chunks);
 
+	free(partials);
 	free(tasks);
+	free(threads);
 	return 0;
 
 handle_err:
@@ -237,119 +540,244 @@ handle_err:
 		integrate_cancel_tasks(threads + 1, n_threads - 1);
 		free(threads);
 	}
-
-	if (tasks)
-		free(tasks);
+	free(partials);
+	free(tasks);
 	return -1;
 }
 
-/* Time-scalability with TurboBoost requires this function with trash-threads */
-int integrate_multicore_scalable(int n_threads, cpu_set_t *cpuset,
-				 size_t n_steps, long double base,
-				 long double step, long double *result)
+/* Long-lived pinned threads with their own task containers */
+struct integrate_pool {
+	struct thread_pool *threads;
+	struct task_container **tasks; /* own page each, see alloc_task */
+	int n_threads;
+
+	/* Chunk partials, grown on demand */
+	double *partials;
+	size_t n_partials;
+
+	/* Per thread, see integrate_pool_counters_enable */
+	struct perf_counters *counters;
+	unsigned counters_mask;
+
+	int cancel; /* batches, see integrate_pool_cancel */
+};
+
+static void integrate_pool_task(void *arg, int thread_idx)
 {
-	if (setjmp(sig_exc_buf)) {
-		fprintf(stderr, "Error: signal-exception caught\n");
-		goto handle_err;
-	}
+	struct task_container **tasks = arg;
+	integrate_task_worker(tasks[thread_idx]);
+}
 
-	/* Allocate cache-aligned task containers */
-	struct task_container_align *tasks = NULL;
-	tasks = aligned_alloc(sizeof(*tasks), sizeof(*tasks) * n_threads);
-	if (!tasks) {
-		perror("Error: aligned_alloc");
-		goto handle_err;
-	}
+/* Pinned thread touches its container first: page on its NUMA node */
+static void integrate_pool_alloc_task(void *arg, int thread_idx)
+{
+	struct task_container **tasks = arg;
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size = (sizeof(**tasks) + page - 1) / page * page;
 
-	/* The same with overloading threads */
-	int n_bad_threads = 0;
-	struct task_container_align *bad_tasks = NULL;
-	if (CPU_COUNT(cpuset) > n_threads) {
-		n_bad_threads = CPU_COUNT(cpuset) - n_threads;
-		bad_tasks = aligned_alloc(sizeof(*bad_tasks),
-					  sizeof(*bad_tasks) * n_bad_threads);
-		if (!bad_tasks) {
-			perror("Error: aligned_alloc");
-			goto handle_err;
-		}
+	tasks[thread_idx] = aligned_alloc(page, size);
+	if (tasks[thread_idx])
+		memset(tasks[thread_idx], 0, size);
+}
+
+struct integrate_pool *integrate_pool_create(int n_threads, cpu_set_t *cpuset)
+{
+	struct integrate_pool *pool = calloc(1, sizeof(*pool));
+	if (!pool) {
+		perror("Error: calloc");
+		goto handle_err_0;
 	}
+	pool->n_threads = n_threads;
 
-	pthread_t *threads = NULL;
-	threads = calloc(sizeof(*threads), n_threads);
-	if (!threads) {
+	int *cpus = malloc(sizeof(*cpus) * n_threads * 2);
+	if (!cpus) {
 		perror("Error: malloc");
-		goto handle_err;
+		goto handle_err_1;
 	}
-
-	pthread_t *bad_threads = NULL;
-	if (n_bad_threads) {
-		bad_threads = calloc(sizeof(*bad_threads), n_bad_threads);
-		if (!bad_threads) {
-			perror("Error: malloc");
-			goto handle_err;
-		}
+	int *weights = cpus + n_threads;
+	if (integrate_place_cpus(cpuset, n_threads, cpus, weights) < 0)
+		goto handle_err_2;
+
+	pool->threads = thread_pool_create(n_threads, cpus);
+	if (!pool->threads) {
+		fprintf(stderr, "Error: thread_pool_create failed\n");
+		goto handle_err_2;
 	}
 
-	/* Split task btw cpus and threads */
-	integrate_split_tasks(tasks, n_threads, cpuset, n_steps, base, step);
-
-	/* Split bad tasks */
-	if (n_bad_threads) {
-		cpu_set_t bad_cpuset;
-		integrate_tasks_unused_cpus(tasks, n_threads, cpuset,
-					    &bad_cpuset);
-		size_t n_bad_steps = (n_steps / n_threads) * n_bad_threads;
-		integrate_split_tasks(bad_tasks, n_bad_threads, &bad_cpuset,
-				      n_bad_steps, base, step);
+	pool->tasks = calloc(n_threads, sizeof(*pool->tasks));
+	if (!pool->tasks) {
+		perror("Error: calloc");
+		goto handle_err_3;
+	}
+	thread_pool_submit(pool->threads, integrate_pool_alloc_task,
+			   pool->tasks);
+	thread_pool_wait(pool->threads);
+	for (int i = 0; i < n_threads; i++) {
+		if (!pool->tasks[i]) {
+			perror("Error: aligned_alloc");
+			goto handle_err_4;
+		}
+		pool->tasks[i]->cpu = cpus[i];
+		pool->tasks[i]->weight = weights[i];
 	}
 
-	/* Move main thread to other cpu */
-	if (set_this_thread_cpu(tasks[0].task.cpu))
-		goto handle_err;
-
-	/* Run bad tasks */
-	if (n_bad_threads &&
-	    integrate_run_tasks(bad_tasks, bad_threads, n_bad_threads))
-		goto handle_err;
+	free(cpus);
+	return pool;
+
+handle_err_4:
+	for (int i = 0; i < n_threads; i++)
+		free(pool->tasks[i]);
+	free(pool->tasks);
+handle_err_3:
+	thread_pool_destroy(pool->threads);
+handle_err_2:
+	free(cpus);
+handle_err_1:
+	free(pool);
+handle_err_0:
+	return NULL;
+}
 
-	/* Run non-main tasks */
-	if (integrate_run_tasks(tasks + 1, threads + 1, n_threads - 1))
-		goto handle_err;
+/* perf_event counts the calling thread only */
+static void integrate_pool_open_counters(void *arg, int thread_idx)
+{
+	struct integrate_pool *pool = arg;
+	struct perf_counters *pc = &pool->counters[thread_idx];
+	unsigned mask = perf_counters_open(pc);
+	__atomic_and_fetch(&pool->counters_mask, mask, __ATOMIC_RELAXED);
+	pool->tasks[thread_idx]->counters = pc;
+}
 
-	/* Run main task */
-	integrate_task_worker(&tasks[0].task);
+static void integrate_pool_close_counters(void *arg, int thread_idx)
+{
+	struct integrate_pool *pool = arg;
+	perf_counters_close(&pool->counters[thread_idx]);
+}
 
-	/* Finish bad tasks */
-	if (n_bad_threads && integrate_join_tasks(bad_threads, n_bad_threads))
-		goto handle_err;
+unsigned integrate_pool_counters_enable(struct integrate_pool *pool)
+{
+	if (pool->counters)
+		return pool->counters_mask;
 
-	/* Finish non-main tasks */
-	if (integrate_join_tasks(threads + 1, n_threads - 1))
-		goto handle_err;
+	pool->counters = calloc(pool->n_threads, sizeof(*pool->counters));
+	if (!pool->counters) {
+		perror("Error: calloc");
+		return 0;
+	}
+	pool->counters_mask = (1U << PERF_COUNTER_COUNT) - 1;
+	thread_pool_submit(pool->threads, integrate_pool_open_counters, pool);
+	thread_pool_wait(pool->threads);
+
+	DUMP_LOG_DO({
+		char names[128] = " none";
+		size_t len = 0;
+		for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+			if (pool->counters_mask & (1U << i))
+				len += snprintf(names + len, sizeof(names) - len,
+						" %s", perf_counter_name(i));
+		}
+		DUMP_LOG("pool counters:%s\n", names);
+	});
+	return pool->counters_mask;
+}
 
-	/* Sumary */
-	*result = integrate_accumulate_result(tasks, n_threads);
+int integrate_pool_counters(struct integrate_pool *pool,
+			    struct perf_sample *job,
+			    struct perf_sample *threads, int *cpus)
+{
+	if (!pool->counters)
+		return -1;
 
-	if (n_bad_threads) {
-		free(bad_tasks);
-		free(bad_threads);
+	memset(job, 0, sizeof(*job));
+	job->mask = pool->counters_mask;
+	for (int i = 0; i < pool->n_threads; i++) {
+		perf_sample_add(job, &pool->counters[i].delta);
+		if (threads)
+			threads[i] = pool->counters[i].delta;
+		if (cpus)
+			cpus[i] = pool->tasks[i]->cpu;
 	}
-	free(tasks);
-	free(threads);
 	return 0;
+}
 
-handle_err:
-	if (bad_threads) {
-		integrate_cancel_tasks(bad_threads, n_bad_threads);
-		free(bad_threads);
+int integrate_pool_cpus(struct integrate_pool *pool, cpu_set_t *set)
+{
+	CPU_ZERO(set);
+	for (int i = 0; i < pool->n_threads; i++)
+		CPU_SET(pool->tasks[i]->cpu, set);
+	return pool->n_threads;
+}
+
+void integrate_pool_destroy(struct integrate_pool *pool)
+{
+	if (pool->counters) {
+		thread_pool_submit(pool->threads,
+				   integrate_pool_close_counters, pool);
+		thread_pool_wait(pool->threads);
+		free(pool->counters);
 	}
-	if (threads) {
-		integrate_cancel_tasks(threads + 1, n_threads - 1);
-		free(threads);
+	thread_pool_destroy(pool->threads);
+	for (int i = 0; i < pool->n_threads; i++)
+		free(pool->tasks[i]);
+	free(pool->partials);
+	free(pool->tasks);
+	free(pool);
+}
+
+int integrate_pool_run(struct integrate_pool *pool, size_t n_steps,
+		       long double base, long double step,
+		       const struct integrand *func,
+		       const struct integrate_rule *rule, long double *result)
+{
+	size_t n_chunks = integrate_reduce_n_chunks(0, n_steps);
+	if (n_chunks > pool->n_partials) {
+		double *partials =
+			realloc(pool->partials, sizeof(*partials) * n_chunks);
+		if (!partials) {
+			perror("Error: realloc");
+			return -1;
+		}
+		pool->partials = partials;
+		pool->n_partials = n_chunks;
 	}
-	if (bad_tasks)
-		free(bad_tasks);
-	if (tasks)
-		free(tasks);
-	return -1;
+
+	integrate_split_tasks(pool->tasks, pool->n_threads, n_steps,
+			      pool->partials, base, step, func, rule);
+
+	thread_pool_submit(pool->threads, integrate_pool_task, pool->tasks);
+	thread_pool_wait(pool->threads);
+
+	*result = integrate_reduce(pool->partials, n_chunks);
+	return 0;
+}
+
+int integrate_pool_batch(struct integrate_pool *pool,
+			 const struct integrate_batch_job *jobs, int n_jobs,
+			 long double *results)
+{
+	return integrate_batch_run(pool->threads, jobs, n_jobs, results, NULL,
+				   &pool->cancel);
+}
+
+int integrate_pool_batch_partials(struct integrate_pool *pool,
+				  const struct integrate_batch_job *jobs,
+				  int n_jobs, double *partials)
+{
+	return integrate_batch_run(pool->threads, jobs, n_jobs, NULL,
+				   partials, &pool->cancel);
+}
+
+void integrate_pool_cancel(struct integrate_pool *pool, int cancel)
+{
+	__atomic_store_n(&pool->cancel, cancel, __ATOMIC_RELAXED);
+}
+
+int integrate_pool_adaptive(struct integrate_pool *pool,
+			    const struct integrand *func, long double from,
+			    long double to, long double epsabs,
+			    long double epsrel, long double *result,
+			    long double *abserr)
+{
+	return integrate_adaptive_run(pool->threads, func, from, to, epsabs,
+				      epsrel, result, abserr);
 }
@@ -5,46 +5,254 @@
 #define CACHE_LINE_ALIGN 256
 typedef double worker_tmp_t;
 
-/* Function to integrate */
-#define INTEGRATE_FUNC(x) (2 / ((x) * (x) + 1))
+/* Work stealing: smallest chunk and guided divisor of own remainder */
+#define INTEGRATE_CHUNK_MIN (1 << 16)
+#define INTEGRATE_CHUNK_GUIDED_DIV 8
+
+/*
+ * Fixed reduction grid: one partial per INTEGRATE_REDUCE_CHUNK steps
+ * counted from step 0, partials summed in a fixed tree. Results do not
+ * depend on number of threads or workers.
+ */
+#define INTEGRATE_REDUCE_CHUNK (1 << 14)
+
+/* Weight calibration: best of reps runs of steps on every cpu */
+#define INTEGRATE_CALIBRATE_STEPS (1 << 20)
+#define INTEGRATE_CALIBRATE_REPS 5
+
+/* Adaptive quadrature interval heap limit */
+#define INTEGRATE_ADAPTIVE_MAX_INTERVALS (1 << 20)
+
+/* Default job, integrand itself is INTEGRAND_DEFAULT (integrand.h) */
 #define INTEGRATE_FROM 0.
 #define INTEGRATE_TO 50000.
-#define INTEGRATE_STEP 1 / (INTEGRATE_TO - INTEGRATE_FROM)
+#define INTEGRATE_STEPS_PER_UNIT 50000
 
 /* Network */
 #define INTEGRATE_UDP_PORT 4020
 #define INTEGRATE_TCP_PORT 4021
 #define INTEGRATE_NETW_TIMEOUT_USEC 1000 * 1000
 #define INTEGRATE_UDP_MAGIC 0xdead
-#define INTEGRATE_MAX_WORKERS 255
+#define INTEGRATE_MAX_WORKERS 4096
+#define INTEGRATE_COORDINATOR_PATH "/tmp/integrate_coordinator.sock"
 
-/* Main log (stderr) */
+/* Main log (stderr), asynchronous, see dump_log.h */
 #define ENABLE_DUMP_LOG
 
 #ifdef ENABLE_DUMP_LOG
-#define DUMP_LOG(...) (fprintf(stderr, "DUMP_LOG: " __VA_ARGS__))
+#define DUMP_LOG(...) DUMP_LOG_AT(DUMP_LOG_LVL_INFO, __VA_ARGS__)
+/* Per thread and per run messages */
+#define DUMP_LOG_DEBUG(...) DUMP_LOG_AT(DUMP_LOG_LVL_DEBUG, __VA_ARGS__)
+#define DUMP_LOG_AT(level, fmt, ...)                                          \
+	dump_log(level, "DUMP_LOG: " fmt, ##__VA_ARGS__)
 #define DUMP_LOG_DO(arg) arg
 #else
 #define DUMP_LOG(...)
+#define DUMP_LOG_DEBUG(...)
+#define DUMP_LOG_AT(...)
 #define DUMP_LOG_DO(arg)
 #endif
 
 #define TRACE_LINE (fprintf(stderr, "TRACE_LINE: %d\n", __LINE__))
 
+#include "dump_log.h"
+
 #include "cpu_topology.h"
+#include "integrand.h"
+#include "perf_counters.h"
+#include "trace.h"
 #include <stdio.h>
 
-/* Uses full cpuset */
-int integrate_multicore(cpu_set_t *cpuset, size_t n_steps, long double base,
-			long double step, long double *result);
+/* Fixed-grid rule applied on every step (panel) */
+enum integrate_rule_type {
+	INTEGRATE_RULE_RECT, /* left Riemann sum */
+	INTEGRATE_RULE_TRAPEZOID,
+	INTEGRATE_RULE_SIMPSON,
+	INTEGRATE_RULE_GAUSS, /* n_points Gauss-Legendre */
+};
+
+#define INTEGRATE_GAUSS_MAX_POINTS 16
+
+struct integrate_rule {
+	int type;
+	int n_points;
+};
+
+/* "rect", "trapezoid", "simpson" or "gauss<N>" */
+int integrate_rule_parse(const char *str, struct integrate_rule *rule);
+int integrate_rule_check(const struct integrate_rule *rule);
+/* Integrand evaluations per step */
+int integrate_rule_cost(const struct integrate_rule *rule);
+
+/* Integral of a batch over steps [start_step, +n_steps) from base */
+struct integrate_batch_job {
+	struct integrand func;
+	struct integrate_rule rule;
+	long double base;
+	long double step;
+	size_t start_step;
+	size_t n_steps;
+};
+
+/* Batch limit of one call and of one network request */
+#define INTEGRATE_BATCH_MAX (1 << 16)
+
+/* Chunks of the reduction grid touched by steps [start_step, +n_steps) */
+size_t integrate_reduce_first(size_t start_step);
+size_t integrate_reduce_n_chunks(size_t start_step, size_t n_steps);
+
+/* Compensated pairwise sum, tree shape depends on n only */
+long double integrate_reduce(const double *partials, size_t n);
+int integrate_reduce_selfcheck(FILE *stream);
+
+/* Job description for command line tools */
+struct integrate_job {
+	struct integrand func;
+	struct integrate_rule rule;
+	long double from;
+	long double to;
+	size_t n_steps; /* 0: INTEGRATE_STEPS_PER_UNIT */
+	long double epsrel; /* != 0: adaptive quadrature */
+
+	/* != 0: batch with param sweep_param in [sweep_from, sweep_to] */
+	int sweep_count;
+	int sweep_param;
+	double sweep_from;
+	double sweep_to;
+};
+
+/*
+ * -f func[:p0,..]|expr:f(x) -r rule -n n_steps -a from -b to -e epsrel
+ * -s param:from:to:count
+ */
+#define INTEGRATE_JOB_OPTS "f:r:n:a:b:e:s:"
+
+void integrate_job_init(struct integrate_job *job);
+int integrate_job_parse_opt(struct integrate_job *job, int opt,
+			    const char *arg);
+/* Range and step count after all options: from < to, n_steps >= 1 */
+int integrate_job_check(const struct integrate_job *job);
+/* Fixes default n_steps, returns step width */
+long double integrate_job_step(struct integrate_job *job);
+/* Fixes default n_steps, malloc'ed batch of sweep_count jobs */
+struct integrate_batch_job *integrate_job_sweep(struct integrate_job *job);
 
-/* Uses full cpuset with thrash-threads to get const cpufreq */
-int integrate_multicore_scalable(int n_threads, cpu_set_t *cpuset,
-				 size_t n_steps, long double base,
-				 long double step, long double *result);
+/*
+ * n_threads pinned to cpuset by placement, other cpus of it stay idle:
+ * frequency-stable timing is bench_integrate -F, not burnt cores.
+ */
+int integrate_multicore(int n_threads, cpu_set_t *cpuset, size_t n_steps,
+			long double base, long double step,
+			const struct integrand *func,
+			const struct integrate_rule *rule, long double *result);
+
+/* Override INTEGRATE_CHUNK_MIN and INTEGRATE_CHUNK_GUIDED_DIV */
+void integrate_set_chunking(size_t min_chunk, int guided_div);
+
+/*
+ * Thread placement of later runs and pools over their cpuset,
+ * enum cpu_place; topo must outlive them. NULL: cpu id order.
+ * Expression blocks are sized to the L1d of topo.
+ * Steps are split by cpu weights of topo, see cpu_topology_set_weights.
+ */
+void integrate_set_placement(struct cpu_topology *topo, int policy);
+
+/* Weights of cpuset cpus in topo from a short run on all of them at once */
+int integrate_calibrate_weights(struct cpu_topology *topo, cpu_set_t *cpuset);
+
+/* Summary weight of the cpus n_threads get, worker speed for starter */
+int integrate_placement_capacity(cpu_set_t *cpuset, int n_threads);
+
+/* Persistent pinned threads for many integrations */
+struct integrate_pool;
+
+struct integrate_pool *integrate_pool_create(int n_threads, cpu_set_t *cpuset);
+void integrate_pool_destroy(struct integrate_pool *pool);
+int integrate_pool_run(struct integrate_pool *pool, size_t n_steps,
+		       long double base, long double step,
+		       const struct integrand *func,
+		       const struct integrate_rule *rule, long double *result);
+
+/* Cpus the pool threads are pinned to, returns n_threads */
+int integrate_pool_cpus(struct integrate_pool *pool, cpu_set_t *set);
+
+/*
+ * Count every later pool run per thread: cycles, instructions,
+ * ref-cycles, task-clock, context switches and migrations.
+ * Returns mask of counters open on all threads, 0 if the kernel
+ * refuses them (perf_event_paranoid); runs are not affected then.
+ */
+unsigned integrate_pool_counters_enable(struct integrate_pool *pool);
+
+/*
+ * Counters of the last integrate_pool_run: job sum, and per thread
+ * with cpus[i] the cpu of thread i (n_threads each, may be NULL).
+ * -1 if counters are not enabled.
+ */
+int integrate_pool_counters(struct integrate_pool *pool,
+			    struct perf_sample *job,
+			    struct perf_sample *threads, int *cpus);
+
+/*
+ * Chunks of all jobs form one schedule, results[i] of jobs[i].
+ * Batches return 1 if cancelled, see integrate_pool_cancel.
+ */
+int integrate_pool_batch(struct integrate_pool *pool,
+			 const struct integrate_batch_job *jobs, int n_jobs,
+			 long double *results);
+
+/* Chunk partials of every job in job order, see integrate_reduce */
+int integrate_pool_batch_partials(struct integrate_pool *pool,
+				  const struct integrate_batch_job *jobs,
+				  int n_jobs, double *partials);
+
+/*
+ * != 0: batches of pool stop at their next chunks, with all threads
+ * out before they return. Async-signal-safe; 0 lets batches run again.
+ */
+void integrate_pool_cancel(struct integrate_pool *pool, int cancel);
+
+/* Adaptive GK15 on pool threads, 1 if tolerance not reached */
+int integrate_pool_adaptive(struct integrate_pool *pool,
+			    const struct integrand *func, long double from,
+			    long double to, long double epsabs,
+			    long double epsrel, long double *result,
+			    long double *abserr);
 
 int integrate_network_starter(size_t n_steps, long double base,
-			      long double step, long double *result);
+			      long double step, const struct integrand *func,
+			      const struct integrate_rule *rule,
+			      long double *result);
+
+/*
+ * Whole batch over the network workers. INTEGRATE_NETW_SCHED=static:
+ * one request per worker, shares by advertised speed; pull: workers
+ * take chunks from a queue, sized by their measured rate, and join
+ * (rebroadcast as the coordinator does) for as long as the job runs.
+ * Slices of lost or overdue workers are given to the others, or
+ * computed here if none is left. Near the end idle workers back up
+ * the slowest ones, INTEGRATE_NETW_BACKUP=slowdown[:max part], 0: off.
+ * INTEGRATE_COORDINATOR=path (empty: INTEGRATE_COORDINATOR_PATH) hands
+ * the batch to a running coordinator instead, as INTEGRATE_PRIORITY and
+ * INTEGRATE_TENANT (0 both by default).
+ */
+int integrate_network_starter_batch(const struct integrate_batch_job *jobs,
+				    int n_jobs, long double *results);
+
+/*
+ * Long-lived starter: workers join on its broadcast, repeated every
+ * INTEGRATE_NETW_TIMEOUT_USEC, and keep their sessions; clients submit
+ * batches at unix socket path. All batches run at once, chunk by chunk:
+ * the highest priority first, then the tenant least served for its
+ * weight, INTEGRATE_COORD_SHARES=tenant:weight[,...] (default 1).
+ * Returns on errors only.
+ */
+int integrate_network_coordinator(const char *path);
+
+/* Batch to the coordinator at path, waits for its results */
+int integrate_network_submit(const char *path,
+			     const struct integrate_batch_job *jobs, int n_jobs,
+			     int priority, int tenant, long double *results);
 
 int integrate_network_worker(int calc_speed, cpu_set_t *cpuset, int n_threads);
 
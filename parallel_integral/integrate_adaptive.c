@@ -0,0 +1,300 @@
+#include "integrate.h"
+#include "integrate_adaptive.h"
+
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+
+struct adapt_interval {
+	long double a;
+	long double b;
+	long double result;
+	long double err;
+};
+
+/* Shared state of one adaptive run, guarded by lock */
+struct adapt_state {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/* Max-heap by err */
+	struct adapt_interval *heap;
+	size_t heap_len;
+	size_t heap_cap;
+
+	/* Intervals too narrow to bisect */
+	long double final_result;
+	long double final_err;
+
+	/* Sums over heap, final and in-flight intervals */
+	long double total_result;
+	long double total_err;
+
+	long double epsabs;
+	long double epsrel;
+
+	const struct integrand *func;
+
+	int n_inflight;
+	int done;
+	int failed;
+};
+
+/* Gauss-Kronrod 7/15 nodes and weights (QUADPACK qk15) */
+static const long double xgk[8] = {
+	0.991455371120812639206854697526329L,
+	0.949107912342758524526189684047851L,
+	0.864864423359769072789712788640926L,
+	0.741531185599394439863864773280788L,
+	0.586087235467691130294144845693013L,
+	0.405845151377397166906606412076961L,
+	0.207784955007898467600689403773245L,
+	0.000000000000000000000000000000000L,
+};
+
+static const long double wgk[8] = {
+	0.022935322010529224963732008058970L,
+	0.063092092629978553290700663189204L,
+	0.104790010322250183839876322541518L,
+	0.140653259715525918745189590510238L,
+	0.169004726639267902826583426598550L,
+	0.190350578064785409913256402421014L,
+	0.204432940075298892414161999234649L,
+	0.209482141084727828012999174891714L,
+};
+
+static const long double wg[4] = {
+	0.129484966168869693270611432679082L,
+	0.279705391489276667901467771423780L,
+	0.381830050505118944950369775488975L,
+	0.417959183673469387755102040816327L,
+};
+
+/* All 15 points go through one specialized eval call */
+static void adapt_gk15(const struct integrand *func, struct adapt_interval *in)
+{
+	long double centr = (in->a + in->b) / 2;
+	long double hlgth = (in->b - in->a) / 2;
+	long double dhlgth = fabsl(hlgth);
+	double x[15], y[15];
+	long double fv1[7], fv2[7];
+
+	x[14] = centr;
+	for (int j = 0; j < 7; j++) {
+		long double absc = hlgth * xgk[j];
+		x[j] = centr - absc;
+		x[7 + j] = centr + absc;
+	}
+	integrand_eval(func, x, y, 15);
+
+	long double fc = y[14];
+	long double resg = fc * wg[3];
+	long double resk = fc * wgk[7];
+	long double resabs = fabsl(resk);
+
+	for (int j = 0; j < 7; j++) {
+		long double f1 = y[j];
+		long double f2 = y[7 + j];
+		fv1[j] = f1;
+		fv2[j] = f2;
+		resk += wgk[j] * (f1 + f2);
+		resabs += wgk[j] * (fabsl(f1) + fabsl(f2));
+		/* Gauss nodes are odd Kronrod ones */
+		if (j % 2)
+			resg += wg[j / 2] * (f1 + f2);
+	}
+
+	long double reskh = resk / 2;
+	long double resasc = wgk[7] * fabsl(fc - reskh);
+	for (int j = 0; j < 7; j++) {
+		resasc += wgk[j] *
+			  (fabsl(fv1[j] - reskh) + fabsl(fv2[j] - reskh));
+	}
+
+	in->result = resk * hlgth;
+	resabs *= dhlgth;
+	resasc *= dhlgth;
+
+	long double err = fabsl((resk - resg) * hlgth);
+	if (resasc != 0 && err != 0)
+		err = resasc * fminl(1, powl(200 * err / resasc, 1.5L));
+	if (resabs > LDBL_MIN / (50 * LDBL_EPSILON))
+		err = fmaxl(LDBL_EPSILON * 50 * resabs, err);
+	in->err = err;
+}
+
+/* Make room for n more intervals */
+static int adapt_heap_reserve(struct adapt_state *st, size_t n)
+{
+	if (st->heap_len + n <= st->heap_cap)
+		return 0;
+	if (st->heap_cap * 2 > INTEGRATE_ADAPTIVE_MAX_INTERVALS)
+		return -1;
+
+	size_t cap = st->heap_cap * 2;
+	struct adapt_interval *tmp = realloc(st->heap, sizeof(*tmp) * cap);
+	if (!tmp) {
+		perror("Error: realloc");
+		return -1;
+	}
+	st->heap = tmp;
+	st->heap_cap = cap;
+	return 0;
+}
+
+static void adapt_heap_push(struct adapt_state *st, struct adapt_interval *in)
+{
+	size_t i = st->heap_len++;
+	while (i && st->heap[(i - 1) / 2].err < in->err) {
+		st->heap[i] = st->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	st->heap[i] = *in;
+}
+
+static void adapt_heap_pop(struct adapt_state *st, struct adapt_interval *out)
+{
+	*out = st->heap[0];
+	struct adapt_interval last = st->heap[--st->heap_len];
+
+	size_t i = 0;
+	while (1) {
+		size_t child = 2 * i + 1;
+		if (child >= st->heap_len)
+			break;
+		if (child + 1 < st->heap_len &&
+		    st->heap[child + 1].err > st->heap[child].err)
+			child++;
+		if (st->heap[child].err <= last.err)
+			break;
+		st->heap[i] = st->heap[child];
+		i = child;
+	}
+	if (st->heap_len)
+		st->heap[i] = last;
+}
+
+static int adapt_converged(struct adapt_state *st)
+{
+	return st->total_err <=
+	       fmaxl(st->epsabs, st->epsrel * fabsl(st->total_result));
+}
+
+static void adapt_thread(void *arg, int thread_idx)
+{
+	struct adapt_state *st = arg;
+	struct adapt_interval in, half[2];
+
+	pthread_mutex_lock(&st->lock);
+	while (1) {
+		while (!st->done && !st->heap_len && st->n_inflight)
+			pthread_cond_wait(&st->cond, &st->lock);
+
+		if (!st->done && (adapt_converged(st) || !st->heap_len))
+			st->done = 1;
+		if (st->done)
+			break;
+
+		adapt_heap_pop(st, &in);
+		st->n_inflight++;
+		pthread_mutex_unlock(&st->lock);
+
+		long double mid = (in.a + in.b) / 2;
+		int narrow = !(in.a < mid && mid < in.b);
+		if (!narrow) {
+			half[0].a = in.a;
+			half[0].b = mid;
+			half[1].a = mid;
+			half[1].b = in.b;
+			adapt_gk15(st->func, &half[0]);
+			adapt_gk15(st->func, &half[1]);
+		}
+
+		pthread_mutex_lock(&st->lock);
+		st->n_inflight--;
+		if (!narrow && adapt_heap_reserve(st, 2)) {
+			/* Out of intervals, keep the unsplit one */
+			narrow = 1;
+			st->failed = 1;
+			st->done = 1;
+		}
+		if (narrow) {
+			st->final_result += in.result;
+			st->final_err += in.err;
+		} else {
+			st->total_result += half[0].result + half[1].result -
+					    in.result;
+			st->total_err += half[0].err + half[1].err - in.err;
+			adapt_heap_push(st, &half[0]);
+			adapt_heap_push(st, &half[1]);
+		}
+		pthread_cond_broadcast(&st->cond);
+	}
+	pthread_cond_broadcast(&st->cond);
+	pthread_mutex_unlock(&st->lock);
+}
+
+int integrate_adaptive_run(struct thread_pool *threads,
+			   const struct integrand *func, long double from,
+			   long double to, long double epsabs,
+			   long double epsrel, long double *result,
+			   long double *abserr)
+{
+	struct adapt_state st = {
+		.epsabs = epsabs,
+		.epsrel = epsrel,
+		.func = func,
+	};
+
+	/* Start from several intervals so every thread has work */
+	int n_init = thread_pool_size(threads) * 4;
+	st.heap_cap = 2 * n_init;
+	st.heap = malloc(sizeof(*st.heap) * st.heap_cap);
+	if (!st.heap) {
+		perror("Error: malloc");
+		return -1;
+	}
+
+	for (int i = 0; i < n_init; i++) {
+		struct adapt_interval in;
+		in.a = from + (to - from) * i / n_init;
+		in.b = from + (to - from) * (i + 1) / n_init;
+		adapt_gk15(func, &in);
+		st.total_result += in.result;
+		st.total_err += in.err;
+		adapt_heap_push(&st, &in);
+	}
+
+	pthread_mutex_init(&st.lock, NULL);
+	pthread_cond_init(&st.cond, NULL);
+
+	thread_pool_submit(threads, adapt_thread, &st);
+	thread_pool_wait(threads);
+
+	pthread_cond_destroy(&st.cond);
+	pthread_mutex_destroy(&st.lock);
+
+	/* Resum to drop rounding of incremental updates */
+	long double res = st.final_result;
+	long double err = st.final_err;
+	for (size_t i = 0; i < st.heap_len; i++) {
+		res += st.heap[i].result;
+		err += st.heap[i].err;
+	}
+	st.total_result = res;
+	st.total_err = err;
+
+	DUMP_LOG("adaptive: %zu intervals, result: %Lg, err: %Lg\n",
+		 st.heap_len, res, err);
+
+	free(st.heap);
+	*result = res;
+	*abserr = err;
+
+	if (st.failed) {
+		fprintf(stderr, "Error: adaptive: interval limit reached\n");
+		return 1;
+	}
+	return adapt_converged(&st) ? 0 : 1;
+}
@@ -0,0 +1,20 @@
+#ifndef INTEGRATE_ADAPTIVE_H_
+#define INTEGRATE_ADAPTIVE_H_
+
+#include "thread_pool.h"
+#include "integrand.h"
+
+/*
+ * Adaptive Gauss-Kronrod (7/15) quadrature of func on [from, to].
+ * Intervals with the largest error estimate are bisected by all pool
+ * threads in parallel until the summary estimate meets
+ * max(epsabs, epsrel * |result|).
+ * Returns 0 on success, 1 if tolerance was not reached, -1 on error.
+ */
+int integrate_adaptive_run(struct thread_pool *threads,
+			   const struct integrand *func, long double from,
+			   long double to, long double epsabs,
+			   long double epsrel, long double *result,
+			   long double *abserr);
+
+#endif /* INTEGRATE_ADAPTIVE_H_ */
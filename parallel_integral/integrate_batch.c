@@ -0,0 +1,268 @@
+#include "integrate.h"
+#include "integrate_batch.h"
+#include "integrate_kernels.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* One job, or up to INTEGRATE_KERNEL_SOA registered ones on one grid */
+struct batch_pack {
+	int n_jobs;
+	int jobs[INTEGRATE_KERNEL_SOA];
+	double params[INTEGRAND_MAX_PARAMS][INTEGRATE_KERNEL_SOA];
+};
+
+struct batch_chunk {
+	int pack;
+	size_t start_step;
+	size_t n_steps;
+	double res[INTEGRATE_KERNEL_SOA];
+};
+
+struct batch_state {
+	const struct integrate_batch_job *jobs;
+	const struct batch_pack *packs;
+	struct batch_chunk *chunks;
+	size_t n_chunks;
+	size_t next_chunk;
+	const struct integrate_kernel *kernel;
+	const int *cancel;
+};
+
+/* Orders jobs so that ones sharing a grid are adjacent */
+static int batch_grid_cmp(const void *a, const void *b)
+{
+	const struct integrate_batch_job *x =
+		*(const struct integrate_batch_job **)a;
+	const struct integrate_batch_job *y =
+		*(const struct integrate_batch_job **)b;
+
+#define BATCH_CMP(field)                                                       \
+	do {                                                                   \
+		if (x->field != y->field)                                      \
+			return x->field < y->field ? -1 : 1;                   \
+	} while (0)
+	BATCH_CMP(func.id);
+	BATCH_CMP(rule.type);
+	BATCH_CMP(rule.n_points);
+	BATCH_CMP(base);
+	BATCH_CMP(step);
+	BATCH_CMP(start_step);
+	BATCH_CMP(n_steps);
+#undef BATCH_CMP
+
+	/* Stable: keep input order inside a grid */
+	return x < y ? -1 : x > y;
+}
+
+static int batch_same_grid(const struct integrate_batch_job *x,
+			   const struct integrate_batch_job *y)
+{
+	return x->func.id == y->func.id && x->rule.type == y->rule.type &&
+	       x->rule.n_points == y->rule.n_points && x->base == y->base &&
+	       x->step == y->step && x->start_step == y->start_step &&
+	       x->n_steps == y->n_steps;
+}
+
+/* Returns number of packs */
+static int batch_make_packs(const struct integrate_batch_job *jobs,
+			    int n_jobs, struct batch_pack *packs)
+{
+	const struct integrate_batch_job **order =
+		malloc(sizeof(*order) * n_jobs);
+	if (!order) {
+		perror("Error: malloc");
+		return -1;
+	}
+	for (int i = 0; i < n_jobs; i++)
+		order[i] = &jobs[i];
+	qsort(order, n_jobs, sizeof(*order), batch_grid_cmp);
+
+	int n_packs = 0;
+	for (int i = 0; i < n_jobs; n_packs++) {
+		struct batch_pack *pack = &packs[n_packs];
+		const struct integrate_batch_job *first = order[i];
+		pack->n_jobs = 0;
+
+		/* Expressions have no soa kernel */
+		do {
+			pack->jobs[pack->n_jobs++] = order[i] - jobs;
+			i++;
+		} while (first->func.id != INTEGRAND_EXPR && i < n_jobs &&
+			 pack->n_jobs < INTEGRATE_KERNEL_SOA &&
+			 batch_same_grid(first, order[i]));
+
+		/* Spare lanes repeat the first func */
+		for (int k = 0; k < INTEGRATE_KERNEL_SOA; k++) {
+			int job = pack->jobs[k < pack->n_jobs ? k : 0];
+			for (int j = 0; j < INTEGRAND_MAX_PARAMS; j++)
+				pack->params[j][k] = jobs[job].func.params[j];
+		}
+	}
+
+	free(order);
+	return n_packs;
+}
+
+static void batch_worker(void *arg, int thread_idx)
+{
+	struct batch_state *st = arg;
+	DUMP_LOG_DO(size_t dump_chunks = 0);
+
+	size_t i;
+	while ((i = __atomic_fetch_add(&st->next_chunk, 1,
+				       __ATOMIC_RELAXED)) < st->n_chunks) {
+		if (st->cancel && __atomic_load_n(st->cancel, __ATOMIC_RELAXED))
+			break;
+
+		struct batch_chunk *chunk = &st->chunks[i];
+		const struct batch_pack *pack = &st->packs[chunk->pack];
+		const struct integrate_batch_job *job =
+			&st->jobs[pack->jobs[0]];
+		uint64_t trace_start = trace_begin();
+
+		if (pack->n_jobs == 1) {
+			chunk->res[0] = integrate_rule_apply(
+				&job->rule, integrate_kernel_get(&job->func),
+				&job->func, job->base, job->step,
+				chunk->start_step, chunk->n_steps);
+		} else {
+			integrate_rule_apply_soa(
+				&job->rule, st->kernel->soa_funcs[job->func.id],
+				pack->params, job->base, job->step,
+				chunk->start_step, chunk->n_steps, chunk->res);
+		}
+		trace_end(TRACE_batch_chunk, trace_start, chunk->pack);
+		DUMP_LOG_DO(dump_chunks++);
+	}
+
+	DUMP_LOG_DEBUG("batch thread %d: %zu chunks\n", thread_idx, dump_chunks);
+}
+
+int integrate_batch_run(struct thread_pool *threads,
+			const struct integrate_batch_job *jobs, int n_jobs,
+			long double *results, double *partials,
+			const int *cancel)
+{
+	if (n_jobs < 1 || n_jobs > INTEGRATE_BATCH_MAX) {
+		fprintf(stderr, "Error: wrong batch size %d\n", n_jobs);
+		goto handle_err_0;
+	}
+	for (int i = 0; i < n_jobs; i++) {
+		if (integrand_check(&jobs[i].func) < 0 ||
+		    integrate_rule_check(&jobs[i].rule) < 0) {
+			fprintf(stderr, "Error: wrong batch job %d\n", i);
+			goto handle_err_0;
+		}
+	}
+
+	struct batch_pack *packs = malloc(sizeof(*packs) * n_jobs);
+	size_t *offsets = malloc(sizeof(*offsets) * n_jobs);
+	if (!packs || !offsets) {
+		perror("Error: malloc");
+		goto handle_err_1;
+	}
+	int n_packs = batch_make_packs(jobs, n_jobs, packs);
+	if (n_packs < 0)
+		goto handle_err_1;
+
+	/* Output partials of every job in job order */
+	offsets[0] = 0;
+	for (int i = 1; i < n_jobs; i++)
+		offsets[i] = offsets[i - 1] +
+			     integrate_reduce_n_chunks(jobs[i - 1].start_step,
+						       jobs[i - 1].n_steps);
+
+	/* Chunks of the reduction grid, so sums do not depend on packing */
+	size_t n_chunks = 0;
+	for (int p = 0; p < n_packs; p++) {
+		const struct integrate_batch_job *job = &jobs[packs[p].jobs[0]];
+		n_chunks += integrate_reduce_n_chunks(job->start_step,
+						      job->n_steps);
+	}
+
+	struct batch_chunk *chunks =
+		malloc(sizeof(*chunks) * (n_chunks ? n_chunks : 1));
+	double *gather = malloc(sizeof(*gather) * (n_chunks ? n_chunks : 1));
+	if (!chunks || !gather) {
+		perror("Error: malloc");
+		goto handle_err_2;
+	}
+
+	struct batch_chunk *chunk = chunks;
+	for (int p = 0; p < n_packs; p++) {
+		const struct integrate_batch_job *job = &jobs[packs[p].jobs[0]];
+		size_t cur_step = job->start_step;
+		size_t end_step = job->start_step + job->n_steps;
+		size_t c = integrate_reduce_first(cur_step);
+
+		for (; cur_step != end_step; chunk++) {
+			size_t next = ++c * INTEGRATE_REDUCE_CHUNK;
+			if (next > end_step)
+				next = end_step;
+			chunk->pack = p;
+			chunk->start_step = cur_step;
+			chunk->n_steps = next - cur_step;
+			cur_step = next;
+		}
+	}
+
+	struct batch_state st = {
+		.jobs = jobs,
+		.packs = packs,
+		.chunks = chunks,
+		.n_chunks = n_chunks,
+		.next_chunk = 0,
+		.kernel = integrate_kernel_select(),
+		.cancel = cancel,
+	};
+	DUMP_LOG("batch: %d jobs, %d packs, %zu chunks\n", n_jobs, n_packs,
+		 n_chunks);
+
+	thread_pool_submit(threads, batch_worker, &st);
+	thread_pool_wait(threads);
+
+	/* Threads are done with everything here, chunks may be left */
+	int ret = 0;
+	if (cancel && __atomic_load_n(cancel, __ATOMIC_RELAXED)) {
+		DUMP_LOG("batch: cancelled\n");
+		ret = 1;
+		goto handle_cancel;
+	}
+
+	/* Chunks of a pack are adjacent, in step order */
+	chunk = chunks;
+	for (int p = 0; p < n_packs; p++) {
+		const struct batch_pack *pack = &packs[p];
+		const struct integrate_batch_job *job = &jobs[pack->jobs[0]];
+		size_t n = integrate_reduce_n_chunks(job->start_step,
+						     job->n_steps);
+
+		for (int k = 0; k < pack->n_jobs; k++) {
+			int idx = pack->jobs[k];
+			double *dst = partials ? partials + offsets[idx] :
+						 gather;
+			for (size_t i = 0; i < n; i++)
+				dst[i] = chunk[i].res[k];
+			if (results)
+				results[idx] = integrate_reduce(dst, n);
+		}
+		chunk += n;
+	}
+
+handle_cancel:
+	free(gather);
+	free(chunks);
+	free(offsets);
+	free(packs);
+	return ret;
+
+handle_err_2:
+	free(gather);
+	free(chunks);
+handle_err_1:
+	free(offsets);
+	free(packs);
+handle_err_0:
+	return -1;
+}
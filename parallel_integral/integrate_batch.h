@@ -0,0 +1,22 @@
+#ifndef INTEGRATE_BATCH_H_
+#define INTEGRATE_BATCH_H_
+
+#include "thread_pool.h"
+#include "integrate.h"
+
+/*
+ * Many small integrals as one schedule of pool threads.
+ * Registered integrands on the same grid with the same rule are packed
+ * by INTEGRATE_KERNEL_SOA and evaluated together. Packs are cut by the
+ * reduction grid, threads take chunks from a shared counter.
+ * results[i] (if not NULL) is the sum of jobs[i], partials (if not
+ * NULL) get chunk partials of every job in job order.
+ * *cancel (if not NULL) != 0 stops threads at their next chunk, the
+ * run returns 1 once all of them are out.
+ */
+int integrate_batch_run(struct thread_pool *threads,
+			const struct integrate_batch_job *jobs, int n_jobs,
+			long double *results, double *partials,
+			const int *cancel);
+
+#endif /* INTEGRATE_BATCH_H_ */
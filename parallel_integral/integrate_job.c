@@ -0,0 +1,142 @@
+#include "integrate.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+void integrate_job_init(struct integrate_job *job)
+{
+	integrand_init(&job->func, INTEGRAND_DEFAULT);
+	job->rule.type = INTEGRATE_RULE_RECT;
+	job->rule.n_points = 1;
+	job->from = INTEGRATE_FROM;
+	job->to = INTEGRATE_TO;
+	job->n_steps = 0;
+	job->epsrel = 0;
+	job->sweep_count = 0;
+}
+
+/* "param:from:to:count" */
+static int parse_sweep(struct integrate_job *job, const char *arg)
+{
+	int n_read;
+	if (sscanf(arg, "%d:%lf:%lf:%d%n", &job->sweep_param, &job->sweep_from,
+		   &job->sweep_to, &job->sweep_count, &n_read) != 4 ||
+	    arg[n_read] != '\0' || job->sweep_param < 0 ||
+	    job->sweep_param >= INTEGRAND_MAX_PARAMS ||
+	    job->sweep_count < 1 || job->sweep_count > INTEGRATE_BATCH_MAX) {
+		fprintf(stderr, "Error: wrong sweep %s\n", arg);
+		return -1;
+	}
+	return 0;
+}
+
+static int parse_ld(const char *arg, long double *res)
+{
+	char *endptr;
+	errno = 0;
+	*res = strtold(arg, &endptr);
+	return (errno || endptr == arg || *endptr != '\0') ? -1 : 0;
+}
+
+int integrate_job_parse_opt(struct integrate_job *job, int opt,
+			    const char *arg)
+{
+	char *endptr;
+	unsigned long long n;
+
+	switch (opt) {
+	case 'f':
+		integrand_fini(&job->func);
+		return integrand_parse(arg, &job->func);
+	case 'r':
+		if (integrate_rule_parse(arg, &job->rule)) {
+			fprintf(stderr, "Error: wrong rule %s\n", arg);
+			return -1;
+		}
+		return 0;
+	case 'n':
+		errno = 0;
+		n = strtoull(arg, &endptr, 10);
+		if (errno || *endptr != '\0' || n == 0) {
+			fprintf(stderr, "Error: wrong n_steps\n");
+			return -1;
+		}
+		job->n_steps = n;
+		return 0;
+	case 'a':
+		return parse_ld(arg, &job->from);
+	case 'b':
+		return parse_ld(arg, &job->to);
+	case 'e':
+		if (parse_ld(arg, &job->epsrel) || job->epsrel <= 0) {
+			fprintf(stderr, "Error: wrong epsrel\n");
+			return -1;
+		}
+		return 0;
+	case 's':
+		return parse_sweep(job, arg);
+	}
+	return -1;
+}
+
+int integrate_job_check(const struct integrate_job *job)
+{
+	if (!(job->from < job->to)) {
+		fprintf(stderr, "Error: wrong range [%Lg, %Lg]\n", job->from,
+			job->to);
+		return -1;
+	}
+
+	/* Fixed grid: the default step count must be one at least */
+	long double n_steps = (job->to - job->from) * INTEGRATE_STEPS_PER_UNIT;
+	if (!job->epsrel && !job->n_steps &&
+	    !(n_steps >= 1 && n_steps < (long double)SIZE_MAX)) {
+		fprintf(stderr, "Error: wrong n_steps for [%Lg, %Lg], use -n\n",
+			job->from, job->to);
+		return -1;
+	}
+	return 0;
+}
+
+long double integrate_job_step(struct integrate_job *job)
+{
+	if (!job->n_steps)
+		job->n_steps = (job->to - job->from) * INTEGRATE_STEPS_PER_UNIT;
+	return (job->to - job->from) / job->n_steps;
+}
+
+struct integrate_batch_job *integrate_job_sweep(struct integrate_job *job)
+{
+	if (job->func.id == INTEGRAND_EXPR ||
+	    job->sweep_param >= integrands[job->func.id].n_params) {
+		fprintf(stderr, "Error: integrand has no param %d\n",
+			job->sweep_param);
+		return NULL;
+	}
+
+	struct integrate_batch_job *batch =
+		malloc(sizeof(*batch) * job->sweep_count);
+	if (!batch) {
+		perror("Error: malloc");
+		return NULL;
+	}
+
+	long double step = integrate_job_step(job);
+	double delta = 0;
+	if (job->sweep_count > 1)
+		delta = (job->sweep_to - job->sweep_from) /
+			(job->sweep_count - 1);
+
+	for (int i = 0; i < job->sweep_count; i++) {
+		batch[i].func = job->func;
+		batch[i].func.params[job->sweep_param] =
+			job->sweep_from + i * delta;
+		batch[i].rule = job->rule;
+		batch[i].base = job->from;
+		batch[i].step = step;
+		batch[i].start_step = 0;
+		batch[i].n_steps = job->n_steps;
+	}
+	return batch;
+}
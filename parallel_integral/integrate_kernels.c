@@ -0,0 +1,633 @@
+#include "integrate.h"
+#include "integrate_kernels.h"
+#include "integrand.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#endif
+
+/*
+ * Independent accumulators per kernel, hides FP add latency.
+ * Summation order is the same for every kernel: step i of a call goes
+ * to lane i % KERNEL_LANES, lanes are summed pairwise. So all kernels
+ * give bit-identical sums (see -ffp-contract=off in Makefile).
+ */
+#define KERNEL_LANES 16
+
+/* Params are loaded once per call, then inlined into expr as scalars */
+#define KERNEL_LOAD_PARAMS(params)                                             \
+	double p0 = (params)[0], p1 = (params)[1];                             \
+	double p2 = (params)[2], p3 = (params)[3];                             \
+	(void)p0, (void)p1, (void)p2, (void)p3
+
+static int kernel_always_supported(void)
+{
+	return 1;
+}
+
+/* Lanes summed pairwise in fixed order */
+static double kernel_reduce_lanes(double *lanes)
+{
+	for (int w = KERNEL_LANES / 2; w != 0; w /= 2) {
+		for (int l = 0; l < w; l++)
+			lanes[l] += lanes[l + w];
+	}
+	return lanes[0];
+}
+
+#define KERNEL_SCALAR_SUM(expr, res)                                           \
+	do {                                                                   \
+		double lanes[KERNEL_LANES] = { 0 };                            \
+		size_t cur_step = start_step;                                  \
+		for (size_t i = 0; i < n_steps; i++, cur_step++) {             \
+			double x = base + cur_step * step;                     \
+			lanes[i % KERNEL_LANES] += (expr);                     \
+		}                                                              \
+		res = kernel_reduce_lanes(lanes);                              \
+	} while (0)
+
+/* Reference kernels */
+#define DEFINE_SCALAR_KERNEL(name, n_params, d0, d1, d2, d3, expr)             \
+	static double kernel_scalar_##name(                                    \
+		const struct integrand *func, double base, double step,        \
+		size_t start_step, size_t n_steps)                             \
+	{                                                                      \
+		KERNEL_LOAD_PARAMS(func->params);                              \
+		double sum;                                                    \
+		KERNEL_SCALAR_SUM(expr, sum);                                  \
+		return sum;                                                    \
+	}
+
+INTEGRANDS(DEFINE_SCALAR_KERNEL)
+
+static const integrate_kernel_t kernels_scalar[INTEGRAND_COUNT] = {
+#define KERNEL_ENTRY(name, ...) kernel_scalar_##name,
+	INTEGRANDS(KERNEL_ENTRY)
+#undef KERNEL_ENTRY
+};
+
+#define DEFINE_SCALAR_SOA_KERNEL(name, n_params, d0, d1, d2, d3, expr)         \
+	static void soa_scalar_##name(                                         \
+		const double (*params)[INTEGRATE_KERNEL_SOA], double base,     \
+		double step, size_t start_step, size_t n_steps, double *sums)  \
+	{                                                                      \
+		for (int k = 0; k < INTEGRATE_KERNEL_SOA; k++) {               \
+			double p0 = params[0][k], p1 = params[1][k];           \
+			double p2 = params[2][k], p3 = params[3][k];           \
+			(void)p0, (void)p1, (void)p2, (void)p3;                \
+			KERNEL_SCALAR_SUM(expr, sums[k]);                      \
+		}                                                              \
+	}
+
+INTEGRANDS(DEFINE_SCALAR_SOA_KERNEL)
+
+static const integrate_soa_kernel_t soa_scalar[INTEGRAND_COUNT] = {
+#define KERNEL_ENTRY(name, ...) soa_scalar_##name,
+	INTEGRANDS(KERNEL_ENTRY)
+#undef KERNEL_ENTRY
+};
+
+#ifdef KERNELS_X86
+
+typedef double v2d __attribute__((vector_size(16)));
+typedef double v4d __attribute__((vector_size(32)));
+typedef double v8d __attribute__((vector_size(64)));
+
+/*
+ * x is built from a vector of step indices as doubles (exact below 2^53),
+ * so each lane costs one mul+add and never drifts like x += step would.
+ * Remaining steps are spread over lanes before the final reduction.
+ */
+#define DEFINE_SIMD_KERNEL(kname, isa, vec_t, expr)                            \
+	__attribute__((target(isa))) static double kname(                      \
+		const struct integrand *func, double base, double step,        \
+		size_t start_step, size_t n_steps)                             \
+	{                                                                      \
+		enum { W = sizeof(vec_t) / sizeof(double) };                   \
+		enum { N_ACC = KERNEL_LANES / W };                             \
+		KERNEL_LOAD_PARAMS(func->params);                              \
+		vec_t acc[N_ACC];                                              \
+		vec_t idx[N_ACC];                                              \
+                                                                               \
+		for (int j = 0; j < N_ACC; j++) {                              \
+			for (int l = 0; l < W; l++) {                          \
+				acc[j][l] = 0;                                 \
+				idx[j][l] = (double)(start_step + j * W + l);  \
+			}                                                      \
+		}                                                              \
+                                                                               \
+		for (size_t i = n_steps / KERNEL_LANES; i != 0; i--) {         \
+			_Pragma("GCC unroll 8") for (int j = 0; j < N_ACC;     \
+						     j++)                      \
+			{                                                      \
+				vec_t x = base + idx[j] * step;                \
+				acc[j] += (expr);                              \
+				idx[j] += KERNEL_LANES;                        \
+			}                                                      \
+		}                                                              \
+                                                                               \
+		double lanes[KERNEL_LANES];                                    \
+		for (int j = 0; j < N_ACC; j++) {                              \
+			for (int l = 0; l < W; l++)                            \
+				lanes[j * W + l] = acc[j][l];                  \
+		}                                                              \
+		size_t done = n_steps - n_steps % KERNEL_LANES;                \
+		size_t cur_step = start_step + done;                           \
+		for (int l = 0; done != n_steps; done++, cur_step++, l++) {    \
+			double x = base + cur_step * step;                     \
+			lanes[l] += (expr);                                    \
+		}                                                              \
+		return kernel_reduce_lanes(lanes);                             \
+	}
+
+#define DEFINE_ISA_KERNELS(name, n_params, d0, d1, d2, d3, expr)               \
+	DEFINE_SIMD_KERNEL(kernel_sse2_##name, "sse2", v2d, expr)              \
+	DEFINE_SIMD_KERNEL(kernel_avx2_##name, "avx2", v4d, expr)              \
+	DEFINE_SIMD_KERNEL(kernel_avx512_##name, "avx512f", v8d, expr)
+
+INTEGRANDS(DEFINE_ISA_KERNELS)
+
+/*
+ * Structure of arrays: vector lanes are different funcs, x is a scalar
+ * shared by all of them, so one grid point feeds INTEGRATE_KERNEL_SOA
+ * evaluations. Each func keeps KERNEL_LANES accumulators of the common
+ * summation order, a block of steps is unrolled to keep them apart.
+ */
+#define SOA_ACCUM(vec_t, expr, l)                                              \
+	do {                                                                   \
+		double x = base + cur_step * step;                             \
+		for (int v = 0; v < N_VEC; v++) {                              \
+			vec_t p0 = pv[0][v], p1 = pv[1][v];                    \
+			vec_t p2 = pv[2][v], p3 = pv[3][v];                    \
+			(void)p0, (void)p1, (void)p2, (void)p3;                \
+			acc[l][v] += (expr);                                   \
+		}                                                              \
+	} while (0)
+
+#define DEFINE_SIMD_SOA_KERNEL(kname, isa, vec_t, expr)                        \
+	__attribute__((target(isa))) static void kname(                        \
+		const double (*params)[INTEGRATE_KERNEL_SOA], double base,     \
+		double step, size_t start_step, size_t n_steps, double *sums)  \
+	{                                                                      \
+		enum { W = sizeof(vec_t) / sizeof(double) };                   \
+		enum { N_VEC = INTEGRATE_KERNEL_SOA / W };                     \
+		vec_t pv[INTEGRAND_MAX_PARAMS][N_VEC];                         \
+		vec_t acc[KERNEL_LANES][N_VEC];                                \
+                                                                               \
+		for (int v = 0; v < N_VEC; v++) {                              \
+			for (int j = 0; j < INTEGRAND_MAX_PARAMS; j++)         \
+				memcpy(&pv[j][v], &params[j][v * W],           \
+				       sizeof(vec_t));                         \
+			for (int l = 0; l < KERNEL_LANES; l++)                 \
+				acc[l][v] = (vec_t){ 0 };                      \
+		}                                                              \
+                                                                               \
+		size_t cur_step = start_step;                                  \
+		for (size_t i = n_steps / KERNEL_LANES; i != 0; i--) {         \
+			_Pragma("GCC unroll 16") for (int l = 0;               \
+						      l < KERNEL_LANES;        \
+						      l++, cur_step++)         \
+				SOA_ACCUM(vec_t, expr, l);                     \
+		}                                                              \
+		for (int l = 0; cur_step != start_step + n_steps;              \
+		     l++, cur_step++)                                          \
+			SOA_ACCUM(vec_t, expr, l);                             \
+                                                                               \
+		for (int v = 0; v < N_VEC; v++) {                              \
+			for (int m = 0; m < W; m++) {                          \
+				double lanes[KERNEL_LANES];                    \
+				for (int l = 0; l < KERNEL_LANES; l++)         \
+					lanes[l] = acc[l][v][m];               \
+				sums[v * W + m] = kernel_reduce_lanes(lanes);  \
+			}                                                      \
+		}                                                              \
+	}
+
+#define DEFINE_ISA_SOA_KERNELS(name, n_params, d0, d1, d2, d3, expr)           \
+	DEFINE_SIMD_SOA_KERNEL(soa_sse2_##name, "sse2", v2d, expr)             \
+	DEFINE_SIMD_SOA_KERNEL(soa_avx2_##name, "avx2", v4d, expr)             \
+	DEFINE_SIMD_SOA_KERNEL(soa_avx512_##name, "avx512f", v8d, expr)
+
+INTEGRANDS(DEFINE_ISA_SOA_KERNELS)
+
+static const integrate_kernel_t kernels_sse2[INTEGRAND_COUNT] = {
+#define KERNEL_ENTRY(name, ...) kernel_sse2_##name,
+	INTEGRANDS(KERNEL_ENTRY)
+#undef KERNEL_ENTRY
+};
+
+static const integrate_kernel_t kernels_avx2[INTEGRAND_COUNT] = {
+#define KERNEL_ENTRY(name, ...) kernel_avx2_##name,
+	INTEGRANDS(KERNEL_ENTRY)
+#undef KERNEL_ENTRY
+};
+
+static const integrate_kernel_t kernels_avx512[INTEGRAND_COUNT] = {
+#define KERNEL_ENTRY(name, ...) kernel_avx512_##name,
+	INTEGRANDS(KERNEL_ENTRY)
+#undef KERNEL_ENTRY
+};
+
+static const integrate_soa_kernel_t soa_sse2[INTEGRAND_COUNT] = {
+#define KERNEL_ENTRY(name, ...) soa_sse2_##name,
+	INTEGRANDS(KERNEL_ENTRY)
+#undef KERNEL_ENTRY
+};
+
+static const integrate_soa_kernel_t soa_avx2[INTEGRAND_COUNT] = {
+#define KERNEL_ENTRY(name, ...) soa_avx2_##name,
+	INTEGRANDS(KERNEL_ENTRY)
+#undef KERNEL_ENTRY
+};
+
+static const integrate_soa_kernel_t soa_avx512[INTEGRAND_COUNT] = {
+#define KERNEL_ENTRY(name, ...) soa_avx512_##name,
+	INTEGRANDS(KERNEL_ENTRY)
+#undef KERNEL_ENTRY
+};
+
+/* __builtin_cpu_supports reads cpuid (and xgetbv for os support) */
+static int kernel_sse2_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+static int kernel_avx2_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+static int kernel_avx512_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f");
+}
+
+#endif /* KERNELS_X86 */
+
+const struct integrate_kernel integrate_kernels[] = {
+	{ "scalar", kernels_scalar, soa_scalar, kernel_always_supported },
+#ifdef KERNELS_X86
+	{ "sse2", kernels_sse2, soa_sse2, kernel_sse2_supported },
+	{ "avx2", kernels_avx2, soa_avx2, kernel_avx2_supported },
+	{ "avx512", kernels_avx512, soa_avx512, kernel_avx512_supported },
+#endif
+	{ NULL, NULL, NULL, NULL }
+};
+
+const struct integrate_kernel *integrate_kernel_find(const char *name)
+{
+	for (const struct integrate_kernel *k = integrate_kernels; k->name;
+	     k++) {
+		if (!strcmp(k->name, name))
+			return k->supported() ? k : NULL;
+	}
+	return NULL;
+}
+
+static const struct integrate_kernel *kernel_selected;
+static pthread_once_t kernel_select_once = PTHREAD_ONCE_INIT;
+
+static void kernel_select_init(void)
+{
+	const char *env = getenv("INTEGRATE_KERNEL");
+	if (env) {
+		kernel_selected = integrate_kernel_find(env);
+		if (kernel_selected)
+			return;
+		fprintf(stderr,
+			"Error: INTEGRATE_KERNEL=%s unsupported, "
+			"using best one\n",
+			env);
+	}
+
+	/* Kernels are sorted by width, take the last supported */
+	for (const struct integrate_kernel *k = integrate_kernels; k->name;
+	     k++) {
+		if (k->supported())
+			kernel_selected = k;
+	}
+}
+
+const struct integrate_kernel *integrate_kernel_select(void)
+{
+	pthread_once(&kernel_select_once, kernel_select_init);
+	return kernel_selected;
+}
+
+int integrate_kernel_force(const struct integrate_kernel *kernel)
+{
+	pthread_once(&kernel_select_once, kernel_select_init);
+	if (!kernel->supported())
+		return -1;
+	kernel_selected = kernel;
+	return 0;
+}
+
+/* Bytecode is interpreted by blocks, expr_sum_grid is simd inside */
+static double kernel_expr(const struct integrand *func, double base,
+			  double step, size_t start_step, size_t n_steps)
+{
+	return expr_sum_grid(func->code, base, step, start_step, n_steps);
+}
+
+integrate_kernel_t integrate_kernel_get(const struct integrand *func)
+{
+	if (func->id == INTEGRAND_EXPR)
+		return kernel_expr;
+	return integrate_kernel_select()->funcs[func->id];
+}
+
+int integrate_rule_parse(const char *str, struct integrate_rule *rule)
+{
+	rule->n_points = 1;
+	if (!strcmp(str, "rect")) {
+		rule->type = INTEGRATE_RULE_RECT;
+		return 0;
+	}
+	if (!strcmp(str, "trapezoid")) {
+		rule->type = INTEGRATE_RULE_TRAPEZOID;
+		return 0;
+	}
+	if (!strcmp(str, "simpson")) {
+		rule->type = INTEGRATE_RULE_SIMPSON;
+		return 0;
+	}
+	if (!strncmp(str, "gauss", 5)) {
+		char *endptr;
+		long n = strtol(str + 5, &endptr, 10);
+		if (*endptr != '\0' || n < 1 || n > INTEGRATE_GAUSS_MAX_POINTS)
+			return -1;
+		rule->type = INTEGRATE_RULE_GAUSS;
+		rule->n_points = n;
+		return 0;
+	}
+	return -1;
+}
+
+int integrate_rule_check(const struct integrate_rule *rule)
+{
+	switch (rule->type) {
+	case INTEGRATE_RULE_RECT:
+	case INTEGRATE_RULE_TRAPEZOID:
+	case INTEGRATE_RULE_SIMPSON:
+		return 0;
+	case INTEGRATE_RULE_GAUSS:
+		if (rule->n_points >= 1 &&
+		    rule->n_points <= INTEGRATE_GAUSS_MAX_POINTS)
+			return 0;
+	}
+	return -1;
+}
+
+int integrate_rule_cost(const struct integrate_rule *rule)
+{
+	switch (rule->type) {
+	case INTEGRATE_RULE_SIMPSON:
+		return 2;
+	case INTEGRATE_RULE_GAUSS:
+		return rule->n_points;
+	}
+	return 1;
+}
+
+/* gauss_t[n][i], gauss_w[n][i]: nodes on [-1, 1] and weights */
+static double gauss_t[INTEGRATE_GAUSS_MAX_POINTS + 1]
+		     [INTEGRATE_GAUSS_MAX_POINTS];
+static double gauss_w[INTEGRATE_GAUSS_MAX_POINTS + 1]
+		     [INTEGRATE_GAUSS_MAX_POINTS];
+static pthread_once_t gauss_once = PTHREAD_ONCE_INIT;
+
+/* Newton iterations on Legendre polynomial roots */
+static void gauss_init(void)
+{
+	for (int n = 1; n <= INTEGRATE_GAUSS_MAX_POINTS; n++) {
+		for (int i = 0; i < (n + 1) / 2; i++) {
+			long double z = cosl(M_PI * (i + 0.75L) / (n + 0.5L));
+			long double z1, pp;
+			do {
+				long double p1 = 1, p2 = 0, p3;
+				for (int j = 1; j <= n; j++) {
+					p3 = p2;
+					p2 = p1;
+					p1 = ((2 * j - 1) * z * p2 -
+					      (j - 1) * p3) /
+					     j;
+				}
+				pp = n * (z * p1 - p2) / (z * z - 1);
+				z1 = z;
+				z = z1 - p1 / pp;
+			} while (fabsl(z - z1) > 4 * LDBL_EPSILON);
+
+			gauss_t[n][i] = -z;
+			gauss_t[n][n - 1 - i] = z;
+			gauss_w[n][i] = 2 / ((1 - z * z) * pp * pp);
+			gauss_w[n][n - 1 - i] = gauss_w[n][i];
+		}
+	}
+}
+
+/* Sums of n_sums funcs over one grid, either kernel or soa kernel */
+struct rule_sums {
+	integrate_kernel_t kernel;
+	const struct integrand *func;
+	integrate_soa_kernel_t soa_kernel;
+	const double (*params)[INTEGRATE_KERNEL_SOA];
+	int n_sums;
+};
+
+static void rule_sums(const struct rule_sums *rs, double base, double step,
+		      size_t start_step, size_t n_steps, double *sums)
+{
+	if (rs->soa_kernel)
+		rs->soa_kernel(rs->params, base, step, start_step, n_steps,
+			       sums);
+	else
+		sums[0] = rs->kernel(rs->func, base, step, start_step, n_steps);
+}
+
+/*
+ * Every rule is a weighted sum of plain kernel sums over the same grid
+ * shifted inside the panel, so all of them reuse the SIMD kernels.
+ * Trapezoid and Simpson endpoints telescope to two extra evaluations.
+ */
+static void rule_apply(const struct integrate_rule *rule,
+		       const struct rule_sums *rs, double base, double step,
+		       size_t start_step, size_t n_steps, double *res)
+{
+	double sum[INTEGRATE_KERNEL_SOA];
+	double a[INTEGRATE_KERNEL_SOA];
+	double b[INTEGRATE_KERNEL_SOA];
+	int n = rs->n_sums;
+
+	for (int k = 0; k < n; k++)
+		res[k] = 0;
+	if (n_steps == 0)
+		return;
+
+	/* Gauss nodes are all inside the panel */
+	if (rule->type != INTEGRATE_RULE_GAUSS)
+		rule_sums(rs, base, step, start_step, n_steps, sum);
+
+	switch (rule->type) {
+	case INTEGRATE_RULE_RECT:
+		for (int k = 0; k < n; k++)
+			res[k] = sum[k] * step;
+		return;
+
+	case INTEGRATE_RULE_TRAPEZOID:
+		rule_sums(rs, base, step, start_step + n_steps, 1, a);
+		rule_sums(rs, base, step, start_step, 1, b);
+		for (int k = 0; k < n; k++)
+			res[k] = (sum[k] + (a[k] - b[k]) / 2) * step;
+		return;
+
+	case INTEGRATE_RULE_SIMPSON:
+		rule_sums(rs, base, step, start_step + n_steps, 1, a);
+		rule_sums(rs, base, step, start_step, 1, b);
+		for (int k = 0; k < n; k++)
+			sum[k] = 2 * sum[k] + (a[k] - b[k]);
+		rule_sums(rs, base + step / 2, step, start_step, n_steps, a);
+		for (int k = 0; k < n; k++)
+			res[k] = (sum[k] + 4 * a[k]) * step / 6;
+		return;
+
+	case INTEGRATE_RULE_GAUSS:
+		pthread_once(&gauss_once, gauss_init);
+		for (int i = 0; i < rule->n_points; i++) {
+			double t = gauss_t[rule->n_points][i];
+			double w = gauss_w[rule->n_points][i];
+			rule_sums(rs, base + step * (1 + t) / 2, step,
+				  start_step, n_steps, a);
+			for (int k = 0; k < n; k++)
+				res[k] += w * a[k];
+		}
+		for (int k = 0; k < n; k++)
+			res[k] *= step / 2;
+		return;
+	}
+}
+
+double integrate_rule_apply(const struct integrate_rule *rule,
+			    integrate_kernel_t kernel,
+			    const struct integrand *func,
+			    double base, double step, size_t start_step,
+			    size_t n_steps)
+{
+	struct rule_sums rs = { .kernel = kernel, .func = func, .n_sums = 1 };
+	double res;
+	rule_apply(rule, &rs, base, step, start_step, n_steps, &res);
+	return res;
+}
+
+void integrate_rule_apply_soa(const struct integrate_rule *rule,
+			      integrate_soa_kernel_t kernel,
+			      const double (*params)[INTEGRATE_KERNEL_SOA],
+			      double base, double step, size_t start_step,
+			      size_t n_steps, double *res)
+{
+	struct rule_sums rs = { .soa_kernel = kernel,
+				.params = params,
+				.n_sums = INTEGRATE_KERNEL_SOA };
+	rule_apply(rule, &rs, base, step, start_step, n_steps, res);
+}
+
+/* Max rel err of soa kernel vs scalar kernel on distinct params */
+static double kernel_soa_err(const struct integrate_kernel *k, int f,
+			     double base, double step, size_t start_step,
+			     size_t n_steps)
+{
+	double params[INTEGRAND_MAX_PARAMS][INTEGRATE_KERNEL_SOA];
+	struct integrand funcs[INTEGRATE_KERNEL_SOA];
+	for (int i = 0; i < INTEGRATE_KERNEL_SOA; i++) {
+		integrand_init(&funcs[i], f);
+		for (int j = 0; j < INTEGRAND_MAX_PARAMS; j++) {
+			funcs[i].params[j] *= 1 + i / 8.;
+			params[j][i] = funcs[i].params[j];
+		}
+	}
+
+	double sums[INTEGRATE_KERNEL_SOA];
+	k->soa_funcs[f](params, base, step, start_step, n_steps, sums);
+
+	double max_err = 0;
+	for (int i = 0; i < INTEGRATE_KERNEL_SOA; i++) {
+		double ref = kernels_scalar[f](&funcs[i], base, step,
+					       start_step, n_steps);
+		double err = fabs(sums[i] - ref);
+		if (ref != 0)
+			err /= fabs(ref);
+		if (err > max_err)
+			max_err = err;
+	}
+	return max_err;
+}
+
+int integrate_kernels_selfcheck(FILE *stream)
+{
+	/* Tails, offsets and sizes not multiple of KERNEL_LANES */
+	static const struct {
+		double base;
+		double step;
+		size_t start_step;
+		size_t n_steps;
+	} cases[] = {
+		{ 0., 1e-3, 0, 0 },	     { 0., 1e-3, 0, 1 },
+		{ 0., 1e-3, 3, 15 },	     { -2., 1e-3, 7, 17 },
+		{ 0., 2e-5, 0, 1000003 },    { 10., 1e-2, 123457, 99991 },
+		{ 0., 1. / 50000, 0, 5000000 },
+	};
+	const double rel_tol = 0;
+	int n_failed = 0;
+
+	for (const struct integrate_kernel *k = integrate_kernels; k->name;
+	     k++) {
+		if (!k->supported()) {
+			fprintf(stream, "kernel %-8s: unsupported\n", k->name);
+			continue;
+		}
+
+		double max_err = 0;
+		for (int f = 0; f < INTEGRAND_COUNT; f++) {
+			struct integrand func;
+			integrand_init(&func, f);
+			for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]);
+			     i++) {
+				double ref = kernels_scalar[f](
+					&func, cases[i].base, cases[i].step,
+					cases[i].start_step, cases[i].n_steps);
+				double res = k->funcs[f](
+					&func, cases[i].base, cases[i].step,
+					cases[i].start_step, cases[i].n_steps);
+				double err = fabs(res - ref);
+				if (ref != 0)
+					err /= fabs(ref);
+				if (err > max_err)
+					max_err = err;
+
+				err = kernel_soa_err(k, f, cases[i].base,
+						     cases[i].step,
+						     cases[i].start_step,
+						     cases[i].n_steps);
+				if (err > max_err)
+					max_err = err;
+			}
+		}
+
+		int ok = max_err <= rel_tol;
+		fprintf(stream, "kernel %-8s: %s (max rel err %.3g)\n", k->name,
+			ok ? "ok" : "FAILED", max_err);
+		if (!ok)
+			n_failed++;
+	}
+
+	return n_failed ? -1 : 0;
+}
@@ -0,0 +1,64 @@
+#ifndef INTEGRATE_KERNELS_H_
+#define INTEGRATE_KERNELS_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+struct integrand;
+
+/* Sum of f(base + i * step), i in [start_step, +n_steps), f specialized */
+typedef double (*integrate_kernel_t)(const struct integrand *func,
+				     double base, double step,
+				     size_t start_step, size_t n_steps);
+
+/* Funcs sharing one grid, structure of arrays */
+#define INTEGRATE_KERNEL_SOA 8
+
+/* sums[k] of func k, params[j][k] is its param j, one registered integrand */
+typedef void (*integrate_soa_kernel_t)(
+	const double (*params)[INTEGRATE_KERNEL_SOA], double base, double step,
+	size_t start_step, size_t n_steps, double *sums);
+
+/* One instruction set: kernels per registered integrand */
+struct integrate_kernel {
+	const char *name;
+	const integrate_kernel_t *funcs;
+	const integrate_soa_kernel_t *soa_funcs;
+	int (*supported)(void);
+};
+
+/* All compiled kernels, scalar first, terminated by {NULL} */
+extern const struct integrate_kernel integrate_kernels[];
+
+/* Best supported kernel (or $INTEGRATE_KERNEL if set), chosen once */
+const struct integrate_kernel *integrate_kernel_select(void);
+
+/* NULL if unknown or unsupported by cpu */
+const struct integrate_kernel *integrate_kernel_find(const char *name);
+
+/* Use kernel for later runs (benchmarks), -1 if unsupported */
+int integrate_kernel_force(const struct integrate_kernel *kernel);
+
+/* Kernel of selected instruction set for func, bytecode one for expr */
+integrate_kernel_t integrate_kernel_get(const struct integrand *func);
+
+struct integrate_rule;
+
+/* Integral over panels [start_step, +n_steps) of width step by rule */
+double integrate_rule_apply(const struct integrate_rule *rule,
+			    integrate_kernel_t kernel,
+			    const struct integrand *func,
+			    double base, double step, size_t start_step,
+			    size_t n_steps);
+
+/* Same for INTEGRATE_KERNEL_SOA funcs at once, res[k] of func k */
+void integrate_rule_apply_soa(const struct integrate_rule *rule,
+			      integrate_soa_kernel_t kernel,
+			      const double (*params)[INTEGRATE_KERNEL_SOA],
+			      double base, double step, size_t start_step,
+			      size_t n_steps, double *res);
+
+/* Compare every supported kernel with scalar one for all integrands */
+int integrate_kernels_selfcheck(FILE *stream);
+
+#endif /* INTEGRATE_KERNELS_H_ */
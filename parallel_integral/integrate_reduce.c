@@ -0,0 +1,94 @@
+#include "integrate.h"
+
+#include <float.h>
+#include <math.h>
+
+size_t integrate_reduce_first(size_t start_step)
+{
+	return start_step / INTEGRATE_REDUCE_CHUNK;
+}
+
+size_t integrate_reduce_n_chunks(size_t start_step, size_t n_steps)
+{
+	if (n_steps == 0)
+		return 0;
+	return integrate_reduce_first(start_step + n_steps - 1) -
+	       integrate_reduce_first(start_step) + 1;
+}
+
+/*
+ * Left subtree takes the largest power of two below n, so subtrees
+ * cover aligned ranges. Each node keeps the rounding errors of its
+ * additions (TwoSum) in comp, added once at the root. An infinite sum
+ * has no rounding error: TwoSum would turn it into inf - inf.
+ */
+static void reduce_tree(const double *partials, size_t n, double *sum,
+			double *comp)
+{
+	if (n == 1) {
+		*sum = partials[0];
+		*comp = 0;
+		return;
+	}
+
+	size_t half = 1;
+	while (half * 2 < n)
+		half *= 2;
+
+	double a, a_comp, b, b_comp;
+	reduce_tree(partials, half, &a, &a_comp);
+	reduce_tree(partials + half, n - half, &b, &b_comp);
+
+	double s = a + b;
+	double err = 0;
+	if (isfinite(s)) {
+		double b_virt = s - a;
+		err = (a - (s - b_virt)) + (b - b_virt);
+	}
+
+	*sum = s;
+	*comp = (a_comp + b_comp) + err;
+}
+
+long double integrate_reduce(const double *partials, size_t n)
+{
+	if (n == 0)
+		return 0;
+
+	double sum, comp;
+	reduce_tree(partials, n, &sum, &comp);
+	if (!isfinite(sum))
+		return sum;
+	return (long double)sum + comp;
+}
+
+int integrate_reduce_selfcheck(FILE *stream)
+{
+	/* Infinite partials at any depth of the tree, and overflow */
+	static const struct {
+		double partials[5];
+		size_t n;
+		double sum;
+	} cases[] = {
+		{ { INFINITY }, 1, INFINITY },
+		{ { 1., INFINITY, 2. }, 3, INFINITY },
+		{ { 1., 2., 3., 4., -INFINITY }, 5, -INFINITY },
+		{ { DBL_MAX, DBL_MAX, 1. }, 3, INFINITY },
+		{ { 1e308, -1e308, 1. }, 3, 1. },
+	};
+	int n_failed = 0;
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		long double sum = integrate_reduce(cases[i].partials,
+						   cases[i].n);
+		if (sum != cases[i].sum) {
+			fprintf(stream, "reduce case %zu: %Lg, expected %g\n",
+				i, sum, cases[i].sum);
+			n_failed++;
+		}
+	}
+
+	fprintf(stream, "reduce non-finite partials: %s\n",
+		n_failed ? "FAILED" : "ok");
+	return n_failed ? -1 : 0;
+}
@@ -1,21 +1,57 @@
 #include "integrate.h"
+#include "integrate_kernels.h"
 #include <stdio.h>
 #include <errno.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <float.h>
+#include <string.h>
+#include <unistd.h>
 
-int process_args(int argc, char *argv[], int *n_threads)
+/*
+ * argv: [-p placement] [-w weights] [job options] n_threads, 0: cpu budget
+ * -e epsrel switches to adaptive quadrature, -r selects fixed-grid panels
+ */
+int process_args(int argc, char *argv[], int *n_threads, int *placement,
+		 int *weights, struct integrate_job *job)
 {
-	if (argc != 2) {
-		fprintf(stderr, "Error: only 1 arg required\n");
+	integrate_job_init(job);
+	*placement = CPU_PLACE_SMT_LAST;
+	*weights = CPU_WEIGHT_CAPACITY;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:w:" INTEGRATE_JOB_OPTS)) != -1) {
+		if (opt == 'p') {
+			*placement = cpu_place_parse(optarg);
+			if (*placement < 0)
+				return -1;
+			continue;
+		}
+		if (opt == 'w') {
+			*weights = cpu_weight_parse(optarg);
+			if (*weights < 0)
+				return -1;
+			continue;
+		}
+		if (integrate_job_parse_opt(job, opt, optarg))
+			return -1;
+	}
+	if (integrate_job_check(job))
+		return -1;
+
+	if (optind != argc - 1) {
+		fprintf(stderr, "Error: [-p linear|core|smt|numa|llc] "
+				"[-w equal|capacity|freq|calibrate] "
+				"[-f func[:params]] [-r rule] "
+				"[-n n_steps] [-a from] [-b to] [-e epsrel] "
+				"[-s param:from:to:count] n_threads\n");
 		return -1;
 	}
 
 	char *endptr;
 	errno = 0;
-	long tmp = strtol(argv[1], &endptr, 10);
-	if (errno || *endptr != '\0' || tmp < 1 || tmp > INT_MAX) {
+	long tmp = strtol(argv[optind], &endptr, 10);
+	if (errno || *endptr != '\0' || tmp < 0 || tmp > INT_MAX) {
 		fprintf(stderr, "Error: wrong number of threads\n");
 		return -1;
 	}
@@ -24,38 +60,139 @@ int process_args(int argc, char *argv[], int *n_threads)
 	return 0;
 }
 
+/* Parameter sweep as one batch */
+static int integrate_sweep(struct integrate_job *job, int n_threads,
+			   cpu_set_t *cpuset)
+{
+	struct integrate_batch_job *batch = integrate_job_sweep(job);
+	if (!batch)
+		exit(EXIT_FAILURE);
+
+	long double *results = malloc(sizeof(*results) * job->sweep_count);
+	if (!results) {
+		perror("Error: malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	struct integrate_pool *pool = integrate_pool_create(n_threads, cpuset);
+	if (!pool)
+		exit(EXIT_FAILURE);
+	if (integrate_pool_batch(pool, batch, job->sweep_count, results) < 0) {
+		fprintf(stderr, "Error: integrate_pool_batch\n");
+		exit(EXIT_FAILURE);
+	}
+	integrate_pool_destroy(pool);
+
+	for (int i = 0; i < job->sweep_count; i++)
+		printf("p%d = %-12.8g result: %.*Lg\n", job->sweep_param,
+		       batch[i].func.params[job->sweep_param], LDBL_DIG,
+		       results[i]);
+
+	free(results);
+	free(batch);
+	integrand_fini(&job->func);
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
-	int n_threads;
-	if (process_args(argc, argv, &n_threads)) {
+	if (argc == 2 && !strcmp(argv[1], "--selfcheck")) {
+		if (integrate_kernels_selfcheck(stdout) |
+		    expr_selfcheck(stdout) |
+		    integrate_reduce_selfcheck(stdout) |
+		    cpu_topology_selfcheck(stdout, CPU_TOPOLOGY_FIXTURE))
+			exit(EXIT_FAILURE);
+		return 0;
+	}
+
+	int n_threads, placement, weights;
+	struct integrate_job job;
+	if (process_args(argc, argv, &n_threads, &placement, &weights, &job)) {
 		fprintf(stderr, "Error: wrong argv\n");
 		exit(EXIT_FAILURE);
 	}
 
+	const char *trace_path = trace_init();
+
 	struct cpu_topology topo;
-	cpu_set_t cpuset;
+	struct cpu_budget budget;
 	if (get_cpu_topology(&topo)) {
 		fprintf(stderr, "Error: get_cpu_topology\n");
 		exit(EXIT_FAILURE);
 	}
-	get_full_cpuset(&topo, &cpuset);
+	if (get_cpu_budget(&topo, &budget)) {
+		fprintf(stderr, "Error: get_cpu_budget: affinity and cgroup "
+				"cpu limits\n");
+		exit(EXIT_FAILURE);
+	}
+	cpu_set_t cpuset = budget.cpuset;
+	integrate_set_placement(&topo, placement);
+	if (weights != CPU_WEIGHT_CALIBRATE)
+		cpu_topology_set_weights(&topo, weights);
+	else if (integrate_calibrate_weights(&topo, &cpuset))
+		exit(EXIT_FAILURE);
 	DUMP_LOG_DO(dump_cpu_topology(stderr, &topo));
 	DUMP_LOG_DO(dump_cpu_set(stderr, &cpuset));
+	DUMP_LOG_DO(dump_cpu_budget(stderr, &budget));
 
-	long double from = INTEGRATE_FROM;
-	long double to = INTEGRATE_TO;
-	long double step = INTEGRATE_STEP;
+	if (n_threads == 0)
+		n_threads = budget.n_cpus;
+	if (n_threads > budget.n_cpus)
+		fprintf(stderr, "Warning: %d threads oversubscribe the budget "
+				"of %d cpus\n", n_threads, budget.n_cpus);
+	DUMP_LOG("placement: %s\n", cpu_place_name(placement));
+	DUMP_LOG("kernel: %s\n", integrate_kernel_select()->name);
+
+	if (job.sweep_count) {
+		int ret = integrate_sweep(&job, n_threads, &cpuset);
+		free_cpu_topology(&topo);
+		if (trace_path && trace_dump(trace_path, "multicore") < 0)
+			exit(EXIT_FAILURE);
+		return ret;
+	}
+
+	long double step = integrate_job_step(&job);
 	long double result;
-	size_t n_steps = (to - from) / step;
 
-	if (integrate_multicore_scalable(n_threads, &cpuset, n_steps, from,
-					 step, &result) == -1) {
+	if (job.epsrel != 0) {
+		struct integrate_pool *pool =
+			integrate_pool_create(n_threads, &cpuset);
+		if (!pool)
+			exit(EXIT_FAILURE);
+
+		long double abserr;
+		int ret = integrate_pool_adaptive(pool, &job.func, job.from,
+						  job.to, 0, job.epsrel,
+						  &result, &abserr);
+		integrate_pool_destroy(pool);
+		if (ret < 0) {
+			fprintf(stderr, "Error: integrate_pool_adaptive\n");
+			exit(EXIT_FAILURE);
+		}
+		if (ret == 1)
+			fprintf(stderr, "Warning: tolerance not reached\n");
+		printf("result: %.*Lg\n", LDBL_DIG, result);
+		printf("abserr: %.3Lg\n", abserr);
+		integrand_fini(&job.func);
+		free_cpu_topology(&topo);
+		if (trace_path && trace_dump(trace_path, "multicore") < 0)
+			exit(EXIT_FAILURE);
+		return 0;
+	}
+
+	if (integrate_multicore(n_threads, &cpuset, job.n_steps, job.from,
+				step, &job.func, &job.rule, &result) == -1) {
 		perror("Error: integrate");
 		exit(EXIT_FAILURE);
 	}
 
 	printf("result: %.*Lg\n", LDBL_DIG, result);
-	printf("+1/to : %.*Lg\n", LDBL_DIG, result + 1 / to);
+	if (job.func.id == INTEGRAND_DEFAULT)
+		printf("+1/to : %.*Lg\n", LDBL_DIG, result + 1 / job.to);
 
+	integrand_fini(&job.func);
+	free_cpu_topology(&topo);
+	if (trace_path && trace_dump(trace_path, "multicore") < 0)
+		exit(EXIT_FAILURE);
 	return 0;
 }
@@ -0,0 +1,18 @@
+#include "integrate.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* argv: [socket path], default INTEGRATE_COORDINATOR_PATH */
+int main(int argc, char *argv[])
+{
+	if (argc > 2) {
+		fprintf(stderr, "Error: [socket path]\n");
+		exit(EXIT_FAILURE);
+	}
+	const char *path = argc == 2 ? argv[1] : INTEGRATE_COORDINATOR_PATH;
+
+	/* Serves until an error */
+	integrate_network_coordinator(path);
+	fprintf(stderr, "Error: coordinator failed\n");
+	exit(EXIT_FAILURE);
+}
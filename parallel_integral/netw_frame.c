@@ -0,0 +1,276 @@
+#include "netw_frame.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int netw_frame_parse(const void *hdr, int type, struct netw_frame *frame)
+{
+	struct netw_reader rd;
+	netw_reader_init(&rd, hdr, NETW_FRAME_HDR);
+
+	uint16_t magic = netw_get_u16(&rd);
+	int version = netw_get_u8(&rd);
+	frame->type = netw_get_u8(&rd);
+	frame->flags = netw_get_u32(&rd);
+	frame->count = netw_get_u32(&rd);
+	frame->len = netw_get_u32(&rd);
+
+	if (magic != NETW_MAGIC) {
+		fprintf(stderr, "Error: wrong frame magic %#x\n", magic);
+		return -1;
+	}
+	if (version != NETW_VERSION) {
+		fprintf(stderr, "Error: protocol version %d, expected %d\n",
+			version, NETW_VERSION);
+		return -1;
+	}
+	if (type ? frame->type != type :
+		   frame->type < NETW_FRAME_HELLO ||
+			   frame->type > NETW_FRAME_CANCEL) {
+		fprintf(stderr, "Error: frame type %d, expected %d\n",
+			frame->type, type);
+		return -1;
+	}
+	if (frame->len > NETW_FRAME_MAX) {
+		fprintf(stderr, "Error: frame of %u bytes\n", frame->len);
+		return -1;
+	}
+
+	return 0;
+}
+
+void *netw_put_space(struct netw_buf *buf, size_t len)
+{
+	if (buf->err)
+		return NULL;
+
+	if (buf->len + len > buf->size) {
+		size_t size = buf->size ? buf->size : 256;
+		while (size < buf->len + len)
+			size *= 2;
+
+		char *data = realloc(buf->data, size);
+		if (!data) {
+			perror("Error: realloc");
+			buf->err = 1;
+			return NULL;
+		}
+		buf->data = data;
+		buf->size = size;
+	}
+
+	unsigned char *dst = (unsigned char *)buf->data + buf->len;
+	buf->len += len;
+	return dst;
+}
+
+static void netw_store(unsigned char *dst, uint64_t val, int n_bytes)
+{
+	for (int i = 0; i < n_bytes; i++)
+		dst[i] = val >> (8 * i);
+}
+
+static void netw_put(struct netw_buf *buf, uint64_t val, int n_bytes)
+{
+	unsigned char *dst = netw_put_space(buf, n_bytes);
+	if (dst)
+		netw_store(dst, val, n_bytes);
+}
+
+void netw_put_u8(struct netw_buf *buf, uint8_t val)
+{
+	netw_put(buf, val, 1);
+}
+
+void netw_put_u16(struct netw_buf *buf, uint16_t val)
+{
+	netw_put(buf, val, 2);
+}
+
+void netw_put_u32(struct netw_buf *buf, uint32_t val)
+{
+	netw_put(buf, val, 4);
+}
+
+void netw_put_u64(struct netw_buf *buf, uint64_t val)
+{
+	netw_put(buf, val, 8);
+}
+
+void netw_put_f64(struct netw_buf *buf, double val)
+{
+	uint64_t bits;
+	memcpy(&bits, &val, sizeof(bits));
+	netw_put(buf, bits, 8);
+}
+
+/* hi + lo: 106 bits of mantissa, x87 has 64 */
+void netw_put_ldbl(struct netw_buf *buf, long double val)
+{
+	double hi = val;
+	double lo = isfinite(hi) ? (double)(val - hi) : 0.;
+	netw_put_f64(buf, hi);
+	netw_put_f64(buf, lo);
+}
+
+void netw_put_bytes(struct netw_buf *buf, const void *src, size_t len)
+{
+	unsigned char *dst = netw_put_space(buf, len);
+	if (dst && len)
+		memcpy(dst, src, len);
+}
+
+size_t netw_frame_begin(struct netw_buf *buf, int type, uint32_t flags)
+{
+	size_t start = buf->len;
+
+	netw_put_u16(buf, NETW_MAGIC);
+	netw_put_u8(buf, NETW_VERSION);
+	netw_put_u8(buf, type);
+	netw_put_u32(buf, flags);
+	netw_put_u32(buf, 0); /* count */
+	netw_put_u32(buf, 0); /* len */
+
+	return start;
+}
+
+int netw_frame_end(struct netw_buf *buf, size_t start, uint32_t count)
+{
+	if (buf->err)
+		return -1;
+
+	size_t len = buf->len - start - NETW_FRAME_HDR;
+	if (len > NETW_FRAME_MAX) {
+		fprintf(stderr, "Error: frame of %zu bytes\n", len);
+		return -1;
+	}
+
+	unsigned char *hdr = (unsigned char *)buf->data + start;
+	netw_store(hdr + 8, count, 4);
+	netw_store(hdr + 12, len, 4);
+	return 0;
+}
+
+size_t netw_record_begin(struct netw_buf *buf)
+{
+	size_t start = buf->len;
+	netw_put_u32(buf, 0);
+	return start;
+}
+
+void netw_record_end(struct netw_buf *buf, size_t start)
+{
+	if (buf->err)
+		return;
+
+	unsigned char *rec = (unsigned char *)buf->data + start;
+	netw_store(rec, buf->len - start - 4, 4);
+}
+
+void netw_reader_init(struct netw_reader *rd, const void *data, size_t len)
+{
+	rd->pos = data;
+	rd->end = rd->pos + len;
+	rd->err = 0;
+}
+
+/* Next len bytes, NULL past the end */
+static const unsigned char *netw_reader_take(struct netw_reader *rd,
+					     size_t len)
+{
+	if ((size_t)(rd->end - rd->pos) < len) {
+		rd->pos = rd->end;
+		rd->err = 1;
+		return NULL;
+	}
+
+	const unsigned char *src = rd->pos;
+	rd->pos += len;
+	return src;
+}
+
+static uint64_t netw_get(struct netw_reader *rd, int n_bytes)
+{
+	const unsigned char *src = netw_reader_take(rd, n_bytes);
+	if (!src)
+		return 0;
+
+	uint64_t val = 0;
+	for (int i = 0; i < n_bytes; i++)
+		val |= (uint64_t)src[i] << (8 * i);
+	return val;
+}
+
+uint8_t netw_get_u8(struct netw_reader *rd)
+{
+	return netw_get(rd, 1);
+}
+
+uint16_t netw_get_u16(struct netw_reader *rd)
+{
+	return netw_get(rd, 2);
+}
+
+uint32_t netw_get_u32(struct netw_reader *rd)
+{
+	return netw_get(rd, 4);
+}
+
+uint64_t netw_get_u64(struct netw_reader *rd)
+{
+	return netw_get(rd, 8);
+}
+
+double netw_get_f64(struct netw_reader *rd)
+{
+	uint64_t bits = netw_get(rd, 8);
+	double val;
+	memcpy(&val, &bits, sizeof(val));
+	return val;
+}
+
+long double netw_get_ldbl(struct netw_reader *rd)
+{
+	double hi = netw_get_f64(rd);
+	double lo = netw_get_f64(rd);
+	return (long double)hi + lo;
+}
+
+void netw_get_bytes(struct netw_reader *rd, void *dst, size_t len)
+{
+	const unsigned char *src = netw_reader_take(rd, len);
+	if (src && len)
+		memcpy(dst, src, len);
+	else if (len)
+		memset(dst, 0, len);
+}
+
+void netw_get_sized(struct netw_reader *rd, size_t size,
+		    struct netw_reader *rec)
+{
+	const unsigned char *src = netw_reader_take(rd, size);
+	netw_reader_init(rec, src, src ? size : 0);
+	rec->err = rd->err;
+}
+
+void netw_get_record(struct netw_reader *rd, struct netw_reader *rec)
+{
+	netw_get_sized(rd, netw_get_u32(rd), rec);
+}
+
+void netw_f64_le(double *vals, size_t n)
+{
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+	for (size_t i = 0; i < n; i++) {
+		uint64_t bits;
+		memcpy(&bits, &vals[i], sizeof(bits));
+		bits = __builtin_bswap64(bits);
+		memcpy(&vals[i], &bits, sizeof(bits));
+	}
+#else
+	(void)vals;
+	(void)n;
+#endif
+}
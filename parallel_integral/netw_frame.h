@@ -0,0 +1,96 @@
+#ifndef NETW_FRAME_H_
+#define NETW_FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Wire format of the starter, workers and coordinator clients. Every
+ * message is a frame: header, then len bytes of payload holding count
+ * records. Integers are little-endian, double is IEEE-754 binary64,
+ * long double a pair of doubles (hi, lo), exact for x87 and binary64:
+ * builds of any ABI talk to each other.
+ *
+ * Records grow by appending fields: readers skip the rest of a record
+ * they don't know, and default fields an older writer did not send.
+ * NETW_VERSION changes only for layouts old readers can't skip.
+ */
+#define NETW_MAGIC 0x494e /* "NI" */
+#define NETW_VERSION 1
+#define NETW_FRAME_HDR 16 /* u16 magic, u8 version, u8 type, u32 flags,
+			     u32 count, u32 len */
+#define NETW_FRAME_MAX (1U << 28) /* payload bytes */
+
+enum netw_frame_type {
+	NETW_FRAME_HELLO = 1, /* worker: speed */
+	NETW_FRAME_REQUEST, /* starter: tasks */
+	NETW_FRAME_PARTIALS, /* worker: chunk partials of all tasks */
+	NETW_FRAME_TRACE, /* worker: clock and trace events */
+	NETW_FRAME_SUBMIT, /* coordinator client: batch */
+	NETW_FRAME_RESULT, /* coordinator: its results */
+	NETW_FRAME_CANCEL, /* starter: stop a request */
+};
+
+struct netw_frame {
+	int type;
+	uint32_t flags;
+	uint32_t count;
+	uint32_t len;
+};
+
+/* Decode hdr, it must be a frame of type (0: any) this build can read */
+int netw_frame_parse(const void *hdr, int type, struct netw_frame *frame);
+
+/* Growing output, a failed put is kept in err and later ones dropped */
+struct netw_buf {
+	char *data;
+	size_t len;
+	size_t size;
+	int err;
+};
+
+void netw_put_u8(struct netw_buf *buf, uint8_t val);
+void netw_put_u16(struct netw_buf *buf, uint16_t val);
+void netw_put_u32(struct netw_buf *buf, uint32_t val);
+void netw_put_u64(struct netw_buf *buf, uint64_t val);
+void netw_put_f64(struct netw_buf *buf, double val);
+void netw_put_ldbl(struct netw_buf *buf, long double val);
+void netw_put_bytes(struct netw_buf *buf, const void *src, size_t len);
+/* Room for len bytes the caller fills in, NULL if the buffer failed */
+void *netw_put_space(struct netw_buf *buf, size_t len);
+
+/* Frame header, returns its offset for netw_frame_end */
+size_t netw_frame_begin(struct netw_buf *buf, int type, uint32_t flags);
+/* Count and len of the frame at start, -1 if a put failed */
+int netw_frame_end(struct netw_buf *buf, size_t start, uint32_t count);
+
+/* Record with its size (u32) in front */
+size_t netw_record_begin(struct netw_buf *buf);
+void netw_record_end(struct netw_buf *buf, size_t start);
+
+/* Payload reader, reading past the end sets err and gives zeros */
+struct netw_reader {
+	const unsigned char *pos;
+	const unsigned char *end;
+	int err;
+};
+
+void netw_reader_init(struct netw_reader *rd, const void *data, size_t len);
+uint8_t netw_get_u8(struct netw_reader *rd);
+uint16_t netw_get_u16(struct netw_reader *rd);
+uint32_t netw_get_u32(struct netw_reader *rd);
+uint64_t netw_get_u64(struct netw_reader *rd);
+double netw_get_f64(struct netw_reader *rd);
+long double netw_get_ldbl(struct netw_reader *rd);
+void netw_get_bytes(struct netw_reader *rd, void *dst, size_t len);
+
+/* Reader of the next record (size-prefixed), rd is past all of it */
+void netw_get_record(struct netw_reader *rd, struct netw_reader *rec);
+/* Reader of the next size bytes, for fixed size records */
+void netw_get_sized(struct netw_reader *rd, size_t size,
+		    struct netw_reader *rec);
+
+/* Host doubles from or to binary64 little-endian, in place */
+void netw_f64_le(double *vals, size_t n);
+
+#endif /* NETW_FRAME_H_ */
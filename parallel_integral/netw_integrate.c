@@ -1,81 +1,235 @@
 #include "integrate.h"
-#include "signal_except.h"
+#include "netw_frame.h"
 
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 #include <signal.h>
+#include <pthread.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <sys/socket.h>
-
-/* Network messages format */
-struct task_netw {
-	long double base;
-	long double step_wdth;
-	size_t start_step;
-	size_t n_steps;
-};
-
+#include <sys/un.h>
+
+/*
+ * Network messages are frames of netw_frame.h.
+ *
+ * Worker connects and sends HELLO, a record of its speed (u32), then
+ * REQUEST frames follow until one without NETW_REQUEST_MORE; they may
+ * come before the previous reply is sent. A request holds task records
+ * (task_put), each request is answered by PARTIALS: chunk partials
+ * (f64) of every task in the same order, integrate_reduce_n_chunks of
+ * each, reduced by the starter. TRACE follows the last one if
+ * NETW_REQUEST_TRACE: worker clock at request read and reply write
+ * (u64 each), event size (u32), then count trace events. CANCEL, a
+ * record of the request number in the session (u32, from 0), stops
+ * that request between chunks: its PARTIALS comes empty, flagged
+ * NETW_PARTIALS_CANCELLED, unless it was done already.
+ *
+ * Coordinator clients (unix socket) send SUBMIT: options record
+ * (priority, tenant; i32 each), then task records. RESULT has a status
+ * record (status i32, queued_ns, service_ns u64) and, if status is 0,
+ * the long double results. More batches may follow on the connection,
+ * batches of all clients run at once.
+ */
+
+/* UDP broadcast */
 typedef int netw_msg_t;
 
-/* Current socket watched by sigio_handler */
-int netw_sigio_handler_socket = -1;
-
-void netw_sigio_handler(int sig)
+/* Trace the session, its spans follow the last reply */
+#define NETW_REQUEST_TRACE 1
+/* Another request follows on this connection */
+#define NETW_REQUEST_MORE 2
+
+/* Request was cancelled, no partials */
+#define NETW_PARTIALS_CANCELLED 1
+
+/* Trace event on the wire: ts, dur (u64), arg (i32), id, tid (u16) */
+#define NETW_TRACE_EVENT_SIZE 24
+
+/*
+ * Task record: start_step, n_steps (u64), base, step (long double),
+ * rule type, n_points (u32), integrand by registry name (ids may differ
+ * between builds; u8 length, bytes), params (u8 count, f64 each),
+ * "expr" bytecode (u8 n_ops, n_consts; ops, args, f64 consts).
+ */
+static void task_put(struct netw_buf *buf,
+		     const struct integrate_batch_job *job)
 {
-	DUMP_LOG("Signal caught: %d\n", sig);
-
-	if (netw_sigio_handler_socket < 0)
-		return;
+	size_t rec = netw_record_begin(buf);
+
+	netw_put_u64(buf, job->start_step);
+	netw_put_u64(buf, job->n_steps);
+	netw_put_ldbl(buf, job->base);
+	netw_put_ldbl(buf, job->step);
+	netw_put_u32(buf, job->rule.type);
+	netw_put_u32(buf, job->rule.n_points);
+
+	const char *name = integrand_name(&job->func);
+	size_t name_len = strlen(name);
+	netw_put_u8(buf, name_len);
+	netw_put_bytes(buf, name, name_len);
+
+	netw_put_u8(buf, INTEGRAND_MAX_PARAMS);
+	for (int i = 0; i < INTEGRAND_MAX_PARAMS; i++)
+		netw_put_f64(buf, job->func.params[i]);
+
+	const struct expr_code *code =
+		job->func.id == INTEGRAND_EXPR ? job->func.code : NULL;
+	netw_put_u8(buf, code ? code->n_ops : 0);
+	netw_put_u8(buf, code ? code->n_consts : 0);
+	if (code) {
+		netw_put_bytes(buf, code->op, code->n_ops);
+		netw_put_bytes(buf, code->arg, code->n_ops);
+		for (int i = 0; i < code->n_consts; i++)
+			netw_put_f64(buf, code->consts[i]);
+	}
 
-	/* Disable async */
-	fcntl(netw_sigio_handler_socket, F_SETFL, 0);
-	longjmp(sig_exc_buf, sig);
+	netw_record_end(buf, rec);
 }
 
-/* Read and write same size blocks from TCP socket */
-ssize_t netw_tcp_read(int sock, void *buf, size_t buf_s)
+/* Job refers to code, it must outlive the job */
+static int task_get(struct netw_reader *rd, struct integrate_batch_job *job,
+		    struct expr_code *code)
 {
-	ssize_t ret = read(sock, buf, buf_s);
-	if (ret < 0) {
-		perror("Error: read");
+	struct netw_reader rec;
+	netw_get_record(rd, &rec);
+
+	job->start_step = netw_get_u64(&rec);
+	job->n_steps = netw_get_u64(&rec);
+	job->base = netw_get_ldbl(&rec);
+	job->step = netw_get_ldbl(&rec);
+	job->rule.type = netw_get_u32(&rec);
+	job->rule.n_points = netw_get_u32(&rec);
+
+	char name[INTEGRAND_NAME_MAX];
+	size_t name_len = netw_get_u8(&rec);
+	if (name_len >= sizeof(name)) {
+		fprintf(stderr, "Error: wrong integrand name length %zu\n",
+			name_len);
 		return -1;
 	}
-	if (ret == 0) {
-		fprintf(stderr, "Error: connection lost\n");
+	netw_get_bytes(&rec, name, name_len);
+	name[name_len] = '\0';
+
+	/* Registries of other builds may have more or fewer params */
+	struct integrand *func = &job->func;
+	memset(func->params, 0, sizeof(func->params));
+	int n_params = netw_get_u8(&rec);
+	for (int i = 0; i < n_params; i++) {
+		double param = netw_get_f64(&rec);
+		if (i < INTEGRAND_MAX_PARAMS)
+			func->params[i] = param;
+	}
+
+	memset(code, 0, sizeof(*code));
+	code->n_ops = netw_get_u8(&rec);
+	code->n_consts = netw_get_u8(&rec);
+	if (code->n_ops > EXPR_MAX_OPS || code->n_consts > EXPR_MAX_CONSTS) {
+		fprintf(stderr, "Error: wrong expression size\n");
 		return -1;
 	}
-	if (ret != buf_s) {
-		fprintf(stderr, "Error: nonfull read\n");
+	netw_get_bytes(&rec, code->op, code->n_ops);
+	netw_get_bytes(&rec, code->arg, code->n_ops);
+	for (int i = 0; i < code->n_consts; i++)
+		code->consts[i] = netw_get_f64(&rec);
+
+	if (rec.err) {
+		fprintf(stderr, "Error: short task record\n");
 		return -1;
 	}
-	return ret;
+
+	if (integrate_rule_check(&job->rule) < 0) {
+		fprintf(stderr, "Error: wrong rule from starter\n");
+		return -1;
+	}
+
+	if (!strcmp(name, "expr")) {
+		func->id = INTEGRAND_EXPR;
+		func->code = code;
+	} else {
+		func->id = integrand_find(name);
+		func->code = NULL;
+	}
+	if (func->id < 0 || integrand_check(func) < 0) {
+		fprintf(stderr, "Error: wrong integrand %s\n", name);
+		return -1;
+	}
+	return 0;
+}
+
+/* Read and write whole blocks, short reads and writes are continued */
+ssize_t netw_tcp_read(int sock, void *buf, size_t buf_s)
+{
+	size_t done = 0;
+	while (done != buf_s) {
+		ssize_t ret = read(sock, (char *)buf + done, buf_s - done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			perror("Error: read");
+			return -1;
+		}
+		if (ret == 0) {
+			fprintf(stderr, "Error: connection lost\n");
+			return -1;
+		}
+		done += ret;
+	}
+	return done;
 }
 
 ssize_t netw_tcp_write(int sock, void *buf, size_t buf_s)
 {
-	ssize_t ret = write(sock, buf, buf_s);
-	if (ret < 0) {
-		perror("Error: write");
-		return -1;
+	size_t done = 0;
+	while (done != buf_s) {
+		ssize_t ret = write(sock, (char *)buf + done, buf_s - done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			perror("Error: write");
+			return -1;
+		}
+		if (ret == 0) {
+			fprintf(stderr, "Error: connection lost\n");
+			return -1;
+		}
+		done += ret;
 	}
-	if (ret == 0) {
-		fprintf(stderr, "Error: connection lost\n");
+	return done;
+}
+
+/* Whole frame of type, payload malloc'ed */
+static int netw_read_frame(int sock, int type, struct netw_frame *frame,
+			   char **payload)
+{
+	unsigned char hdr[NETW_FRAME_HDR];
+	if (netw_tcp_read(sock, hdr, sizeof(hdr)) < 0 ||
+	    netw_frame_parse(hdr, type, frame) < 0)
+		return -1;
+
+	*payload = malloc(frame->len ? frame->len : 1);
+	if (!*payload) {
+		perror("Error: malloc");
 		return -1;
 	}
-	if (ret != buf_s) {
-		fprintf(stderr, "Error: nonfull write\n");
+	if (netw_tcp_read(sock, *payload, frame->len) < 0) {
+		free(*payload);
+		*payload = NULL;
 		return -1;
 	}
-	return ret;
+	return 0;
 }
 
 int netw_tcp_set_keepalive(int sock)
@@ -192,8 +346,7 @@ int netw_tcp_connect(struct sockaddr_in *addr, struct timeval *timeout)
 		ret = select(tcp_sock + 1, NULL, &set, NULL, timeout);
 		if (ret == 0) {
 			fprintf(stderr, "Error: connect timed out\n");
-			close(tcp_sock);
-			return 1; // Note this
+			goto handle_err_1;
 		}
 		if (ret < 0) {
 			perror("Error: select");
@@ -226,11 +379,6 @@ int netw_tcp_connect(struct sockaddr_in *addr, struct timeval *timeout)
 		goto handle_err_1;
 	}
 
-	if (fcntl(tcp_sock, F_SETOWN, getpid()) < 0) {
-		perror("Error: fcntl");
-		goto handle_err_1;
-	}
-
 	return tcp_sock;
 
 handle_err_1:
@@ -313,65 +461,351 @@ handle_err_0:
 	return -1;
 }
 
-int netw_tcp_accept_connections(int tcp_sock, int *sockets, int max_sockets,
-				struct timeval *timeout)
+/********************** Network Worker *************************/
+
+/* HELLO: speed record */
+static int worker_send_hello(int sock, int calc_speed)
 {
-	fd_set set;
-	FD_ZERO(&set);
-	FD_SET(tcp_sock, &set);
+	struct netw_buf out = {};
+	size_t start = netw_frame_begin(&out, NETW_FRAME_HELLO, 0);
+	size_t rec = netw_record_begin(&out);
+	netw_put_u32(&out, calc_speed);
+	netw_record_end(&out, rec);
+
+	int ret = 0;
+	if (netw_frame_end(&out, start, 1) < 0 ||
+	    netw_tcp_write(sock, out.data, out.len) < 0)
+		ret = -1;
+	free(out.data);
+	return ret;
+}
 
-	int n_sockets = 0;
+/* Spans of this request since t_request for the starter timeline */
+static int worker_send_trace(int sock, uint64_t t_request, uint64_t t_recv,
+			     uint64_t t_send)
+{
+	struct trace_event *events;
+	size_t n_events = trace_collect(t_request, &events);
+	if (!events)
+		return -1;
 
-	for (; n_sockets < max_sockets; n_sockets++) {
-		/* Unportable, Linux-only */
-		int ret = select(tcp_sock + 1, &set, NULL, NULL, timeout);
-		if (ret == 0) {
-			DUMP_LOG("Accept timed out, %d connections accepted\n",
-				 n_sockets);
+	struct netw_buf out = {};
+	size_t start = netw_frame_begin(&out, NETW_FRAME_TRACE, 0);
+	netw_put_u64(&out, t_recv);
+	netw_put_u64(&out, t_send);
+	netw_put_u32(&out, NETW_TRACE_EVENT_SIZE);
+	for (size_t i = 0; i < n_events; i++) {
+		netw_put_u64(&out, events[i].ts);
+		netw_put_u64(&out, events[i].dur);
+		netw_put_u32(&out, events[i].arg);
+		netw_put_u16(&out, events[i].id);
+		netw_put_u16(&out, events[i].tid);
+	}
+	free(events);
+
+	int ret = 0;
+	if (netw_frame_end(&out, start, n_events) < 0 ||
+	    netw_tcp_write(sock, out.data, out.len) < 0)
+		ret = -1;
+	free(out.data);
+	return ret;
+}
+
+/* Requests read ahead of the one computed, the starter keeps 2 */
+#define WORKER_QUEUE 4
+
+struct worker_request {
+	struct netw_frame frame;
+	char *payload;
+	uint32_t seq; /* number in the session */
+	int cancelled;
+	uint64_t t_request; /* reading started */
+};
+
+/*
+ * Session with the starter. A reader thread takes frames as they come,
+ * so a CANCEL or a hangup reaches the batch being computed.
+ */
+struct worker_session {
+	int sock;
+	struct integrate_pool *pool;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct worker_request queue[WORKER_QUEUE];
+	int q_first;
+	int q_count;
+	uint32_t n_read;
+	uint32_t computing; /* seq of the batch, if busy */
+	int busy;
+	int closed; /* reader is gone: EOF or error */
+	int done; /* last request served */
+};
+
+/* CANCEL of request seq: stop its batch, or skip it if still queued */
+static void worker_cancel(struct worker_session *s, uint32_t seq)
+{
+	if (s->busy && s->computing == seq)
+		integrate_pool_cancel(s->pool, 1);
+	for (int i = 0; i < s->q_count; i++) {
+		struct worker_request *req =
+			&s->queue[(s->q_first + i) % WORKER_QUEUE];
+		if (req->seq == seq)
+			req->cancelled = 1;
+	}
+}
+
+static void *worker_reader(void *arg)
+{
+	struct worker_session *s = arg;
+
+	while (1) {
+		/* EOF ends the session, it is not an error here */
+		char next;
+		ssize_t ret = recv(s->sock, &next, 1, MSG_PEEK);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+
+		struct worker_request req = { .t_request = trace_now() };
+		if (netw_read_frame(s->sock, 0, &req.frame, &req.payload) < 0)
+			break;
+		if (req.frame.type != NETW_FRAME_REQUEST &&
+		    req.frame.type != NETW_FRAME_CANCEL) {
+			fprintf(stderr, "Error: frame type %d from starter\n",
+				req.frame.type);
+			free(req.payload);
 			break;
-		}
-		if (ret < 0) {
-			perror("Error: select");
-			goto handle_err;
 		}
 
-		ret = accept(tcp_sock, NULL, NULL);
-		if (ret == -1) {
-			perror("Error: accept");
-			goto handle_err;
+		pthread_mutex_lock(&s->lock);
+		if (req.frame.type == NETW_FRAME_CANCEL) {
+			struct netw_reader rd, rec;
+			netw_reader_init(&rd, req.payload, req.frame.len);
+			netw_get_record(&rd, &rec);
+			worker_cancel(s, netw_get_u32(&rec));
+			pthread_mutex_unlock(&s->lock);
+			free(req.payload);
+			continue;
 		}
-		sockets[n_sockets] = ret;
+		while (s->q_count == WORKER_QUEUE && !s->done)
+			pthread_cond_wait(&s->cond, &s->lock);
+		if (s->done) {
+			pthread_mutex_unlock(&s->lock);
+			free(req.payload);
+			break;
+		}
+		req.seq = s->n_read++;
+		s->queue[(s->q_first + s->q_count) % WORKER_QUEUE] = req;
+		s->q_count++;
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	/* Threads leave the batch at their next chunk */
+	pthread_mutex_lock(&s->lock);
+	s->closed = 1;
+	if (s->busy)
+		integrate_pool_cancel(s->pool, 1);
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+/* Next request, it is the one computing from now on; -1: hangup */
+static int worker_next(struct worker_session *s, struct worker_request *req)
+{
+	pthread_mutex_lock(&s->lock);
+	while (!s->q_count && !s->closed)
+		pthread_cond_wait(&s->cond, &s->lock);
+	if (!s->q_count) {
+		pthread_mutex_unlock(&s->lock);
+		fprintf(stderr, "Error: connection lost\n");
+		return -1;
+	}
+	*req = s->queue[s->q_first];
+	s->q_first = (s->q_first + 1) % WORKER_QUEUE;
+	s->q_count--;
+	s->busy = 1;
+	s->computing = req->seq;
+	integrate_pool_cancel(s->pool, req->cancelled || s->closed);
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	return 0;
+}
 
-		DUMP_LOG("Accepted connection №%d\n", n_sockets + 1);
-		DUMP_LOG("\t(%ld usec remaining)\n", timeout->tv_usec);
+/* One request of the session, *flags: its NETW_REQUEST_* */
+static int worker_serve_request(struct worker_session *s, uint64_t t_session,
+				int *flags)
+{
+	struct expr_code *codes = NULL;
+	struct integrate_batch_job *jobs = NULL;
+	struct netw_buf out = {};
+
+	/* Receive tasks */
+	struct worker_request req;
+	if (worker_next(s, &req) < 0) {
+		fprintf(stderr, "Error: read task from starter\n");
+		return -1;
+	}
+	struct netw_frame request = req.frame;
+	int n_tasks = request.count;
+	if (request.count > INTEGRATE_BATCH_MAX) {
+		fprintf(stderr, "Error: wrong number of tasks\n");
+		goto handle_err;
+	}
+	*flags = request.flags;
 
-		if (netw_tcp_set_keepalive(sockets[n_sockets]) < 0) {
-			fprintf(stderr, "Error: netw_socket_keepalive");
+	codes = malloc(sizeof(*codes) * (n_tasks ? n_tasks : 1));
+	jobs = malloc(sizeof(*jobs) * (n_tasks ? n_tasks : 1));
+	if (!codes || !jobs) {
+		perror("Error: malloc");
+		goto handle_err;
+	}
+	struct netw_reader rd;
+	netw_reader_init(&rd, req.payload, request.len);
+	for (int i = 0; i < n_tasks; i++) {
+		if (task_get(&rd, &jobs[i], &codes[i]) < 0)
 			goto handle_err;
-		}
+	}
+	uint64_t t_recv = trace_now();
+	if (request.flags & NETW_REQUEST_TRACE) {
+		trace_enable();
+		trace_record(TRACE_request_recv, req.t_request, n_tasks);
+	}
+
+	/* Partials are computed right into the reply */
+	size_t n_partials = 0;
+	for (int i = 0; i < n_tasks; i++)
+		n_partials += integrate_reduce_n_chunks(jobs[i].start_step,
+							jobs[i].n_steps);
+	size_t start = netw_frame_begin(&out, NETW_FRAME_PARTIALS, 0);
+	if (!netw_put_space(&out, sizeof(double) * n_partials) ||
+	    netw_frame_end(&out, start, n_partials) < 0) {
+		fprintf(stderr, "Error: reply of %zu partials\n", n_partials);
+		goto handle_err;
+	}
+	double *partials = (double *)(out.data + start + NETW_FRAME_HDR);
+
+	/* Process tasks as one batch, a CANCEL or hangup stops it */
+	DUMP_LOG("%d tasks\n", n_tasks);
+	uint64_t trace_start = trace_begin();
+	int ret = 0;
+	if (n_tasks && !req.cancelled)
+		ret = integrate_pool_batch_partials(s->pool, jobs, n_tasks,
+						    partials);
+	trace_end(TRACE_worker_compute, trace_start, n_tasks);
+
+	pthread_mutex_lock(&s->lock);
+	s->busy = 0;
+	int closed = s->closed;
+	pthread_mutex_unlock(&s->lock);
+	if (ret < 0) {
+		fprintf(stderr, "Error: integrate failed\n");
+		goto handle_err;
+	}
+	if ((ret > 0 || req.cancelled) && closed) {
+		fprintf(stderr, "Error: connection lost\n");
+		goto handle_err;
+	}
 
-		if (fcntl(sockets[n_sockets], F_SETOWN, getpid()) < 0) {
-			perror("Error: fcntl");
+	if (ret > 0 || req.cancelled) {
+		/* Still one reply per request, empty */
+		DUMP_LOG("request %u cancelled\n", req.seq);
+		out.len = 0;
+		start = netw_frame_begin(&out, NETW_FRAME_PARTIALS,
+					 NETW_PARTIALS_CANCELLED);
+		if (netw_frame_end(&out, start, 0) < 0)
 			goto handle_err;
-		}
+	} else {
+		netw_f64_le(partials, n_partials);
 	}
 
-	return n_sockets;
+	/* Send results */
+	DUMP_LOG("Results sending...\n");
 
-handle_err:
-	while (n_sockets--)
-		close(sockets[n_sockets]);
+	uint64_t t_send = trace_now();
+	if (netw_tcp_write(s->sock, out.data, out.len) < 0) {
+		fprintf(stderr, "Error: write result to starter\n");
+		goto handle_err;
+	}
+	trace_end(TRACE_result_send, t_send, 0);
+
+	/* Spans of the whole session follow its last reply */
+	if ((request.flags & NETW_REQUEST_TRACE) &&
+	    !(request.flags & NETW_REQUEST_MORE) &&
+	    worker_send_trace(s->sock, t_session, t_recv, t_send) < 0) {
+		fprintf(stderr, "Error: write trace to starter\n");
+		goto handle_err;
+	}
+
+	free(out.data);
+	free(jobs);
+	free(codes);
+	free(req.payload);
+	return 0;
 
+handle_err:
+	free(out.data);
+	free(jobs);
+	free(codes);
+	free(req.payload);
 	return -1;
 }
 
-/********************** Network Worker *************************/
+/* Requests until one without NETW_REQUEST_MORE, the pool is kept */
+static int worker_session_run(struct integrate_pool *pool, int tcp_sock,
+			      uint64_t t_session)
+{
+	struct worker_session s = {
+		.sock = tcp_sock,
+		.pool = pool,
+	};
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.cond, NULL);
+
+	int ret = -1;
+	pthread_t reader;
+	if (pthread_create(&reader, NULL, worker_reader, &s)) {
+		perror("Error: pthread_create");
+		goto handle_err;
+	}
+
+	int flags = NETW_REQUEST_MORE;
+	int n_requests = 0;
+	ret = 0;
+	while (flags & NETW_REQUEST_MORE) {
+		if (worker_serve_request(&s, t_session, &flags) < 0) {
+			ret = -1;
+			break;
+		}
+		n_requests++;
+	}
+	if (!ret)
+		DUMP_LOG("-------- %d requests done --------\n", n_requests);
+
+	/* The reader leaves at EOF */
+	pthread_mutex_lock(&s.lock);
+	s.done = 1;
+	pthread_cond_broadcast(&s.cond);
+	pthread_mutex_unlock(&s.lock);
+	shutdown(tcp_sock, SHUT_RD);
+	pthread_join(reader, NULL);
+	for (int i = 0; i < s.q_count; i++)
+		free(s.queue[(s.q_first + i) % WORKER_QUEUE].payload);
 
-/* Calc speed here is synonym for n_threads, but not in general */
+handle_err:
+	pthread_cond_destroy(&s.cond);
+	pthread_mutex_destroy(&s.lock);
+	return ret;
+}
+
+/* Calc speed: summary weight of used cpus, integrate_placement_capacity */
 int integrate_network_worker(int calc_speed, cpu_set_t *cpuset, int n_threads)
 {
-	fprintf(stderr, "-------- Starting worker (%d threads) --------\n",
-		calc_speed);
+	fprintf(stderr,
+		"-------- Starting worker (%d threads, speed %d) --------\n",
+		n_threads, calc_speed);
 
 	/* Ignore SIGPIPE */
 	struct sigaction act = {};
@@ -381,22 +815,20 @@ int integrate_network_worker(int calc_speed, cpu_set_t *cpuset, int n_threads)
 		goto handle_err_0;
 	}
 
-	/* Prepare SIGIO handler */
-	act.sa_handler = netw_sigio_handler;
-	if (sigaction(SIGIO, &act, NULL) < 0) {
-		perror("Error: sigaction");
+	/* Threads live across requests */
+	struct integrate_pool *pool = integrate_pool_create(n_threads, cpuset);
+	if (!pool) {
+		fprintf(stderr, "Error: integrate_pool_create failed\n");
 		goto handle_err_0;
 	}
 
 	/* Prepare UDP socket to receive broadcast */
 	int udp_sock = netw_udp_brcast_rec_socket(htons(INTEGRATE_UDP_PORT));
 	if (udp_sock < 0) {
-		goto handle_err_0;
+		goto handle_err_pool;
 	}
 
-	int tcp_sock;
-
-	/* Process requests */
+	/* Process sessions, a lost one does not end the worker */
 	while (1) {
 		/* Wait for broadcast */
 		struct sockaddr_in starter_addr;
@@ -411,278 +843,2374 @@ int integrate_network_worker(int calc_speed, cpu_set_t *cpuset, int n_threads)
 		timeout.tv_usec = INTEGRATE_NETW_TIMEOUT_USEC;
 		starter_addr.sin_port = htons(INTEGRATE_TCP_PORT);
 
-		tcp_sock = netw_tcp_connect(&starter_addr, &timeout);
-		if (tcp_sock < 0) {
-			goto handle_err_1;
-		}
+		int tcp_sock = netw_tcp_connect(&starter_addr, &timeout);
+		if (tcp_sock < 0)
+			continue;
 
-		/* Send relative calc speed value (here it's n_threads) */
-		DUMP_LOG("n_threads: %d, sending...\n", calc_speed);
+		/* Send relative calc speed value */
+		DUMP_LOG("calc_speed: %d, sending...\n", calc_speed);
 
-		if (netw_tcp_write(tcp_sock, &calc_speed, sizeof(int)) < 0) {
+		uint64_t t_session = trace_now();
+		if (worker_send_hello(tcp_sock, calc_speed) < 0)
 			fprintf(stderr, "Error: write n_threads to starter\n");
-			goto handle_err_2;
-		}
-
-		/* Receive task */
-		struct task_netw task;
-		if (netw_tcp_read(tcp_sock, &task, sizeof(task)) < 0) {
-			fprintf(stderr, "Error: read task from starter\n");
-			goto handle_err_2;
-		}
-
-		/* Prepare exception handler */
-		if (setjmp(sig_exc_buf)) {
-			fprintf(stderr, "Error: connection lost\n");
-			goto handle_err_2;
-		}
-
-		/* Enable async */
-		netw_sigio_handler_socket = tcp_sock;
-		if (fcntl(tcp_sock, F_SETFL, O_ASYNC) < 0) {
-			perror("Error: fcntl");
-			goto handle_err_2;
-		}
-
-		/* Process task */
-		DUMP_LOG("task:\n\tfrom = %Lg\n\tto = %Lg\n\tstep = %Lg\n",
-			 task.base + task.step_wdth * task.start_step,
-			 task.base + task.step_wdth *
-					     (task.start_step + task.n_steps),
-			 task.step_wdth);
-		long double result;
-
-		if (integrate_multicore_scalable(
-			    n_threads, cpuset, task.n_steps,
-			    task.base + task.step_wdth * task.start_step,
-			    task.step_wdth, &result) < 0) {
-			fprintf(stderr, "Error: integrate failed\n");
-			goto handle_err_2;
-		}
-
-		/* Disable async */
-		if (fcntl(tcp_sock, F_SETFL, 0) < 0) {
-			perror("Error: fcntl");
-			goto handle_err_2;
-		}
+		else if (worker_session_run(pool, tcp_sock, t_session) < 0)
+			fprintf(stderr, "Error: session lost\n");
 
-		/* Send result */
-		DUMP_LOG("Result: %Lg, sending...\n", result);
-
-		if (netw_tcp_write(tcp_sock, &result, sizeof(result)) < 0) {
-			fprintf(stderr, "Error: write result to starter\n");
-			goto handle_err_2;
-		}
-
-		DUMP_LOG("-------- Result sent, request done --------\n");
 		close(tcp_sock);
+		/* Tracing is asked for per session */
+		trace_disable();
+
+		/* Broadcasts that came meanwhile are stale, live ones repeat */
+		netw_msg_t stale;
+		while (recv(udp_sock, &stale, sizeof(stale), MSG_DONTWAIT) >= 0)
+			;
 	}
 
 	return 0;
 
-handle_err_2:
-	close(tcp_sock);
 handle_err_1:
 	close(udp_sock);
+handle_err_pool:
+	integrate_pool_destroy(pool);
 handle_err_0:
 	return -1;
 }
 
 /********************** Network Starter *************************/
 
-int starter_send_tasks(int *sockets, int *speeds, int n_sockets,
-		       struct task_netw *full_task)
+/* Part of the whole batch sent to one worker: slices of jobs */
+struct starter_slice {
+	int job; /* batch job index */
+	size_t start_step;
+	size_t n_steps;
+};
+
+struct starter_share {
+	int n_slices;
+	struct starter_slice *slices;
+};
+
+/*
+ * Slices from *job, *job_done on of about quota cost (steps * evaluations
+ * per step), all the rest if last. Jobs are cut on the reduction grid
+ * only, so the sum does not depend on who computes what.
+ */
+static int starter_take(const struct integrate_batch_job *jobs, int n_jobs,
+			int *job, size_t *job_done, long double quota,
+			int last, struct starter_slice *slices)
+{
+	int n_slices = 0;
+	for (; *job < n_jobs; (*job)++, *job_done = 0) {
+		const struct integrate_batch_job *cur = &jobs[*job];
+		int job_cost = integrate_rule_cost(&cur->rule);
+		size_t pos = cur->start_step + *job_done;
+		size_t take = cur->n_steps - *job_done;
+		if (!last && quota < (long double)take * job_cost) {
+			size_t cut = quota > 0 ? quota / job_cost + 0.5L : 0;
+			cut = (pos + cut + INTEGRATE_REDUCE_CHUNK / 2) /
+			      INTEGRATE_REDUCE_CHUNK * INTEGRATE_REDUCE_CHUNK;
+			if (cut < pos + take)
+				take = cut > pos ? cut - pos : 0;
+		}
+		if (take == 0 && cur->n_steps != 0)
+			break;
+
+		slices[n_slices].job = *job;
+		slices[n_slices].start_step = pos;
+		slices[n_slices].n_steps = take;
+		n_slices++;
+		quota -= (long double)take * job_cost;
+		*job_done += take;
+		if (*job_done != cur->n_steps)
+			break;
+	}
+	return n_slices;
+}
+
+/*
+ * Jobs are laid out one after another by cost, the line is cut in
+ * ranges proportional to worker speeds. So a worker gets either many
+ * whole jobs or a part of a large one, n_jobs + n_workers - 1 slices
+ * at most.
+ */
+static void starter_split_batch(const struct integrate_batch_job *jobs,
+				int n_jobs, int *speeds, int n_workers,
+				struct starter_slice *slices,
+				struct starter_share *shares)
 {
+	long double cost = 0;
 	int sum_speeds = 0;
-	for (int i = 0; i < n_sockets; i++)
-		sum_speeds += speeds[i];
+	for (int i = 0; i < n_jobs; i++)
+		cost += (long double)jobs[i].n_steps *
+			integrate_rule_cost(&jobs[i].rule);
+	for (int w = 0; w < n_workers; w++)
+		sum_speeds += speeds[w];
+
+	int job = 0;
+	size_t job_done = 0;
+	for (int w = 0; w < n_workers; w++) {
+		struct starter_share *share = &shares[w];
+		long double quota = cost * speeds[w] / sum_speeds;
+		cost -= quota;
+		sum_speeds -= speeds[w];
+		share->slices = slices;
+		share->n_slices = starter_take(jobs, n_jobs, &job, &job_done,
+					       quota, w == n_workers - 1,
+					       slices);
+		slices += share->n_slices;
+	}
+}
+
+/*
+ * Starter side of a worker connection, one epoll loop drives them all:
+ * speed is read as soon as the worker connects, requests go out when
+ * the accept window closes (at once in the coordinator), replies are
+ * read as they arrive.
+ */
+enum starter_conn_state {
+	STARTER_CONN_SPEED, /* HELLO */
+	STARTER_CONN_IDLE, /* speed known, waiting for the split */
+	STARTER_CONN_RESULT,
+	STARTER_CONN_TRACE,
+	STARTER_CONN_DONE,
+	STARTER_CONN_LOST, /* closed, outstanding slices went to retry */
+};
 
-	struct task_netw task;
-	task.base = full_task->base;
-	task.step_wdth = full_task->step_wdth;
-	size_t cur_step = full_task->start_step;
-	size_t n_steps = full_task->n_steps;
+/* Requests in flight per worker, pull mode refills as replies come */
+#define STARTER_PIPELINE 2
+
+/* Pull mode: chunk cost for this much work at the measured rate */
+#define STARTER_PULL_NS (50 * 1000000ULL)
+/* First chunk cost per unit of advertised speed */
+#define STARTER_PULL_FIRST 1024
+
+/*
+ * A worker is given up on if a reply is this many times later than its
+ * rate (or speed and the rate of the others) predicts, plus the slack
+ */
+#define STARTER_DEADLINE_FACTOR 4
+#define STARTER_DEADLINE_SLACK_NS (INTEGRATE_NETW_TIMEOUT_USEC * 1000ULL)
+#define STARTER_DEADLINE_CHECK_MS 100
+/*
+ * Rate assumed per unit of speed while no worker has replied, cost per
+ * second: slow on purpose, it only bounds the wait for a hung worker
+ */
+#define STARTER_FIRST_RATE 10000
+
+/* Backup if the copy would be done this many times sooner */
+#define STARTER_BACKUP_SLOWDOWN 2.0
+/* At most this part of the job cost is computed twice */
+#define STARTER_BACKUP_MAX 0.1
+/* Not worth it for less time left, latency dominates small requests */
+#define STARTER_BACKUP_MIN_NS STARTER_PULL_NS
+
+/* Coordinator: new workers are invited this often */
+#define COORD_BROADCAST_NS STARTER_DEADLINE_SLACK_NS
+
+/*
+ * Coordinator tenant: chunks go to the one with the least cost served
+ * per weight (vtime), among jobs of the highest priority
+ */
+struct coord_tenant {
+	int id;
+	long double weight;
+	long double vtime;
+	int n_jobs; /* submitted, not done */
+	int n_done;
+	long double cost; /* handed out so far, retries included */
+};
+
+/*
+ * One batch being computed: what is left of it and where the replies
+ * go. The starter has just one, the coordinator a queue of them.
+ */
+struct starter_job {
+	const struct integrate_batch_job *jobs;
+	int n_jobs;
+	size_t *offsets;
+	double *partials;
+	int n_outstanding; /* requests with work in flight */
+
+	/* Queue: jobs from q_job, q_done steps of it taken */
+	int q_job;
+	size_t q_done;
+	long double q_cost; /* left, retries included */
+	struct starter_slice *q_slices;
+
+	/* Slices of lost workers, handed out before the queue */
+	struct starter_slice *retry;
+	int n_retry;
+	int max_retry;
+	int n_retried;
+
+	/* Backups of the slowest requests on idle workers, near the end */
+	long double total_cost;
+	long double backup_cost;
+	int n_backups;
+	int n_backups_won;
+	int n_cancelled;
+
+	/* Coordinator: submitting client, -1 if it is gone */
+	unsigned id;
+	int client;
+	int priority;
+	struct coord_tenant *tenant; /* NULL: the starter's own */
+	uint64_t t_submit;
+	uint64_t t_start; /* first chunk sent */
+	struct integrate_batch_job *batch; /* jobs, refer to codes */
+	struct expr_code *codes;
+
+	struct starter_job *next; /* in submit order */
+};
+
+struct starter_request {
+	struct starter_job *job; /* NULL: the session end or cancelled */
+	uint32_t seq; /* number in the session, for CANCEL */
+	struct starter_slice *slices;
+	int n_slices;
+	int flags; /* NETW_REQUEST_* */
+	long double cost;
+	uint64_t t_sent; /* 0 until written out */
+
+	/* Backups: first request of conn twin is the other copy */
+	int twin; /* -1: none */
+	int done_elsewhere; /* the other copy won, don't retry */
+	int cancelled; /* CANCEL sent, the reply goes to spec and away */
+	double *spec; /* backup copy: partials kept until it wins */
+	size_t spec_len; /* chunks read to spec */
+};
+
+struct starter_conn {
+	int fd;
+	int state;
+	int speed;
+	int n_replies;
+
+	/* Written or waiting in out, replied in order */
+	struct starter_request req[STARTER_PIPELINE];
+	int req_first;
+	int req_count;
+	int last_queued; /* request without NETW_REQUEST_MORE */
+	uint32_t n_pushed;
+	struct netw_buf out;
+	size_t out_done;
+
+	/* Reply being read */
+	unsigned char hdr[NETW_FRAME_HDR];
+	struct netw_frame frame;
+	int in_reply; /* PARTIALS header read */
+	int slice;
+	size_t done; /* bytes of the current piece */
+	char *buf; /* HELLO or TRACE payload */
+
+	long double rate; /* cost per ns, pull mode */
+	uint64_t t_accept;
+	uint64_t t_state; /* speed exchange or request send span */
+	uint64_t t_sent; /* last request written, for clock offsets */
+	uint64_t t_ready; /* first bytes of the reply read */
+	uint64_t t_replied; /* previous reply read */
+};
 
-	for (; n_sockets != 0; n_sockets--) {
-		task.start_step = cur_step;
-		task.n_steps = (n_steps * speeds[n_sockets - 1]) / sum_speeds;
+/* Coordinator client: a request in, its reply out, then the next one */
+enum coord_client_state {
+	COORD_CLIENT_REQUEST,
+	COORD_CLIENT_WAIT, /* its job is queued or running */
+	COORD_CLIENT_REPLY,
+	COORD_CLIENT_FREE,
+};
 
-		cur_step += task.n_steps;
-		n_steps -= task.n_steps;
-		sum_speeds -= speeds[n_sockets - 1];
+struct coord_client {
+	int fd;
+	int state;
+	unsigned char hdr[NETW_FRAME_HDR];
+	struct netw_frame frame;
+	char *payload; /* SUBMIT */
+	size_t done;
+	struct starter_job *job;
+	struct netw_buf out;
+	size_t out_done;
+};
 
-		DUMP_LOG("Sending task to worker[%d]\n", n_sockets - 1);
+struct starter {
+	int epoll_fd;
+	int tcp_sock;
+	struct starter_conn *conns;
+	int n_conns;
+	int max_conns;
+	int n_done;
+	int n_lost;
+	int n_live;
+	int reassign; /* retries, a new job or the end to hand out */
+
+	struct starter_job *jobs; /* handed out now, NULL: none */
+	int pull;
+	long double backup_slowdown; /* 0: off */
+	long double backup_max; /* part of the job cost */
+
+	/* Coordinator: sessions don't end, jobs come from clients */
+	int coordinator;
+	int unix_sock;
+	struct coord_client *clients;
+	int n_clients;
+	int max_clients;
+	struct coord_tenant **tenants; /* jobs keep pointers */
+	int n_tenants;
+	int max_tenants;
+	unsigned n_submitted;
+};
 
-		ssize_t ret =
-			write(sockets[n_sockets - 1], &task, sizeof(task));
+/* epoll data of the listening sockets, others carry their conn index */
+#define STARTER_LISTEN UINT32_MAX
+#define COORD_LISTEN (UINT32_MAX - 1)
+/* Coordinator client index with this bit */
+#define COORD_CLIENT (1U << 31)
+#define STARTER_EVENTS 64
+
+/*
+ * Nonblocking piece read, *done bytes of it so far: 1 piece done,
+ * 0 would block, -1 error or EOF
+ */
+static int starter_read(int fd, size_t *done, void *buf, size_t len)
+{
+	while (*done != len) {
+		ssize_t ret = read(fd, (char *)buf + *done, len - *done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
 		if (ret < 0) {
-			if (errno == EPIPE)
-				fprintf(stderr,
-					"Error: connection to "
-					"worker[%d] lost (EPIPE)\n",
-					n_sockets - 1);
-			else
-				perror("Error: write");
+			perror("Error: read");
 			return -1;
 		}
-		if (ret != sizeof(task)) {
-			fprintf(stderr, "Error: nonfull write\n");
+		if (ret == 0) {
+			fprintf(stderr, "Error: connection lost\n");
 			return -1;
 		}
+		*done += ret;
 	}
-
-	return 0;
+	*done = 0;
+	return 1;
 }
 
-int starter_accumulate_result(int *sockets, int n_sockets, long double *result)
+/* Nonblocking write, *done bytes so far: 1 all written, 0 would block */
+static int starter_write(int fd, size_t *done, const void *buf, size_t len)
 {
-	DUMP_LOG("Receiving sum...\n");
-
-	fd_set set;
-	fd_set tmp_set;
-	FD_ZERO(&set);
-	int max_fd = 0;
-	for (int i = 0; i < n_sockets; i++) {
-		if (sockets[i] > max_fd)
-			max_fd = sockets[i];
-		FD_SET(sockets[i], &set);
-	}
-
-	long double accum = 0;
-	while (n_sockets) {
-		tmp_set = set;
-		int n_ready = select(max_fd + 1, &tmp_set, NULL, NULL, NULL);
-		if (n_ready < 0) {
-			perror("Error: select");
+	while (*done != len) {
+		ssize_t ret = write(fd, (const char *)buf + *done, len - *done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (ret < 0) {
+			if (errno == EPIPE)
+				fprintf(stderr,
+					"Error: connection lost (EPIPE)\n");
+			else
+				perror("Error: write");
 			return -1;
 		}
-
-		for (int n = 0; n_ready; n++) {
-			if (!FD_ISSET(sockets[n], &tmp_set))
-				continue;
-			long double sum;
-			if (netw_tcp_read(sockets[n], &sum, sizeof(sum)) < 0) {
-				fprintf(stderr, "Error: connection[%d] lost\n",
-					n_sockets - 1);
-				return -1;
-			}
-			DUMP_LOG("worker[%d] sum = %Lg\n", n, sum);
-			accum += sum;
-			n_ready--;
-			n_sockets--;
-			FD_CLR(sockets[n], &set);
-		}
+		*done += ret;
 	}
-
-	*result = accum;
-	return 0;
+	return 1;
 }
 
-int starter_get_workers_speeds(int *sockets, int *speeds, int n_sockets)
+/*
+ * Nonblocking read of a whole frame of type: header to hdr, then the
+ * payload to *payload, malloc'ed once the header is in
+ */
+static int starter_read_frame(int fd, size_t *done, void *hdr, int type,
+			      struct netw_frame *frame, char **payload)
 {
-	DUMP_LOG("Receiving ncpus...\n");
-	for (; n_sockets != 0; n_sockets--) {
-		if (netw_tcp_read(sockets[n_sockets - 1],
-				  &speeds[n_sockets - 1],
-				  sizeof(*speeds)) < 0) {
-			fprintf(stderr,
-				"Error: connection with worker[%d] lost\n",
-				n_sockets - 1);
+	if (!*payload) {
+		int ret = starter_read(fd, done, hdr, NETW_FRAME_HDR);
+		if (ret <= 0)
+			return ret;
+		if (netw_frame_parse(hdr, type, frame) < 0)
 			return -1;
-		}
 
-		DUMP_LOG("worker[%d] ncpus = %d\n", n_sockets - 1,
-			 speeds[n_sockets - 1]);
+		*payload = malloc(frame->len ? frame->len : 1);
+		if (!*payload) {
+			perror("Error: malloc");
+			return -1;
+		}
 	}
-
-	return 0;
+	return starter_read(fd, done, *payload, frame->len);
 }
 
-int integrate_network_starter(size_t n_steps, long double base,
-			      long double step, long double *result)
+static int starter_conn_read(struct starter_conn *conn, void *buf, size_t len)
 {
-	fprintf(stderr, "Starting starter\n");
+	return starter_read(conn->fd, &conn->done, buf, len);
+}
 
-	/* Set SIGPIPE here */
-	struct sigaction act = {};
-	act.sa_handler = SIG_IGN;
-	if (sigaction(SIGPIPE, &act, NULL) < 0) {
-		perror("Error: sigaction");
-		goto handle_err_0;
-	}
+static int starter_conn_read_frame(struct starter_conn *conn, int type)
+{
+	return starter_read_frame(conn->fd, &conn->done, conn->hdr, type,
+				  &conn->frame, &conn->buf);
+}
 
-	/* Prepare TCP socket */
-	int tcp_sock = netw_tcp_listen_socket(htons(INTEGRATE_TCP_PORT),
-					      INTEGRATE_MAX_WORKERS);
-	if (tcp_sock < 0) {
-		fprintf(stderr, "Error: starter_tcp_listen_socket failed\n");
-		goto handle_err_0;
+/* Write out queued requests: 1 all written, 0 would block, -1 error */
+static int starter_conn_flush(struct starter_conn *conn, int w)
+{
+	int ret = starter_write(conn->fd, &conn->out_done, conn->out.data,
+				conn->out.len);
+	if (ret <= 0)
+		return ret;
+	if (!conn->out.len)
+		return 1;
+
+	uint64_t now = trace_now();
+	for (int i = 0; i < conn->req_count; i++) {
+		struct starter_request *req =
+			&conn->req[(conn->req_first + i) % STARTER_PIPELINE];
+		if (!req->t_sent)
+			req->t_sent = now;
 	}
+	trace_end(TRACE_task_send, conn->t_state, w);
+	conn->out.len = 0;
+	conn->out_done = 0;
+	return 1;
+}
 
-	/* UDP Broadcast */
-	if (netw_udp_broadcast_msg(htons(INTEGRATE_UDP_PORT),
-				   INTEGRATE_UDP_MAGIC) < 0) {
-		fprintf(stderr, "Error: starter_udp_broadcast_msg failed\n");
-		goto handle_err_1;
+/* Queue a request of job slices to worker w and start writing it */
+static int starter_conn_push(struct starter *st, int w,
+			     struct starter_job *job,
+			     const struct starter_slice *slices, int n_slices,
+			     int flags)
+{
+	struct starter_conn *conn = &st->conns[w];
+
+	assert(conn->req_count < STARTER_PIPELINE);
+	struct starter_request *req =
+		&conn->req[(conn->req_first + conn->req_count) %
+			   STARTER_PIPELINE];
+	req->slices = malloc(sizeof(*slices) * (n_slices ? n_slices : 1));
+	if (!req->slices) {
+		perror("Error: malloc");
+		return -1;
 	}
 
-	/* Accept TCP connections */
-	int worker_sock[INTEGRATE_MAX_WORKERS];
-	struct timeval timeout;
-	timeout.tv_sec = 0;
-	timeout.tv_usec = INTEGRATE_NETW_TIMEOUT_USEC;
-
-	int n_workers = netw_tcp_accept_connections(
-		tcp_sock, worker_sock, INTEGRATE_MAX_WORKERS, &timeout);
-	if (n_workers < 0) {
-		fprintf(stderr, "Error: starter_accept_connections failed\n");
-		goto handle_err_1;
+	/* Queued requests stay, a failed one is cut off */
+	size_t out_len = conn->out.len;
+	size_t start = netw_frame_begin(
+		&conn->out, NETW_FRAME_REQUEST,
+		flags | (trace_enabled ? NETW_REQUEST_TRACE : 0));
+	req->cost = 0;
+	for (int i = 0; i < n_slices; i++) {
+		struct integrate_batch_job task = job->jobs[slices[i].job];
+		task.start_step = slices[i].start_step;
+		task.n_steps = slices[i].n_steps;
+		task_put(&conn->out, &task);
+		req->cost += (long double)task.n_steps *
+			     integrate_rule_cost(&task.rule);
 	}
-	if (n_workers == 0) {
-		DUMP_LOG("No workers aviable\n");
-		goto handle_err_1;
+	if (netw_frame_end(&conn->out, start, n_slices) < 0) {
+		fprintf(stderr, "Error: request of %d tasks\n", n_slices);
+		conn->out.len = out_len;
+		conn->out.err = 0;
+		free(req->slices);
+		return -1;
 	}
 
-	/* Get relative speeds (number of threads here) */
-	int worker_speed[INTEGRATE_MAX_WORKERS];
+	memcpy(req->slices, slices, sizeof(*slices) * n_slices);
+	req->job = job;
+	req->seq = conn->n_pushed++;
+	req->n_slices = n_slices;
+	req->flags = flags;
+	req->t_sent = 0;
+	req->twin = -1;
+	req->done_elsewhere = 0;
+	req->cancelled = 0;
+	req->spec = NULL;
+	req->spec_len = 0;
+	conn->req_count++;
+	if (flags & NETW_REQUEST_MORE)
+		job->n_outstanding++;
+	else
+		conn->last_queued = 1;
+
+	if (!out_len)
+		conn->t_state = trace_begin();
+
+	DUMP_LOG_DEBUG("Sending %d tasks to worker[%d]\n", n_slices, w);
+	return starter_conn_flush(conn, w) < 0 ? -1 : 0;
+}
 
-	if (starter_get_workers_speeds(worker_sock, worker_speed, n_workers) <
-	    0) {
-		fprintf(stderr, "Error: starter_get_workers_ncpus failed\n");
+static long double starter_slice_cost(struct starter_job *job,
+				      const struct starter_slice *slice)
+{
+	return (long double)slice->n_steps *
+	       integrate_rule_cost(&job->jobs[slice->job].rule);
+}
+
+/* Place of the slice chunk partials in the job partials */
+static double *starter_slice_partials(struct starter_job *job,
+				      const struct starter_slice *slice)
+{
+	size_t first = integrate_reduce_first(job->jobs[slice->job].start_step);
+	return job->partials + job->offsets[slice->job] +
+	       integrate_reduce_first(slice->start_step) - first;
+}
+
+static int starter_retry_add(struct starter_job *job,
+			     const struct starter_slice *slice)
+{
+	if (job->n_retry == job->max_retry) {
+		int max_retry = job->max_retry ? job->max_retry * 2 : 16;
+		struct starter_slice *retry =
+			realloc(job->retry, sizeof(*retry) * max_retry);
+		if (!retry) {
+			perror("Error: realloc");
+			return -1;
+		}
+		job->retry = retry;
+		job->max_retry = max_retry;
+	}
+	job->retry[job->n_retry++] = *slice;
+	job->q_cost += starter_slice_cost(job, slice);
+	return 0;
+}
+
+/* Next chunk, retries first, at least one grid chunk; 0: none left */
+static int starter_queue_take(struct starter_job *job, long double quota)
+{
+	int n_slices;
+	if (job->n_retry) {
+		/* Cut the last retry slice as a job of its own */
+		struct starter_slice *retry = &job->retry[job->n_retry - 1];
+		struct integrate_batch_job cur = job->jobs[retry->job];
+		long double min = (long double)INTEGRATE_REDUCE_CHUNK *
+				  integrate_rule_cost(&cur.rule);
+		int job_idx = 0;
+		size_t job_done = 0;
+		cur.start_step = retry->start_step;
+		cur.n_steps = retry->n_steps;
+		n_slices = starter_take(&cur, 1, &job_idx, &job_done,
+					quota < min ? min : quota, 0,
+					job->q_slices);
+		job->q_slices[0].job = retry->job;
+		retry->start_step += job_done;
+		retry->n_steps -= job_done;
+		if (job_idx == 1)
+			job->n_retry--;
+	} else if (job->q_job != job->n_jobs) {
+		const struct integrate_batch_job *cur = &job->jobs[job->q_job];
+		long double min = (long double)INTEGRATE_REDUCE_CHUNK *
+				  integrate_rule_cost(&cur->rule);
+		n_slices = starter_take(job->jobs, job->n_jobs, &job->q_job,
+					&job->q_done, quota < min ? min : quota,
+					0, job->q_slices);
+	} else {
+		return 0;
+	}
+
+	for (int i = 0; i < n_slices; i++)
+		job->q_cost -= starter_slice_cost(job, &job->q_slices[i]);
+	return n_slices;
+}
+
+/* Slices left to hand out or to be replied */
+static int starter_job_busy(const struct starter_job *job)
+{
+	return job->n_outstanding || job->n_retry || job->q_job != job->n_jobs;
+}
+
+/* Partials and queue of the whole batch, job zeroed by the caller */
+static int starter_job_init(struct starter_job *job,
+			    const struct integrate_batch_job *jobs, int n_jobs)
+{
+	job->jobs = jobs;
+	job->n_jobs = n_jobs;
+	job->client = -1;
+	job->offsets = malloc(sizeof(*job->offsets) * (n_jobs + 1));
+	job->q_slices = malloc(sizeof(*job->q_slices) * n_jobs);
+	if (!job->offsets || !job->q_slices) {
+		perror("Error: malloc");
+		return -1;
+	}
+
+	job->offsets[0] = 0;
+	for (int i = 0; i < n_jobs; i++) {
+		job->total_cost += (long double)jobs[i].n_steps *
+				   integrate_rule_cost(&jobs[i].rule);
+		job->offsets[i + 1] =
+			job->offsets[i] +
+			integrate_reduce_n_chunks(jobs[i].start_step,
+						  jobs[i].n_steps);
+	}
+	job->q_cost = job->total_cost;
+	size_t n_partials = job->offsets[n_jobs];
+	job->partials =
+		malloc(sizeof(*job->partials) * (n_partials ? n_partials : 1));
+	if (!job->partials) {
+		perror("Error: malloc");
+		return -1;
+	}
+	return 0;
+}
+
+static void starter_job_free(struct starter_job *job)
+{
+	free(job->partials);
+	free(job->q_slices);
+	free(job->offsets);
+	free(job->retry);
+	free(job->batch);
+	free(job->codes);
+}
+
+static void starter_job_results(struct starter_job *job, long double *results)
+{
+	for (int i = 0; i < job->n_jobs; i++)
+		results[i] = integrate_reduce(
+			job->partials + job->offsets[i],
+			job->offsets[i + 1] - job->offsets[i]);
+}
+
+static void starter_job_report(struct starter_job *job)
+{
+	if (job->n_backups)
+		DUMP_LOG("%d backups (%.2f%% of the job), %d won, "
+			 "%d cancelled\n",
+			 job->n_backups,
+			 (double)(100 * job->backup_cost / job->total_cost),
+			 job->n_backups_won, job->n_cancelled);
+}
+
+/* Mean rate per unit of speed of workers that replied, 0: none yet */
+static long double starter_rate_per_speed(struct starter *st)
+{
+	long double sum_rate = 0;
+	long double sum_speed = 0;
+	for (int w = 0; w < st->n_conns; w++) {
+		if (st->conns[w].state != STARTER_CONN_LOST &&
+		    st->conns[w].rate) {
+			sum_rate += st->conns[w].rate;
+			sum_speed += st->conns[w].speed;
+		}
+	}
+	return sum_speed ? sum_rate / sum_speed : 0;
+}
+
+/* Measured rate, or one expected from the speed */
+static long double starter_conn_rate(struct starter_conn *conn,
+				     long double rate_per_speed)
+{
+	return conn->rate ? conn->rate : conn->speed * rate_per_speed;
+}
+
+/* Chunks of all slices of req, the size of its PARTIALS */
+static size_t starter_req_chunks(const struct starter_request *req)
+{
+	size_t n_chunks = 0;
+	for (int i = 0; i < req->n_slices; i++) {
+		n_chunks += integrate_reduce_n_chunks(req->slices[i].start_step,
+						      req->slices[i].n_steps);
+	}
+	return n_chunks;
+}
+
+/* Queued requests start when the previous one is replied */
+static uint64_t starter_req_start(struct starter_conn *conn,
+				  struct starter_request *req)
+{
+	return req->t_sent > conn->t_replied ? req->t_sent : conn->t_replied;
+}
+
+/*
+ * Nothing left to hand out: idle worker w copies the request expected
+ * to be done last, if it would be done backup_slowdown times sooner
+ * here. Whichever copy replies first wins, the other is cancelled.
+ */
+static int starter_backup(struct starter *st, int w)
+{
+	struct starter_conn *idle = &st->conns[w];
+	long double rate_per_speed = starter_rate_per_speed(st);
+	long double idle_rate = starter_conn_rate(idle, rate_per_speed);
+	if (!st->backup_slowdown || !idle_rate)
+		return 0;
+
+	uint64_t now = trace_now();
+	long double latest = 0;
+	long double cost = 0;
+	int slow = -1;
+	for (int t = 0; t < st->n_conns; t++) {
+		struct starter_conn *conn = &st->conns[t];
+		if (conn->state != STARTER_CONN_RESULT || !conn->req_count)
+			continue;
+		struct starter_request *req = &conn->req[conn->req_first];
+		long double rate = starter_conn_rate(conn, rate_per_speed);
+		if (!req->t_sent || req->twin >= 0 || req->cancelled ||
+		    !req->cost || !rate)
+			continue;
+
+		/* Overdue ones may take as long again */
+		long double elapsed = now - starter_req_start(conn, req);
+		long double left = elapsed < req->cost / rate ?
+					   req->cost / rate - elapsed :
+					   elapsed;
+		if (slow < 0 || left > latest) {
+			slow = t;
+			latest = left;
+		}
+	}
+	if (slow < 0)
+		return 0;
+
+	struct starter_conn *conn = &st->conns[slow];
+	struct starter_request *req = &conn->req[conn->req_first];
+	struct starter_job *job = req->job;
+	size_t n_chunks = 0;
+	for (int i = conn->slice; i < req->n_slices; i++) {
+		cost += starter_slice_cost(job, &req->slices[i]);
+		n_chunks += integrate_reduce_n_chunks(
+			req->slices[i].start_step, req->slices[i].n_steps);
+	}
+	if (latest < st->backup_slowdown * cost / idle_rate ||
+	    latest < STARTER_BACKUP_MIN_NS ||
+	    job->backup_cost + cost > st->backup_max * job->total_cost)
+		return 0;
+
+	double *spec = malloc(sizeof(*spec) * (n_chunks ? n_chunks : 1));
+	if (!spec) {
+		perror("Error: malloc");
+		return -1;
+	}
+	if (starter_conn_push(st, w, job, req->slices + conn->slice,
+			      req->n_slices - conn->slice,
+			      NETW_REQUEST_MORE) < 0) {
+		free(spec);
+		return -1;
+	}
+
+	struct starter_request *copy = &idle->req[idle->req_first];
+	copy->spec = spec;
+	copy->twin = slow;
+	req->twin = w;
+	job->backup_cost += cost;
+	job->n_backups++;
+	DUMP_LOG("worker[%d] backs up worker[%d], %d slices\n", w, slow,
+		 copy->n_slices);
+	return 0;
+}
+
+static long double starter_job_vtime(const struct starter_job *job)
+{
+	return job->tenant ? job->tenant->vtime : 0;
+}
+
+/*
+ * Job of the next chunk: the highest priority first, then the tenant
+ * furthest behind its share, then submit order. NULL: nothing to hand
+ * out.
+ */
+static struct starter_job *starter_job_pick(struct starter *st)
+{
+	struct starter_job *best = NULL;
+	for (struct starter_job *job = st->jobs; job; job = job->next) {
+		if (!job->n_retry && job->q_job == job->n_jobs)
+			continue;
+		if (!best || job->priority > best->priority ||
+		    (job->priority == best->priority &&
+		     starter_job_vtime(job) < starter_job_vtime(best)))
+			best = job;
+	}
+	return best;
+}
+
+/*
+ * Keep STARTER_PIPELINE requests in flight, so the next one is there
+ * when the worker is done with the current one. Each is a chunk of the
+ * job picked for it, so jobs share the workers chunk by chunk. Chunks
+ * are STARTER_PULL_NS at the worker's rate, but no more than its part
+ * of what is left of the job (guided). Static mode has only retries to
+ * hand out.
+ */
+static int starter_conn_refill(struct starter *st, int w)
+{
+	struct starter_conn *conn = &st->conns[w];
+
+	while (!conn->last_queued && conn->req_count < STARTER_PIPELINE) {
+		struct starter_job *job = starter_job_pick(st);
+		if (!job) {
+			if (!conn->req_count && starter_backup(st, w) < 0)
+				return -1;
+			break;
+		}
+
+		long double quota = conn->rate ?
+					    conn->rate * STARTER_PULL_NS :
+					    (long double)conn->speed *
+						    STARTER_PULL_FIRST;
+		long double part = job->q_cost / st->n_live;
+		if (quota > part)
+			quota = part;
+
+		long double q_cost = job->q_cost;
+		int n_slices = starter_queue_take(job, quota);
+		if (starter_conn_push(st, w, job, job->q_slices, n_slices,
+				      NETW_REQUEST_MORE) < 0)
+			return -1;
+		if (!job->t_start)
+			job->t_start = trace_now();
+		if (job->tenant) {
+			job->tenant->cost += q_cost - job->q_cost;
+			job->tenant->vtime +=
+				(q_cost - job->q_cost) / job->tenant->weight;
+		}
+	}
+	return 0;
+}
+
+/* An empty request without NETW_REQUEST_MORE ends the session */
+static int starter_conn_finish(struct starter *st, int w)
+{
+	struct starter_conn *conn = &st->conns[w];
+	if (conn->last_queued)
+		return 0;
+	return starter_conn_push(st, w, NULL, NULL, 0, 0);
+}
+
+/*
+ * Close connection w, slices it still owes go to retry. A reply being
+ * read keeps the slices read so far, a backed up request is left to
+ * its other copy. Returns slices to retry.
+ */
+static int starter_conn_close(struct starter *st, int w)
+{
+	struct starter_conn *conn = &st->conns[w];
+	int n_slices = 0;
+
+	for (int i = 0; i < conn->req_count; i++) {
+		struct starter_request *req =
+			&conn->req[(conn->req_first + i) % STARTER_PIPELINE];
+		struct starter_job *job = req->job;
+		if (req->twin >= 0) {
+			struct starter_conn *twin = &st->conns[req->twin];
+			twin->req[twin->req_first].twin = -1;
+		} else if (!req->done_elsewhere) {
+			for (int j = i ? 0 : conn->slice; j < req->n_slices;
+			     j++) {
+				if (starter_retry_add(job, &req->slices[j]) < 0)
+					st->reassign = -1;
+				job->n_retried++;
+				n_slices++;
+			}
+		}
+		if ((req->flags & NETW_REQUEST_MORE) && !req->cancelled)
+			job->n_outstanding--;
+		free(req->slices);
+		free(req->spec);
+	}
+	conn->req_count = 0;
+
+	free(conn->out.data);
+	free(conn->buf);
+	memset(&conn->out, 0, sizeof(conn->out));
+	conn->buf = NULL;
+	close(conn->fd);
+	conn->state = STARTER_CONN_LOST;
+	st->n_lost++;
+	st->n_live--;
+	if (st->reassign >= 0)
+		st->reassign = 1;
+	return n_slices;
+}
+
+static void starter_conn_lost(struct starter *st, int w, const char *why)
+{
+	int n_slices = starter_conn_close(st, w);
+	DUMP_LOG_AT(DUMP_LOG_LVL_WARN,
+		    "worker[%d] lost (%s), %d slices to retry\n", w, why,
+		    n_slices);
+}
+
+/*
+ * The other copy of the first request of w won: CANCEL it, w stays in
+ * its session. Partials still coming are read to spec and dropped, the
+ * job is done with the request.
+ */
+static void starter_conn_cancel(struct starter *st, int w)
+{
+	struct starter_conn *conn = &st->conns[w];
+	struct starter_request *req = &conn->req[conn->req_first];
+	struct starter_job *job = req->job;
+	req->twin = -1;
+	req->done_elsewhere = 1;
+	job->n_cancelled++;
+
+	if (!req->spec) {
+		size_t n_chunks = starter_req_chunks(req);
+		req->spec = malloc(sizeof(*req->spec) *
+				   (n_chunks ? n_chunks : 1));
+		if (!req->spec) {
+			perror("Error: malloc");
+			starter_conn_lost(st, w, "cancel");
+			return;
+		}
+	}
+	req->cancelled = 1;
+	req->job = NULL;
+	if (!--job->n_outstanding && !starter_job_busy(job) && !st->reassign)
+		st->reassign = 1;
+
+	size_t start = netw_frame_begin(&conn->out, NETW_FRAME_CANCEL, 0);
+	size_t rec = netw_record_begin(&conn->out);
+	netw_put_u32(&conn->out, req->seq);
+	netw_record_end(&conn->out, rec);
+	if (netw_frame_end(&conn->out, start, 1) < 0 ||
+	    starter_conn_flush(conn, w) < 0) {
+		starter_conn_lost(st, w, "write");
+		return;
+	}
+	DUMP_LOG("worker[%d] cancelled\n", w);
+}
+
+/* Jobs are handed out from the next refill on */
+static void starter_job_add(struct starter *st, struct starter_job *job)
+{
+	struct starter_job **pos = &st->jobs;
+	while (*pos)
+		pos = &(*pos)->next;
+	job->next = NULL;
+	*pos = job;
+	if (st->reassign >= 0)
+		st->reassign = 1;
+}
+
+static void starter_job_remove(struct starter *st, struct starter_job *job)
+{
+	struct starter_job **pos = &st->jobs;
+	while (*pos != job)
+		pos = &(*pos)->next;
+	*pos = job->next;
+}
+
+/*
+ * Tenant by id, weight from INTEGRATE_COORD_SHARES (1 if not there).
+ * A tenant coming back after a pause starts at the least vtime of the
+ * busy ones: no credit is saved up while idle.
+ */
+static struct coord_tenant *coord_tenant_get(struct starter *st, int id)
+{
+	struct coord_tenant *tenant = NULL;
+	long double vtime = -1;
+	for (int i = 0; i < st->n_tenants; i++) {
+		struct coord_tenant *cur = st->tenants[i];
+		if (cur->id == id)
+			tenant = cur;
+		else if (cur->n_jobs && (vtime < 0 || cur->vtime < vtime))
+			vtime = cur->vtime;
+	}
+
+	if (!tenant) {
+		if (st->n_tenants == st->max_tenants) {
+			int max_tenants =
+				st->max_tenants ? st->max_tenants * 2 : 16;
+			struct coord_tenant **tenants = realloc(
+				st->tenants, sizeof(*tenants) * max_tenants);
+			if (!tenants) {
+				perror("Error: realloc");
+				return NULL;
+			}
+			st->tenants = tenants;
+			st->max_tenants = max_tenants;
+		}
+		tenant = calloc(1, sizeof(*tenant));
+		if (!tenant) {
+			perror("Error: calloc");
+			return NULL;
+		}
+		st->tenants[st->n_tenants++] = tenant;
+		tenant->id = id;
+		tenant->weight = 1;
+	}
+	if (!tenant->n_jobs && vtime > tenant->vtime)
+		tenant->vtime = vtime;
+	return tenant;
+}
+
+/* Its job goes on, the results are dropped */
+static void coord_client_close(struct starter *st, int c)
+{
+	struct coord_client *cl = &st->clients[c];
+	if (cl->job)
+		cl->job->client = -1;
+	free(cl->payload);
+	free(cl->out.data);
+	close(cl->fd);
+	memset(cl, 0, sizeof(*cl));
+	cl->state = COORD_CLIENT_FREE;
+	DUMP_LOG_DEBUG("client[%d] closed\n", c);
+}
+
+/* Results of job if status is 0, written out by coord_client_step */
+static int coord_client_reply(struct starter *st, int c,
+			      struct starter_job *job, int status)
+{
+	struct coord_client *cl = &st->clients[c];
+	uint64_t queued_ns = 0;
+	uint64_t service_ns = 0;
+	if (job) {
+		queued_ns = job->t_start - job->t_submit;
+		service_ns = trace_now() - job->t_start;
+	}
+	int n_jobs = status ? 0 : job->n_jobs;
+
+	cl->out.len = 0;
+	size_t start = netw_frame_begin(&cl->out, NETW_FRAME_RESULT, 0);
+	size_t rec = netw_record_begin(&cl->out);
+	netw_put_u32(&cl->out, status);
+	netw_put_u64(&cl->out, queued_ns);
+	netw_put_u64(&cl->out, service_ns);
+	netw_record_end(&cl->out, rec);
+	for (int i = 0; i < n_jobs; i++) {
+		netw_put_ldbl(&cl->out,
+			      integrate_reduce(job->partials + job->offsets[i],
+					       job->offsets[i + 1] -
+						       job->offsets[i]));
+	}
+	if (netw_frame_end(&cl->out, start, n_jobs) < 0) {
+		fprintf(stderr, "Error: reply of %d results\n", n_jobs);
+		return -1;
+	}
+
+	cl->out_done = 0;
+	cl->job = NULL;
+	cl->state = COORD_CLIENT_REPLY;
+	return 0;
+}
+
+/* Batch of client c is read: its tasks become a job, run at once */
+static int coord_job_submit(struct starter *st, int c)
+{
+	struct coord_client *cl = &st->clients[c];
+	int n_jobs = cl->frame.count;
+
+	struct netw_reader rd, options;
+	netw_reader_init(&rd, cl->payload, cl->frame.len);
+	netw_get_record(&rd, &options);
+	int priority = (int32_t)netw_get_u32(&options);
+	int tenant = (int32_t)netw_get_u32(&options);
+
+	struct starter_job *job = calloc(1, sizeof(*job));
+	if (!job) {
+		perror("Error: calloc");
+		return -1;
+	}
+	job->batch = malloc(sizeof(*job->batch) * n_jobs);
+	job->codes = malloc(sizeof(*job->codes) * n_jobs);
+	if (!job->batch || !job->codes) {
+		perror("Error: malloc");
+		goto handle_err;
+	}
+	for (int i = 0; i < n_jobs; i++) {
+		if (options.err ||
+		    task_get(&rd, &job->batch[i], &job->codes[i]) < 0) {
+			/* The client is told, the connection stays */
+			starter_job_free(job);
+			free(job);
+			return coord_client_reply(st, c, NULL, -1);
+		}
+	}
+	if (starter_job_init(job, job->batch, n_jobs) < 0)
+		goto handle_err;
+	job->tenant = coord_tenant_get(st, tenant);
+	if (!job->tenant)
+		goto handle_err;
+
+	job->id = st->n_submitted++;
+	job->client = c;
+	job->priority = priority;
+	job->t_submit = trace_now();
+	job->tenant->n_jobs++;
+	cl->job = job;
+	cl->state = COORD_CLIENT_WAIT;
+	starter_job_add(st, job);
+	DUMP_LOG("job %u: %d integrals from client[%d], tenant %d, "
+		 "priority %d\n",
+		 job->id, n_jobs, c, job->tenant->id, job->priority);
+	return 0;
+
+handle_err:
+	starter_job_free(job);
+	free(job);
+	return -1;
+}
+
+/* Advance client c as far as its socket allows */
+static int coord_client_step(struct starter *st, int c)
+{
+	struct coord_client *cl = &st->clients[c];
+	int ret;
+
+	while (1) {
+		switch (cl->state) {
+		case COORD_CLIENT_REQUEST:
+			/* Closed between requests: done, not an error */
+			if (!cl->done && !cl->payload &&
+			    recv(cl->fd, &ret, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+				return -1;
+			ret = starter_read_frame(cl->fd, &cl->done, cl->hdr,
+						 NETW_FRAME_SUBMIT, &cl->frame,
+						 &cl->payload);
+			if (ret <= 0)
+				return ret;
+			if (cl->frame.count < 1 ||
+			    cl->frame.count > INTEGRATE_BATCH_MAX) {
+				fprintf(stderr,
+					"Error: wrong batch size %u from "
+					"client\n",
+					cl->frame.count);
+				return -1;
+			}
+			ret = coord_job_submit(st, c);
+			free(cl->payload);
+			cl->payload = NULL;
+			if (ret < 0)
+				return -1;
+			break;
+
+		case COORD_CLIENT_WAIT:
+		case COORD_CLIENT_FREE:
+			return 0;
+
+		case COORD_CLIENT_REPLY:
+			ret = starter_write(cl->fd, &cl->out_done, cl->out.data,
+					    cl->out.len);
+			if (ret <= 0)
+				return ret;
+			cl->out.len = 0;
+			cl->state = COORD_CLIENT_REQUEST;
+			break;
+		}
+	}
+}
+
+/* Job is computed (status 0) or failed: reply to its client */
+static void coord_job_done(struct starter *st, struct starter_job *job,
+			   int status)
+{
+	uint64_t now = trace_now();
+	if (!job->t_start)
+		job->t_start = now;
+	struct coord_tenant *tenant = job->tenant;
+	tenant->n_jobs--;
+	tenant->n_done++;
+	DUMP_LOG("job %u done: %.3f ms queued, %.3f ms service, "
+		 "%d slices retried\n",
+		 job->id, (job->t_start - job->t_submit) * 1e-6,
+		 (now - job->t_start) * 1e-6, job->n_retried);
+	DUMP_LOG_DEBUG("tenant %d: %d jobs done, %d running, cost %Lg\n",
+		       tenant->id, tenant->n_done, tenant->n_jobs,
+		       tenant->cost);
+	starter_job_report(job);
+
+	int c = job->client;
+	if (c >= 0 && (coord_client_reply(st, c, job, status) < 0 ||
+		       coord_client_step(st, c) < 0))
+		coord_client_close(st, c);
+	starter_job_free(job);
+	free(job);
+}
+
+/* The starter ends the sessions once it is the last one */
+static void starter_job_end(struct starter *st, struct starter_job *job,
+			    int status)
+{
+	starter_job_remove(st, job);
+	if (st->coordinator)
+		coord_job_done(st, job, status);
+}
+
+/*
+ * Hand retries and new jobs out to idle workers, end the sessions once
+ * nothing is left (the coordinator keeps them). -1: can't go on (no
+ * memory for retries).
+ */
+static int starter_reassign(struct starter *st)
+{
+	while (st->reassign > 0) {
+		st->reassign = 0;
+		struct starter_job *job = st->jobs;
+		while (job) {
+			struct starter_job *next = job->next;
+			if (!starter_job_busy(job))
+				starter_job_end(st, job, 0);
+			job = next;
+		}
+		for (int w = 0; w < st->n_conns; w++) {
+			if (st->conns[w].state != STARTER_CONN_RESULT)
+				continue;
+			int ret = 0;
+			if (st->jobs)
+				ret = starter_conn_refill(st, w);
+			else if (!st->coordinator)
+				ret = starter_conn_finish(st, w);
+			if (ret < 0)
+				starter_conn_lost(st, w, "write");
+		}
+	}
+	return st->reassign;
+}
+
+/*
+ * Overdue replies count as lost, see STARTER_DEADLINE_FACTOR. So do
+ * coordinator workers that don't send their speed.
+ */
+static void starter_check_deadlines(struct starter *st, uint64_t now)
+{
+	long double first_rate = STARTER_FIRST_RATE * 1e-9L;
+	long double rate_per_speed = starter_rate_per_speed(st);
+	if (!rate_per_speed)
+		rate_per_speed = first_rate;
+
+	for (int w = 0; w < st->n_conns; w++) {
+		struct starter_conn *conn = &st->conns[w];
+		if (conn->state == STARTER_CONN_SPEED &&
+		    (st->coordinator || st->pull) &&
+		    now - conn->t_accept > STARTER_DEADLINE_SLACK_NS)
+			starter_conn_lost(st, w, "no speed");
+		if (conn->state != STARTER_CONN_RESULT || !conn->req_count)
+			continue;
+		struct starter_request *req = &conn->req[conn->req_first];
+		if (!req->t_sent)
+			continue;
+
+		long double rate = starter_conn_rate(conn, rate_per_speed);
+		if (!rate) /* no speed advertised */
+			rate = first_rate;
+		uint64_t start = starter_req_start(conn, req);
+		long double expected = req->cost > 0 ? req->cost / rate : 0;
+		if (now - start > STARTER_DEADLINE_FACTOR * expected +
+					  STARTER_DEADLINE_SLACK_NS)
+			starter_conn_lost(st, w, "deadline");
+	}
+}
+
+/* First request of worker w is replied: its rate, next requests */
+static int starter_conn_replied(struct starter *st, int w)
+{
+	struct starter_conn *conn = &st->conns[w];
+	struct starter_request *req = &conn->req[conn->req_first];
+	struct starter_job *job = req->job;
+	uint64_t now = trace_now();
+
+	uint64_t start = starter_req_start(conn, req);
+	int empty = conn->frame.flags & NETW_PARTIALS_CANCELLED;
+	if (req->cost > 0 && now > start && !empty) {
+		long double rate = req->cost / (now - start);
+		conn->rate = conn->rate ? (conn->rate + rate) / 2 : rate;
+	}
+	if (conn->t_ready)
+		trace_end(TRACE_result_recv, conn->t_ready, w);
+	conn->t_sent = req->t_sent;
+	conn->t_replied = now;
+	conn->n_replies++;
+
+	/* Both copies of a backup are done by the first reply */
+	if (req->cancelled) {
+		free(req->spec);
+		req->spec = NULL;
+	} else if (req->spec) {
+		double *src = req->spec;
+		for (int i = 0; i < req->n_slices; i++) {
+			struct starter_slice *slice = &req->slices[i];
+			size_t n_chunks = integrate_reduce_n_chunks(
+				slice->start_step, slice->n_steps);
+			memcpy(starter_slice_partials(job, slice), src,
+			       sizeof(*src) * n_chunks);
+			src += n_chunks;
+		}
+		free(req->spec);
+		req->spec = NULL;
+		job->n_backups_won++;
+	}
+	if (req->twin >= 0) {
+		starter_conn_cancel(st, req->twin);
+		req->twin = -1;
+	}
+
+	int flags = req->flags;
+	if ((flags & NETW_REQUEST_MORE) && !req->cancelled) {
+		/* Nothing left to compute: the job is done */
+		if (!--job->n_outstanding && !starter_job_busy(job) &&
+		    !st->reassign)
+			st->reassign = 1;
+	}
+	free(req->slices);
+	req->slices = NULL;
+	conn->req_first = (conn->req_first + 1) % STARTER_PIPELINE;
+	conn->req_count--;
+	conn->slice = 0;
+	conn->in_reply = 0;
+
+	if (!(flags & NETW_REQUEST_MORE)) {
+		conn->state = trace_enabled ? STARTER_CONN_TRACE :
+					      STARTER_CONN_DONE;
+		return 0;
+	}
+	conn->t_ready = 0;
+	return starter_conn_refill(st, w);
+}
+
+/*
+ * Worker spans onto our timeline. Offset of its clock, NTP style:
+ * request sent t_sent, read t_recv; reply sent t_send, ready t_ready.
+ */
+static int starter_conn_add_trace(struct starter_conn *conn, int w)
+{
+	size_t n_events = conn->frame.count;
+	if (n_events > (size_t)TRACE_RING * TRACE_MAX_THREADS) {
+		fprintf(stderr, "Error: wrong trace size from worker\n");
+		return -1;
+	}
+
+	struct netw_reader rd;
+	netw_reader_init(&rd, conn->buf, conn->frame.len);
+	uint64_t t_recv = netw_get_u64(&rd);
+	uint64_t t_send = netw_get_u64(&rd);
+	size_t event_size = netw_get_u32(&rd);
+
+	struct trace_event *events =
+		malloc(sizeof(*events) * (n_events ? n_events : 1));
+	if (!events) {
+		perror("Error: malloc");
+		return -1;
+	}
+	for (size_t i = 0; i < n_events; i++) {
+		struct netw_reader ev;
+		netw_get_sized(&rd, event_size, &ev);
+		events[i].ts = netw_get_u64(&ev);
+		events[i].dur = netw_get_u64(&ev);
+		events[i].arg = netw_get_u32(&ev);
+		events[i].id = netw_get_u16(&ev);
+		events[i].tid = netw_get_u16(&ev);
+	}
+	if (rd.err || event_size < NETW_TRACE_EVENT_SIZE) {
+		fprintf(stderr, "Error: short trace from worker\n");
+		free(events);
+		return -1;
+	}
+
+	int64_t offset = ((int64_t)(t_recv - conn->t_sent) +
+			  (int64_t)(t_send - conn->t_ready)) / 2;
+	DUMP_LOG("worker[%d] clock offset %lld ns, %zu spans\n", w,
+		 (long long)offset, n_events);
+
+	char name[32];
+	snprintf(name, sizeof(name), "worker[%d]", w);
+	int ret = trace_add_process(name, events, n_events, offset);
+	free(events);
+	return ret;
+}
+
+/*
+ * Advance connection w as far as its socket allows. Chunk partials of
+ * a slice are read straight to their place in the job partials.
+ */
+static int starter_conn_step(struct starter *st, int w)
+{
+	struct starter_conn *conn = &st->conns[w];
+	struct starter_request *req;
+	int ret;
+
+	if (starter_conn_flush(conn, w) < 0)
+		return -1;
+
+	while (1) {
+		switch (conn->state) {
+		case STARTER_CONN_SPEED:
+			ret = starter_conn_read_frame(conn, NETW_FRAME_HELLO);
+			if (ret <= 0)
+				return ret;
+			struct netw_reader rd, hello;
+			netw_reader_init(&rd, conn->buf, conn->frame.len);
+			netw_get_record(&rd, &hello);
+			conn->speed = netw_get_u32(&hello);
+			free(conn->buf);
+			conn->buf = NULL;
+			if (hello.err || conn->speed < 0) {
+				fprintf(stderr, "Error: wrong HELLO\n");
+				return -1;
+			}
+			DUMP_LOG("worker[%d] speed = %d\n", w, conn->speed);
+			trace_end(TRACE_speed_exchange, conn->t_state, w);
+			if (!st->coordinator && !st->pull) {
+				conn->state = STARTER_CONN_IDLE;
+				break;
+			}
+
+			/* Joins the current job at once */
+			conn->state = STARTER_CONN_RESULT;
+			ret = st->jobs || st->coordinator ?
+				      starter_conn_refill(st, w) :
+				      starter_conn_finish(st, w);
+			if (ret < 0)
+				return -1;
+			break;
+		case STARTER_CONN_IDLE:
+		case STARTER_CONN_DONE:
+			return 0;
+
+		case STARTER_CONN_RESULT:
+			if (!conn->req_count)
+				return 0;
+			req = &conn->req[conn->req_first];
+			if (!conn->in_reply) {
+				ret = starter_conn_read(conn, conn->hdr,
+							NETW_FRAME_HDR);
+				if (!conn->t_ready && (ret > 0 || conn->done))
+					conn->t_ready = trace_now();
+				if (ret <= 0)
+					return ret;
+				if (netw_frame_parse(conn->hdr,
+						     NETW_FRAME_PARTIALS,
+						     &conn->frame) < 0)
+					return -1;
+				size_t n_chunks = starter_req_chunks(req);
+				if (conn->frame.flags &
+				    NETW_PARTIALS_CANCELLED) {
+					/* Nothing more of req comes */
+					n_chunks = 0;
+					conn->slice = req->n_slices;
+				}
+				if ((conn->frame.flags &
+				     NETW_PARTIALS_CANCELLED &&
+				     !req->cancelled) ||
+				    conn->frame.count != n_chunks ||
+				    conn->frame.len !=
+					    sizeof(double) * n_chunks) {
+					fprintf(stderr,
+						"Error: %u partials from "
+						"worker, expected %zu\n",
+						conn->frame.count, n_chunks);
+					return -1;
+				}
+				conn->in_reply = 1;
+			}
+			if (conn->slice == req->n_slices) {
+				if (starter_conn_replied(st, w) < 0)
+					return -1;
+				break;
+			}
+
+			struct starter_slice *slice = &req->slices[conn->slice];
+			double *dst =
+				req->spec ? req->spec + req->spec_len :
+					    starter_slice_partials(req->job,
+								   slice);
+			size_t n_chunks = integrate_reduce_n_chunks(
+				slice->start_step, slice->n_steps);
+			ret = starter_conn_read(conn, dst,
+						sizeof(*dst) * n_chunks);
+			if (ret <= 0)
+				return ret;
+			netw_f64_le(dst, n_chunks);
+			req->spec_len += n_chunks;
+			conn->slice++;
+			break;
+
+		case STARTER_CONN_TRACE:
+			ret = starter_conn_read_frame(conn, NETW_FRAME_TRACE);
+			if (ret <= 0)
+				return ret;
+			if (starter_conn_add_trace(conn, w) < 0)
+				return -1;
+			free(conn->buf);
+			conn->buf = NULL;
+			conn->state = STARTER_CONN_DONE;
+			break;
+		}
+
+		if (conn->state == STARTER_CONN_DONE) {
+			DUMP_LOG("worker[%d] done, %d requests\n", w,
+				 conn->n_replies);
+			st->n_done++;
+			return 0;
+		}
+	}
+}
+
+/* Accept everything pending, speeds are read as they come */
+static int starter_accept(struct starter *st)
+{
+	while (1) {
+		/* The coordinator runs for long, reuses slots of lost ones */
+		int w = st->n_conns;
+		if (st->coordinator) {
+			for (w = 0; w < st->n_conns; w++) {
+				if (st->conns[w].state == STARTER_CONN_LOST)
+					break;
+			}
+		}
+
+		int fd = accept4(st->tcp_sock, NULL, NULL, SOCK_NONBLOCK);
+		if (fd < 0 && errno == EINTR)
+			continue;
+		if (fd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (fd < 0) {
+			perror("Error: accept");
+			return -1;
+		}
+
+		/* No slot: turn it away, the edge is spent only at EAGAIN */
+		if (w == INTEGRATE_MAX_WORKERS) {
+			DUMP_LOG_AT(DUMP_LOG_LVL_WARN,
+				    "worker turned away, %d slots in use\n", w);
+			close(fd);
+			continue;
+		}
+
+		if (netw_tcp_set_keepalive(fd) < 0) {
+			fprintf(stderr, "Error: netw_socket_keepalive\n");
+			close(fd);
+			return -1;
+		}
+
+		if (st->n_conns == st->max_conns) {
+			int max_conns = st->max_conns ? st->max_conns * 2 : 16;
+			struct starter_conn *conns = realloc(
+				st->conns, sizeof(*conns) * max_conns);
+			if (!conns) {
+				perror("Error: realloc");
+				close(fd);
+				return -1;
+			}
+			st->conns = conns;
+			st->max_conns = max_conns;
+		}
+
+		struct starter_conn *conn = &st->conns[w];
+		memset(conn, 0, sizeof(*conn));
+		conn->fd = fd;
+		conn->state = STARTER_CONN_SPEED;
+		conn->t_accept = trace_now();
+		conn->t_state = trace_begin();
+
+		/* Edge triggered: every handler reads or writes to EAGAIN */
+		struct epoll_event ev = {
+			.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+			.data.u32 = w,
+		};
+		if (epoll_ctl(st->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			perror("Error: epoll_ctl");
+			close(fd);
+			conn->state = STARTER_CONN_LOST;
+			return -1;
+		}
+		if (w == st->n_conns)
+			st->n_conns++;
+		else
+			st->n_lost--;
+		st->n_live++;
+		DUMP_LOG("Accepted connection №%d\n", w + 1);
+
+		if (starter_conn_step(st, w) < 0)
+			starter_conn_lost(st, w, "read");
+	}
+}
+
+/* Hang up after the whole reply is fine */
+static void starter_conn_event(struct starter *st, int w, uint32_t events)
+{
+	struct starter_conn *conn = &st->conns[w];
+	if (conn->state == STARTER_CONN_LOST)
+		return;
+	if (starter_conn_step(st, w) < 0)
+		starter_conn_lost(st, w, "read");
+	else if (conn->state != STARTER_CONN_DONE &&
+		 (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)))
+		starter_conn_lost(st, w, "hangup");
+}
+
+/* Static mode: one share per worker, split by the speeds */
+static int starter_dispatch_static(struct starter *st, struct starter_job *job)
+{
+	int *live = malloc(sizeof(*live) * st->n_conns * 2);
+	struct starter_share *shares = malloc(sizeof(*shares) * st->n_conns);
+	struct starter_slice *slices =
+		malloc(sizeof(*slices) * (job->n_jobs + st->n_conns));
+	if (!live || !shares || !slices) {
+		perror("Error: malloc");
+		free(slices);
+		free(shares);
+		free(live);
+		return -1;
+	}
+
+	int *speeds = live + st->n_conns;
+	int n_live = 0;
+	for (int w = 0; w < st->n_conns; w++) {
+		if (st->conns[w].state != STARTER_CONN_IDLE)
+			continue;
+		speeds[n_live] = st->conns[w].speed;
+		live[n_live++] = w;
+	}
+	starter_split_batch(job->jobs, job->n_jobs, speeds, n_live, slices,
+			    shares);
+	job->q_job = job->n_jobs;
+	job->q_cost = 0;
+	starter_job_add(st, job);
+
+	for (int i = 0; i < n_live; i++) {
+		int w = live[i];
+		st->conns[w].state = STARTER_CONN_RESULT;
+		if (starter_conn_push(st, w, job, shares[i].slices,
+				      shares[i].n_slices,
+				      NETW_REQUEST_MORE) < 0) {
+			/* Pushed already, so retried with the rest */
+			starter_conn_lost(st, w, "write");
+		}
+	}
+
+	free(slices);
+	free(shares);
+	free(live);
+	return 0;
+}
+
+/* Pull mode: workers take chunks from the queue as they reply */
+static int starter_dispatch_pull(struct starter *st, struct starter_job *job)
+{
+	starter_job_add(st, job);
+	for (int w = 0; w < st->n_conns; w++) {
+		if (st->conns[w].state != STARTER_CONN_IDLE)
+			continue;
+		st->conns[w].state = STARTER_CONN_RESULT;
+		if (starter_conn_refill(st, w) < 0)
+			starter_conn_lost(st, w, "write");
+	}
+	return 0;
+}
+
+/*
+ * No worker is left for the queue and the retries: compute them here,
+ * on all cpus we may run on
+ */
+static int starter_compute_rest(struct starter_job *job)
+{
+	int n_slices = starter_take(job->jobs, job->n_jobs, &job->q_job,
+				    &job->q_done, 0, 1, job->q_slices);
+	for (int i = 0; i < n_slices; i++) {
+		if (starter_retry_add(job, &job->q_slices[i]) < 0)
+			return -1;
+	}
+	if (!job->n_retry)
+		return 0;
+
+	DUMP_LOG_AT(DUMP_LOG_LVL_WARN, "computing %d slices here\n",
+		    job->n_retry);
+	cpu_set_t cpuset;
+	if (sched_getaffinity(0, sizeof(cpuset), &cpuset) < 0) {
+		perror("Error: sched_getaffinity");
+		return -1;
+	}
+	struct integrate_pool *pool =
+		integrate_pool_create(CPU_COUNT(&cpuset), &cpuset);
+	if (!pool) {
+		fprintf(stderr, "Error: integrate_pool_create failed\n");
+		return -1;
+	}
+
+	for (; job->n_retry; job->n_retry--) {
+		struct starter_slice *slice = &job->retry[job->n_retry - 1];
+		struct integrate_batch_job cur = job->jobs[slice->job];
+		double *dst = starter_slice_partials(job, slice);
+		cur.start_step = slice->start_step;
+		cur.n_steps = slice->n_steps;
+		if (cur.n_steps &&
+		    integrate_pool_batch_partials(pool, &cur, 1, dst) < 0) {
+			fprintf(stderr, "Error: integrate failed\n");
+			integrate_pool_destroy(pool);
+			return -1;
+		}
+	}
+	integrate_pool_destroy(pool);
+	return 0;
+}
+
+/* A descriptor per worker, take all the hard limit allows */
+static void starter_raise_nofile(void)
+{
+	struct rlimit lim;
+	if (getrlimit(RLIMIT_NOFILE, &lim) < 0 || lim.rlim_cur == lim.rlim_max)
+		return;
+	lim.rlim_cur = lim.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &lim) < 0)
+		DUMP_LOG_AT(DUMP_LOG_LVL_WARN,
+			    "can't raise RLIMIT_NOFILE: %s\n", strerror(errno));
+}
+
+/*
+ * Static mode: one job run by the workers that came in the accept
+ * window. Pull mode: the job is there from the start, workers join it
+ * on their HELLO for as long as it runs.
+ */
+static int starter_running(struct starter *st, int window)
+{
+	if (st->n_done + st->n_lost != st->n_conns)
+		return 1;
+	return st->pull ? st->jobs && (window || st->n_live) : window;
+}
+
+/*
+ * Accept window, then request and reply of every worker, in one loop.
+ * Lost workers' slices go to the others, or are computed here if none
+ * is left.
+ */
+static int starter_run(struct starter *st, struct starter_job *job)
+{
+	struct epoll_event events[STARTER_EVENTS];
+	uint64_t t_accept = trace_begin();
+	uint64_t deadline = trace_now() +
+			    (uint64_t)INTEGRATE_NETW_TIMEOUT_USEC * 1000;
+	uint64_t t_checked = trace_now();
+	uint64_t t_broadcast = t_checked;
+	int window = 1;
+	int dispatched = 0;
+
+	if (st->pull) {
+		if (starter_dispatch_pull(st, job) < 0)
+			return -1;
+		dispatched = 1;
+	}
+
+	while (starter_running(st, window)) {
+		int timeout = STARTER_DEADLINE_CHECK_MS;
+		uint64_t now = trace_now();
+		if (st->pull && now - t_broadcast >= COORD_BROADCAST_NS) {
+			/* Late workers join too, not fatal */
+			if (netw_udp_broadcast_msg(htons(INTEGRATE_UDP_PORT),
+						   INTEGRATE_UDP_MAGIC) < 0)
+				fprintf(stderr, "Error: starter "
+						"broadcast failed\n");
+			t_broadcast = now;
+		}
+		if (window && now < deadline) {
+			if (deadline - now < timeout * 1000000ULL)
+				timeout = (deadline - now + 999999) / 1000000;
+		} else if (window) {
+			DUMP_LOG("Accept timed out, %d connections accepted\n",
+				 st->n_conns);
+			trace_end(TRACE_accept, t_accept, st->n_conns);
+			window = 0;
+
+			/* Silent ones are not waited for */
+			for (int w = 0; !st->pull && w < st->n_conns; w++) {
+				if (st->conns[w].state == STARTER_CONN_SPEED)
+					starter_conn_lost(st, w, "no speed");
+			}
+			if (st->n_conns == st->n_lost) {
+				DUMP_LOG("No workers aviable\n");
+				return -1;
+			}
+			if (!dispatched &&
+			    starter_dispatch_static(st, job) < 0)
+				return -1;
+			dispatched = 1;
+			t_checked = now;
+			if (starter_reassign(st) < 0)
+				return -1;
+			continue;
+		}
+		if (dispatched &&
+		    now - t_checked >= STARTER_DEADLINE_CHECK_MS * 1000000ULL) {
+			/* Idle workers may back up stragglers by now */
+			starter_check_deadlines(st, now);
+			t_checked = now;
+			if (!st->reassign)
+				st->reassign = 1;
+			if (starter_reassign(st) < 0)
+				return -1;
+			continue;
+		}
+
+		int n_events = epoll_wait(st->epoll_fd, events,
+					  STARTER_EVENTS, timeout);
+		if (n_events < 0 && errno == EINTR)
+			continue;
+		if (n_events < 0) {
+			perror("Error: epoll_wait");
+			return -1;
+		}
+
+		for (int i = 0; i < n_events; i++) {
+			uint32_t w = events[i].data.u32;
+			if (w == STARTER_LISTEN) {
+				if ((st->pull || window) &&
+				    starter_accept(st) < 0)
+					return -1;
+				continue;
+			}
+			starter_conn_event(st, w, events[i].events);
+		}
+		if (starter_reassign(st) < 0)
+			return -1;
+	}
+
+	if (starter_compute_rest(job) < 0)
+		return -1;
+	if (st->n_lost)
+		DUMP_LOG_AT(DUMP_LOG_LVL_WARN,
+			    "%d of %d workers lost, %d slices retried\n",
+			    st->n_lost, st->n_conns, job->n_retried);
+	starter_job_report(job);
+	return 0;
+}
+
+static void starter_close_conns(struct starter *st)
+{
+	for (int w = 0; w < st->n_conns; w++) {
+		struct starter_conn *conn = &st->conns[w];
+		if (conn->state == STARTER_CONN_LOST)
+			continue;
+		for (int i = 0; i < conn->req_count; i++) {
+			struct starter_request *req =
+				&conn->req[(conn->req_first + i) %
+					   STARTER_PIPELINE];
+			free(req->slices);
+			free(req->spec);
+		}
+		free(conn->out.data);
+		free(conn->buf);
+		close(conn->fd);
+	}
+	free(st->conns);
+}
+
+/* INTEGRATE_NETW_BACKUP=slowdown[:max part of the job], 0: off */
+static void starter_backup_config(struct starter *st)
+{
+	st->backup_slowdown = STARTER_BACKUP_SLOWDOWN;
+	st->backup_max = STARTER_BACKUP_MAX;
+
+	const char *env = getenv("INTEGRATE_NETW_BACKUP");
+	if (!env)
+		return;
+	double slowdown;
+	double max = STARTER_BACKUP_MAX;
+	if (sscanf(env, "%lf:%lf", &slowdown, &max) < 1 || slowdown < 0 ||
+	    max < 0) {
+		fprintf(stderr,
+			"Error: INTEGRATE_NETW_BACKUP=%s wrong, using %g:%g\n",
+			env, STARTER_BACKUP_SLOWDOWN, STARTER_BACKUP_MAX);
+		return;
+	}
+	st->backup_slowdown = slowdown;
+	st->backup_max = max;
+}
+
+/* INTEGRATE_NETW_SCHED: static (default) or pull */
+static int starter_pull_mode(void)
+{
+	const char *env = getenv("INTEGRATE_NETW_SCHED");
+	if (!env || !strcmp(env, "static"))
+		return 0;
+	if (!strcmp(env, "pull"))
+		return 1;
+	fprintf(stderr,
+		"Error: INTEGRATE_NETW_SCHED=%s unknown, using static\n", env);
+	return 0;
+}
+
+/* Listening socket for workers, nonblocking, in epoll as STARTER_LISTEN */
+static int starter_listen(struct starter *st)
+{
+	st->tcp_sock = netw_tcp_listen_socket(htons(INTEGRATE_TCP_PORT),
+					      INTEGRATE_MAX_WORKERS);
+	if (st->tcp_sock < 0) {
+		fprintf(stderr, "Error: starter_tcp_listen_socket failed\n");
+		goto handle_err_0;
+	}
+	if (fcntl(st->tcp_sock, F_SETFL, O_NONBLOCK) < 0) {
+		perror("Error: fcntl");
+		goto handle_err_1;
+	}
+
+	st->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (st->epoll_fd < 0) {
+		perror("Error: epoll_create1");
+		goto handle_err_1;
+	}
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLET,
+		.data.u32 = STARTER_LISTEN,
+	};
+	if (epoll_ctl(st->epoll_fd, EPOLL_CTL_ADD, st->tcp_sock, &ev) < 0) {
+		perror("Error: epoll_ctl");
 		goto handle_err_2;
 	}
+	return 0;
+
+handle_err_2:
+	close(st->epoll_fd);
+handle_err_1:
+	close(st->tcp_sock);
+handle_err_0:
+	return -1;
+}
 
-	/* Split task and send requests */
-	struct task_netw task;
-	task.base = base;
-	task.step_wdth = step;
-	task.start_step = 0;
-	task.n_steps = n_steps;
+/* Integer from environment variable name, def if unset or wrong */
+static int starter_env_int(const char *name, int def)
+{
+	const char *env = getenv(name);
+	if (!env)
+		return def;
+
+	char *endptr;
+	errno = 0;
+	long val = strtol(env, &endptr, 10);
+	if (errno || endptr == env || *endptr != '\0' || val < INT_MIN ||
+	    val > INT_MAX) {
+		fprintf(stderr, "Error: %s=%s wrong, using %d\n", name, env,
+			def);
+		return def;
+	}
+	return val;
+}
 
-	if (starter_send_tasks(worker_sock, worker_speed, n_workers, &task) <
-	    0) {
-		fprintf(stderr, "Error: starter_send_tasks failed\n");
+int integrate_network_starter(size_t n_steps, long double base,
+			      long double step, const struct integrand *func,
+			      const struct integrate_rule *rule,
+			      long double *result)
+{
+	struct integrate_batch_job job = {
+		.func = *func,
+		.rule = *rule,
+		.base = base,
+		.step = step,
+		.start_step = 0,
+		.n_steps = n_steps,
+	};
+	return integrate_network_starter_batch(&job, 1, result);
+}
+
+int integrate_network_starter_batch(const struct integrate_batch_job *jobs,
+				    int n_jobs, long double *results)
+{
+	/* A running coordinator has the workers already */
+	const char *coordinator = getenv("INTEGRATE_COORDINATOR");
+	if (coordinator)
+		return integrate_network_submit(
+			*coordinator ? coordinator : INTEGRATE_COORDINATOR_PATH,
+			jobs, n_jobs, starter_env_int("INTEGRATE_PRIORITY", 0),
+			starter_env_int("INTEGRATE_TENANT", 0), results);
+
+	fprintf(stderr, "Starting starter\n");
+
+	if (n_jobs < 1 || n_jobs > INTEGRATE_BATCH_MAX) {
+		fprintf(stderr, "Error: wrong batch size %d\n", n_jobs);
+		goto handle_err_0;
+	}
+
+	/* Set SIGPIPE here */
+	struct sigaction act = {};
+	act.sa_handler = SIG_IGN;
+	if (sigaction(SIGPIPE, &act, NULL) < 0) {
+		perror("Error: sigaction");
+		goto handle_err_0;
+	}
+	starter_raise_nofile();
+
+	struct starter st = {
+		.pull = starter_pull_mode(),
+	};
+	struct starter_job job = {};
+	if (starter_job_init(&job, jobs, n_jobs) < 0)
+		goto handle_err_1;
+	starter_backup_config(&st);
+
+	if (starter_listen(&st) < 0)
+		goto handle_err_1;
+
+	/* UDP Broadcast */
+	uint64_t trace_start = trace_begin();
+	if (netw_udp_broadcast_msg(htons(INTEGRATE_UDP_PORT),
+				   INTEGRATE_UDP_MAGIC) < 0) {
+		fprintf(stderr, "Error: starter_udp_broadcast_msg failed\n");
 		goto handle_err_2;
 	}
+	trace_end(TRACE_udp_broadcast, trace_start, 0);
 
-	/* Accumulate result */
-	if (starter_accumulate_result(worker_sock, n_workers, result) < 0) {
-		fprintf(stderr, "Error: starter_accumulate_result failed\n");
+	if (starter_run(&st, &job) < 0) {
+		fprintf(stderr, "Error: starter_run failed\n");
 		goto handle_err_2;
 	}
+	starter_job_results(&job, results);
 
 	/* Close connections */
-	while (n_workers--)
-		close(worker_sock[n_workers]);
-	close(tcp_sock);
+	starter_close_conns(&st);
+	close(st.epoll_fd);
+	close(st.tcp_sock);
+	starter_job_free(&job);
 
 	return 0;
 
 handle_err_2:
-	while (n_workers--)
-		close(worker_sock[n_workers]);
+	starter_close_conns(&st);
+	close(st.epoll_fd);
+	close(st.tcp_sock);
 handle_err_1:
-	close(tcp_sock);
+	starter_job_free(&job);
+handle_err_0:
+	return -1;
+}
+
+/********************** Coordinator *************************/
+
+/* Accept every pending client, requests are read as they come */
+static int coord_accept(struct starter *st)
+{
+	while (1) {
+		int fd = accept4(st->unix_sock, NULL, NULL, SOCK_NONBLOCK);
+		if (fd < 0 && errno == EINTR)
+			continue;
+		if (fd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (fd < 0) {
+			perror("Error: accept");
+			return -1;
+		}
+
+		int c;
+		for (c = 0; c < st->n_clients; c++) {
+			if (st->clients[c].state == COORD_CLIENT_FREE)
+				break;
+		}
+		if (c == st->max_clients) {
+			int max_clients =
+				st->max_clients ? st->max_clients * 2 : 16;
+			struct coord_client *clients = realloc(
+				st->clients, sizeof(*clients) * max_clients);
+			if (!clients) {
+				perror("Error: realloc");
+				close(fd);
+				return -1;
+			}
+			st->clients = clients;
+			st->max_clients = max_clients;
+		}
+
+		struct coord_client *cl = &st->clients[c];
+		memset(cl, 0, sizeof(*cl));
+		cl->fd = fd;
+		cl->state = COORD_CLIENT_REQUEST;
+
+		struct epoll_event ev = {
+			.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+			.data.u32 = COORD_CLIENT | c,
+		};
+		if (epoll_ctl(st->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			perror("Error: epoll_ctl");
+			close(fd);
+			cl->state = COORD_CLIENT_FREE;
+			return -1;
+		}
+		if (c == st->n_clients)
+			st->n_clients++;
+		DUMP_LOG_DEBUG("client[%d] connected\n", c);
+
+		if (coord_client_step(st, c) < 0)
+			coord_client_close(st, c);
+	}
+}
+
+/* A hang up drops the client, its reply can't be read any more */
+static void coord_client_event(struct starter *st, int c, uint32_t events)
+{
+	if (st->clients[c].state == COORD_CLIENT_FREE)
+		return;
+	if ((events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) ||
+	    coord_client_step(st, c) < 0)
+		coord_client_close(st, c);
+}
+
+/* Listening unix socket at path, a stale one is replaced */
+static int coord_listen(struct starter *st, const char *path)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Error: socket path %s too long\n", path);
+		goto handle_err_0;
+	}
+	strcpy(addr.sun_path, path);
+
+	st->unix_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (st->unix_sock < 0) {
+		perror("Error: socket");
+		goto handle_err_0;
+	}
+	unlink(path);
+	if (bind(st->unix_sock, &addr, sizeof(addr))) {
+		perror("Error: bind");
+		goto handle_err_1;
+	}
+	if (listen(st->unix_sock, SOMAXCONN)) {
+		perror("Error: listen");
+		goto handle_err_1;
+	}
+
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLET,
+		.data.u32 = COORD_LISTEN,
+	};
+	if (epoll_ctl(st->epoll_fd, EPOLL_CTL_ADD, st->unix_sock, &ev) < 0) {
+		perror("Error: epoll_ctl");
+		goto handle_err_1;
+	}
+	return 0;
+
+handle_err_1:
+	close(st->unix_sock);
+handle_err_0:
+	return -1;
+}
+
+static void coord_close(struct starter *st)
+{
+	for (int c = 0; c < st->n_clients; c++) {
+		if (st->clients[c].state != COORD_CLIENT_FREE)
+			coord_client_close(st, c);
+	}
+	free(st->clients);
+
+	while (st->jobs) {
+		struct starter_job *job = st->jobs;
+		st->jobs = job->next;
+		starter_job_free(job);
+		free(job);
+	}
+	for (int i = 0; i < st->n_tenants; i++)
+		free(st->tenants[i]);
+	free(st->tenants);
+}
+
+/* No worker is left: jobs submitted before the slack are computed here */
+static void coord_compute_orphans(struct starter *st, uint64_t now)
+{
+	struct starter_job *job = st->jobs;
+	while (job) {
+		struct starter_job *next = job->next;
+		if (now - job->t_submit > STARTER_DEADLINE_SLACK_NS) {
+			if (!job->t_start)
+				job->t_start = now;
+			starter_job_end(st, job, starter_compute_rest(job));
+		}
+		job = next;
+	}
+}
+
+/* INTEGRATE_COORD_SHARES=tenant:weight[,tenant:weight...], others 1 */
+static int coord_shares_config(struct starter *st)
+{
+	const char *env = getenv("INTEGRATE_COORD_SHARES");
+	if (!env)
+		return 0;
+
+	const char *pos = env;
+	while (*pos) {
+		int id;
+		int len;
+		double weight;
+		if (sscanf(pos, "%d:%lf%n", &id, &weight, &len) < 2 ||
+		    weight <= 0) {
+			fprintf(stderr,
+				"Error: INTEGRATE_COORD_SHARES=%s wrong, "
+				"using equal shares\n",
+				env);
+			for (int i = 0; i < st->n_tenants; i++)
+				st->tenants[i]->weight = 1;
+			return 0;
+		}
+		struct coord_tenant *tenant = coord_tenant_get(st, id);
+		if (!tenant)
+			return -1;
+		tenant->weight = weight;
+		pos += len;
+		if (*pos == ',')
+			pos++;
+	}
+	return 0;
+}
+
+/*
+ * Between the periodic broadcasts workers join and keep their sessions,
+ * all submitted jobs share them in pull mode, see starter_job_pick.
+ * Jobs nobody is left for are computed here.
+ */
+static int coord_run(struct starter *st)
+{
+	struct epoll_event events[STARTER_EVENTS];
+	uint64_t t_broadcast = 0;
+	uint64_t t_checked = trace_now();
+
+	while (1) {
+		uint64_t now = trace_now();
+		if (now - t_broadcast >= COORD_BROADCAST_NS) {
+			/* Not fatal, workers already joined go on */
+			if (netw_udp_broadcast_msg(htons(INTEGRATE_UDP_PORT),
+						   INTEGRATE_UDP_MAGIC) < 0)
+				fprintf(stderr, "Error: coordinator "
+						"broadcast failed\n");
+			t_broadcast = now;
+		}
+		if (now - t_checked >= STARTER_DEADLINE_CHECK_MS * 1000000ULL) {
+			starter_check_deadlines(st, now);
+			t_checked = now;
+			if (!st->n_live)
+				coord_compute_orphans(st, now);
+			if (!st->reassign)
+				st->reassign = 1;
+		}
+		if (starter_reassign(st) < 0)
+			return -1;
+
+		int n_events = epoll_wait(st->epoll_fd, events,
+					  STARTER_EVENTS,
+					  STARTER_DEADLINE_CHECK_MS);
+		if (n_events < 0 && errno == EINTR)
+			continue;
+		if (n_events < 0) {
+			perror("Error: epoll_wait");
+			return -1;
+		}
+
+		for (int i = 0; i < n_events; i++) {
+			uint32_t w = events[i].data.u32;
+			int ret = 0;
+			if (w == STARTER_LISTEN)
+				ret = starter_accept(st);
+			else if (w == COORD_LISTEN)
+				ret = coord_accept(st);
+			else if (w & COORD_CLIENT)
+				coord_client_event(st, w & ~COORD_CLIENT,
+						   events[i].events);
+			else
+				starter_conn_event(st, w, events[i].events);
+			if (ret < 0)
+				return -1;
+		}
+	}
+}
+
+int integrate_network_coordinator(const char *path)
+{
+	fprintf(stderr, "Starting coordinator at %s\n", path);
+
+	struct sigaction act = {};
+	act.sa_handler = SIG_IGN;
+	if (sigaction(SIGPIPE, &act, NULL) < 0) {
+		perror("Error: sigaction");
+		goto handle_err_0;
+	}
+	starter_raise_nofile();
+
+	struct starter st = {
+		.pull = 1,
+		.coordinator = 1,
+	};
+	starter_backup_config(&st);
+	if (coord_shares_config(&st) < 0)
+		goto handle_err_0;
+
+	if (starter_listen(&st) < 0)
+		goto handle_err_0;
+	if (coord_listen(&st, path) < 0)
+		goto handle_err_1;
+
+	coord_run(&st);
+	fprintf(stderr, "Error: coord_run failed\n");
+
+	coord_close(&st);
+	close(st.unix_sock);
+	unlink(path);
+handle_err_1:
+	starter_close_conns(&st);
+	close(st.epoll_fd);
+	close(st.tcp_sock);
+handle_err_0:
+	return -1;
+}
+
+int integrate_network_submit(const char *path,
+			     const struct integrate_batch_job *jobs, int n_jobs,
+			     int priority, int tenant, long double *results)
+{
+	if (n_jobs < 1 || n_jobs > INTEGRATE_BATCH_MAX) {
+		fprintf(stderr, "Error: wrong batch size %d\n", n_jobs);
+		goto handle_err_0;
+	}
+
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Error: socket path %s too long\n", path);
+		goto handle_err_0;
+	}
+	strcpy(addr.sun_path, path);
+
+	struct netw_buf out = {};
+	size_t start = netw_frame_begin(&out, NETW_FRAME_SUBMIT, 0);
+	size_t rec = netw_record_begin(&out);
+	netw_put_u32(&out, priority);
+	netw_put_u32(&out, tenant);
+	netw_record_end(&out, rec);
+	for (int i = 0; i < n_jobs; i++)
+		task_put(&out, &jobs[i]);
+	if (netw_frame_end(&out, start, n_jobs) < 0) {
+		fprintf(stderr, "Error: batch of %d jobs\n", n_jobs);
+		goto handle_err_1;
+	}
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		perror("Error: socket");
+		goto handle_err_1;
+	}
+	if (connect(sock, &addr, sizeof(addr)) < 0) {
+		perror("Error: connect to coordinator");
+		goto handle_err_2;
+	}
+
+	if (netw_tcp_write(sock, out.data, out.len) < 0) {
+		fprintf(stderr, "Error: write job to coordinator\n");
+		goto handle_err_2;
+	}
+
+	struct netw_frame reply;
+	char *payload;
+	if (netw_read_frame(sock, NETW_FRAME_RESULT, &reply, &payload) < 0) {
+		fprintf(stderr, "Error: read reply from coordinator\n");
+		goto handle_err_2;
+	}
+	struct netw_reader rd, status;
+	netw_reader_init(&rd, payload, reply.len);
+	netw_get_record(&rd, &status);
+	int ret = (int32_t)netw_get_u32(&status);
+	uint64_t queued_ns = netw_get_u64(&status);
+	uint64_t service_ns = netw_get_u64(&status);
+	for (uint32_t i = 0; i < reply.count && i < (uint32_t)n_jobs; i++)
+		results[i] = netw_get_ldbl(&rd);
+	free(payload);
+	if (status.err || ret || rd.err || reply.count != (uint32_t)n_jobs) {
+		fprintf(stderr, "Error: coordinator failed the job\n");
+		goto handle_err_2;
+	}
+	DUMP_LOG("coordinator: %.3f ms queued, %.3f ms service\n",
+		 queued_ns * 1e-6, service_ns * 1e-6);
+
+	close(sock);
+	free(out.data);
+	return 0;
+
+handle_err_2:
+	close(sock);
+handle_err_1:
+	free(out.data);
 handle_err_0:
 	return -1;
 }
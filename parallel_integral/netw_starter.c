@@ -4,23 +4,93 @@
 #include <errno.h>
 #include <assert.h>
 #include <float.h>
+#include <unistd.h>
+
+/* argv: [job options], adaptive -e is local-only */
+int process_args(int argc, char *argv[], struct integrate_job *job)
+{
+	integrate_job_init(job);
+
+	int opt;
+	while ((opt = getopt(argc, argv, INTEGRATE_JOB_OPTS)) != -1) {
+		if (integrate_job_parse_opt(job, opt, optarg))
+			return -1;
+	}
+	if (integrate_job_check(job))
+		return -1;
+
+	if (optind != argc || job->epsrel != 0) {
+		fprintf(stderr, "Error: [-f func[:params]] [-r rule] "
+				"[-n n_steps] [-a from] [-b to] "
+				"[-s param:from:to:count]\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Parameter sweep as one request */
+static int integrate_sweep(struct integrate_job *job)
+{
+	struct integrate_batch_job *batch = integrate_job_sweep(job);
+	if (!batch)
+		exit(EXIT_FAILURE);
+
+	long double *results = malloc(sizeof(*results) * job->sweep_count);
+	if (!results) {
+		perror("Error: malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	if (integrate_network_starter_batch(batch, job->sweep_count,
+					    results) < 0) {
+		fprintf(stderr, "Error: starter failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < job->sweep_count; i++)
+		printf("p%d = %-12.8g result: %.*Lg\n", job->sweep_param,
+		       batch[i].func.params[job->sweep_param], LDBL_DIG,
+		       results[i]);
+
+	free(results);
+	free(batch);
+	integrand_fini(&job->func);
+	return 0;
+}
 
 int main(int argc, char *argv[])
 {
-	long double from = INTEGRATE_FROM;
-	long double to = INTEGRATE_TO;
-	long double step = INTEGRATE_STEP;
+	struct integrate_job job;
+	if (process_args(argc, argv, &job))
+		exit(EXIT_FAILURE);
+
+	/* Timeline of the starter and all workers */
+	const char *trace_path = trace_init();
+
+	if (job.sweep_count) {
+		int ret = integrate_sweep(&job);
+		if (trace_path && trace_dump(trace_path, "starter") < 0)
+			exit(EXIT_FAILURE);
+		return ret;
+	}
+
+	long double step = integrate_job_step(&job);
 	long double result;
-	size_t n_steps = (to - from) / step;
 
-	int ret = integrate_network_starter(n_steps, from, step, &result);
+	int ret = integrate_network_starter(job.n_steps, job.from, step,
+					    &job.func, &job.rule, &result);
 	if (ret == -1) {
 		fprintf(stderr, "Error: starter failed\n");
 		exit(EXIT_FAILURE);
 	}
 
 	printf("result: %.*Lg\n", LDBL_DIG, result);
-	printf("+1/to : %.*Lg\n", LDBL_DIG, result + 1 / to);
+	if (job.func.id == INTEGRAND_DEFAULT)
+		printf("+1/to : %.*Lg\n", LDBL_DIG, result + 1 / job.to);
 
+	integrand_fini(&job.func);
+	if (trace_path && trace_dump(trace_path, "starter") < 0)
+		exit(EXIT_FAILURE);
 	return 0;
 }
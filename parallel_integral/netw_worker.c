@@ -4,18 +4,42 @@
 #include <errno.h>
 #include <assert.h>
 #include <float.h>
+#include <unistd.h>
+#include <limits.h>
 
-int process_args(int argc, char *argv[], int *n_threads)
+/* argv: [-p placement] [-w weights] [n_threads], default and 0: budget */
+int process_args(int argc, char *argv[], int *n_threads, int *placement,
+		 int *weights)
 {
-	if (argc != 2) {
-		fprintf(stderr, "Error: only n_threads required\n");
+	*placement = CPU_PLACE_SMT_LAST;
+	*weights = CPU_WEIGHT_CAPACITY;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:w:")) != -1) {
+		if (opt == 'p')
+			*placement = cpu_place_parse(optarg);
+		else if (opt == 'w')
+			*weights = cpu_weight_parse(optarg);
+		else
+			return -1;
+		if (*placement < 0 || *weights < 0)
+			return -1;
+	}
+
+	*n_threads = 0;
+	if (optind == argc)
+		return 0;
+	if (optind != argc - 1) {
+		fprintf(stderr, "Error: [-p linear|core|smt|numa|llc] "
+				"[-w equal|capacity|freq|calibrate] "
+				"[n_threads]\n");
 		return -1;
 	}
 
 	char *endptr;
 	errno = 0;
-	long tmp = strtol(argv[1], &endptr, 10);
-	if (errno || *endptr != '\0' || tmp < 1) {
+	long tmp = strtol(argv[optind], &endptr, 10);
+	if (errno || *endptr != '\0' || tmp < 0 || tmp > INT_MAX) {
 		fprintf(stderr, "Error: wrong n_threads\n");
 		return -1;
 	}
@@ -26,23 +50,43 @@ int process_args(int argc, char *argv[], int *n_threads)
 
 int main(int argc, char *argv[])
 {
-	int n_threads;
-	if (process_args(argc, argv, &n_threads))
+	int n_threads, placement, weights;
+	if (process_args(argc, argv, &n_threads, &placement, &weights))
 		exit(EXIT_FAILURE);
 
 	/* Prepare usable cpuset */
 	struct cpu_topology topo;
-	cpu_set_t cpuset;
+	struct cpu_budget budget;
 	if (get_cpu_topology(&topo)) {
 		fprintf(stderr, "Error: get_cpu_topology\n");
 		exit(EXIT_FAILURE);
 	}
-	get_full_cpuset(&topo, &cpuset);
+	if (get_cpu_budget(&topo, &budget)) {
+		fprintf(stderr, "Error: get_cpu_budget: affinity and cgroup "
+				"cpu limits\n");
+		exit(EXIT_FAILURE);
+	}
+	integrate_set_placement(&topo, placement);
+	if (weights != CPU_WEIGHT_CALIBRATE)
+		cpu_topology_set_weights(&topo, weights);
+	else if (integrate_calibrate_weights(&topo, &budget.cpuset))
+		exit(EXIT_FAILURE);
 	DUMP_LOG_DO(dump_cpu_topology(stderr, &topo));
-	DUMP_LOG_DO(dump_cpu_set(stderr, &cpuset));
+	DUMP_LOG_DO(dump_cpu_set(stderr, &budget.cpuset));
+	DUMP_LOG_DO(dump_cpu_budget(stderr, &budget));
+
+	/* Starter shares work by capacity of cpus the budget runs at once */
+	if (n_threads == 0)
+		n_threads = budget.n_cpus;
+	int calc_speed = integrate_placement_capacity(
+		&budget.cpuset,
+		n_threads < budget.n_cpus ? n_threads : budget.n_cpus);
+	if (calc_speed < 0)
+		exit(EXIT_FAILURE);
 
 	while (1) {
-		if (integrate_network_worker(n_threads, &cpuset, n_threads) < 0)
+		if (integrate_network_worker(calc_speed, &budget.cpuset,
+					     n_threads) < 0)
 			fprintf(stderr,
 				"Error: worker failed, restarting...\n");
 	}
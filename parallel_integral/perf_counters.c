@@ -0,0 +1,174 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "perf_counters.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#define PERF_COUNTERS_ENABLED
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+static const char *const perf_counter_names[PERF_COUNTER_COUNT] = {
+	[PERF_CYCLES] = "cycles",
+	[PERF_INSTRUCTIONS] = "instructions",
+	[PERF_REF_CYCLES] = "ref_cycles",
+	[PERF_TASK_CLOCK] = "task_clock_ns",
+	[PERF_CTX_SWITCHES] = "ctx_switches",
+	[PERF_MIGRATIONS] = "migrations",
+};
+
+const char *perf_counter_name(int counter)
+{
+	return perf_counter_names[counter];
+}
+
+#ifdef PERF_COUNTERS_ENABLED
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} perf_counter_events[PERF_COUNTER_COUNT] = {
+	[PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE,
+				PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_REF_CYCLES] = { PERF_TYPE_HARDWARE,
+			      PERF_COUNT_HW_REF_CPU_CYCLES },
+	[PERF_TASK_CLOCK] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+	[PERF_CTX_SWITCHES] = { PERF_TYPE_SOFTWARE,
+				PERF_COUNT_SW_CONTEXT_SWITCHES },
+	[PERF_MIGRATIONS] = { PERF_TYPE_SOFTWARE,
+			      PERF_COUNT_SW_CPU_MIGRATIONS },
+};
+
+/* Separate events, not a group: one refused counter keeps the others */
+unsigned perf_counters_open(struct perf_counters *pc)
+{
+	unsigned mask = 0;
+	memset(pc, 0, sizeof(*pc));
+
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = perf_counter_events[i].type;
+		attr.config = perf_counter_events[i].config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+				   PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (pc->fd[i] < 0 && attr.type == PERF_TYPE_SOFTWARE) {
+			/* exclude_kernel needs paranoid <= 1, sw events not */
+			attr.exclude_kernel = 0;
+			pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1,
+					    -1, 0);
+		}
+		if (pc->fd[i] >= 0)
+			mask |= 1U << i;
+	}
+
+	pc->start.mask = mask;
+	pc->delta.mask = mask;
+	return mask;
+}
+
+void perf_counters_close(struct perf_counters *pc)
+{
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+		if (pc->fd[i] >= 0)
+			close(pc->fd[i]);
+		pc->fd[i] = -1;
+	}
+}
+
+/* Scaled by enabled / running time when the PMU multiplexes */
+static void perf_counters_read(struct perf_counters *pc,
+			       struct perf_sample *sample)
+{
+	sample->mask = 0;
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+		uint64_t buf[3]; /* value, time_enabled, time_running */
+		sample->val[i] = 0;
+		if (pc->fd[i] < 0 ||
+		    read(pc->fd[i], buf, sizeof(buf)) != sizeof(buf))
+			continue;
+		if (buf[2] != 0 && buf[2] < buf[1])
+			buf[0] = (double)buf[0] * buf[1] / buf[2];
+		sample->val[i] = buf[0];
+		sample->mask |= 1U << i;
+	}
+}
+
+#else /* PERF_COUNTERS_ENABLED */
+
+unsigned perf_counters_open(struct perf_counters *pc)
+{
+	memset(pc, 0, sizeof(*pc));
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+		pc->fd[i] = -1;
+	return 0;
+}
+
+void perf_counters_close(struct perf_counters *pc)
+{
+	(void)pc;
+}
+
+static void perf_counters_read(struct perf_counters *pc,
+			       struct perf_sample *sample)
+{
+	(void)pc;
+	memset(sample, 0, sizeof(*sample));
+}
+
+#endif /* PERF_COUNTERS_ENABLED */
+
+void perf_counters_start(struct perf_counters *pc)
+{
+	perf_counters_read(pc, &pc->start);
+}
+
+void perf_counters_stop(struct perf_counters *pc)
+{
+	struct perf_sample now;
+	perf_counters_read(pc, &now);
+	pc->delta.mask = now.mask & pc->start.mask;
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+		pc->delta.val[i] = now.val[i] - pc->start.val[i];
+}
+
+void perf_sample_add(struct perf_sample *sum, const struct perf_sample *add)
+{
+	sum->mask &= add->mask;
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+		sum->val[i] += add->val[i];
+}
+
+void perf_sample_dump(FILE *stream, const struct perf_sample *sample)
+{
+	const uint64_t *val = sample->val;
+	unsigned mask = sample->mask;
+
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+		if (mask & (1U << i))
+			fprintf(stream, " %s=%llu", perf_counter_names[i],
+				(unsigned long long)val[i]);
+	}
+	if ((mask & (1U << PERF_CYCLES)) && (mask & (1U << PERF_INSTRUCTIONS)) &&
+	    val[PERF_CYCLES])
+		fprintf(stream, " ipc=%.3f",
+			(double)val[PERF_INSTRUCTIONS] / val[PERF_CYCLES]);
+	if ((mask & (1U << PERF_CYCLES)) && (mask & (1U << PERF_TASK_CLOCK)) &&
+	    val[PERF_TASK_CLOCK])
+		fprintf(stream, " ghz=%.3f",
+			(double)val[PERF_CYCLES] / val[PERF_TASK_CLOCK]);
+	if (!mask)
+		fprintf(stream, " unavailable");
+}
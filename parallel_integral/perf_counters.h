@@ -0,0 +1,49 @@
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Per thread perf_event counters of the calling thread. Counters the
+ * kernel refuses (perf_event_paranoid, no PMU in a VM, no
+ * linux/perf_event.h at build time) are left out of the mask.
+ */
+
+enum perf_counter {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_REF_CYCLES,
+	PERF_TASK_CLOCK, /* ns */
+	PERF_CTX_SWITCHES,
+	PERF_MIGRATIONS,
+	PERF_COUNTER_COUNT
+};
+
+struct perf_sample {
+	uint64_t val[PERF_COUNTER_COUNT];
+	unsigned mask; /* 1 << enum perf_counter of valid val */
+};
+
+struct perf_counters {
+	int fd[PERF_COUNTER_COUNT];
+	struct perf_sample start;
+	struct perf_sample delta; /* last start..stop */
+};
+
+/* Opens for the calling thread, returns mask of opened counters */
+unsigned perf_counters_open(struct perf_counters *pc);
+void perf_counters_close(struct perf_counters *pc);
+
+void perf_counters_start(struct perf_counters *pc);
+void perf_counters_stop(struct perf_counters *pc);
+
+/* sum += add, mask of both */
+void perf_sample_add(struct perf_sample *sum, const struct perf_sample *add);
+
+const char *perf_counter_name(int counter);
+
+/* name=value pairs of valid counters and ipc, ghz derived of them */
+void perf_sample_dump(FILE *stream, const struct perf_sample *sample);
+
+#endif /* PERF_COUNTERS_H_ */
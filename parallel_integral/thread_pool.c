@@ -0,0 +1,197 @@
+#include "thread_pool.h"
+#include "integrate.h"
+
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/* Busy-wait iterations before sleeping in futex */
+#define THREAD_POOL_SPIN 4096
+
+struct thread_pool {
+	pthread_t *threads;
+	int n_threads;
+
+	thread_pool_func_t func;
+	void *arg;
+
+	/* Futex words */
+	int generation;
+	int n_running;
+
+	int stop;
+};
+
+struct thread_pool_arg {
+	struct thread_pool *pool;
+	int idx;
+};
+
+static void futex_wait(int *addr, int val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(int *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/* Wait while *addr == val */
+static void thread_pool_wait_change(int *addr, int val)
+{
+	for (int i = 0; i < THREAD_POOL_SPIN; i++) {
+		if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) != val)
+			return;
+		cpu_relax();
+	}
+	while (__atomic_load_n(addr, __ATOMIC_ACQUIRE) == val)
+		futex_wait(addr, val);
+}
+
+static void *thread_pool_loop(void *arg)
+{
+	struct thread_pool_arg *targ = arg;
+	struct thread_pool *pool = targ->pool;
+	int idx = targ->idx;
+	free(targ);
+
+	int seen = 0;
+	while (1) {
+		thread_pool_wait_change(&pool->generation, seen);
+		seen = __atomic_load_n(&pool->generation, __ATOMIC_ACQUIRE);
+		if (pool->stop)
+			break;
+
+		uint64_t trace_start = trace_begin();
+		pool->func(pool->arg, idx);
+		trace_end(TRACE_pool_task, trace_start, idx);
+
+		if (__atomic_sub_fetch(&pool->n_running, 1, __ATOMIC_ACQ_REL) ==
+		    0)
+			futex_wake(&pool->n_running);
+	}
+
+	DUMP_LOG_DEBUG("pool thread %d exits\n", idx);
+	return NULL;
+}
+
+struct thread_pool *thread_pool_create(int n_threads, const int *cpus)
+{
+	struct thread_pool *pool = calloc(1, sizeof(*pool));
+	if (!pool) {
+		perror("Error: calloc");
+		return NULL;
+	}
+
+	pool->threads = calloc(n_threads, sizeof(*pool->threads));
+	if (!pool->threads) {
+		perror("Error: calloc");
+		free(pool);
+		return NULL;
+	}
+
+	/* Pool threads inherit it, signals go to caller threads only */
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	cpu_set_t cpuset_tmp;
+
+	for (; pool->n_threads < n_threads; pool->n_threads++) {
+		int i = pool->n_threads;
+		if (cpus && cpus[i] >= 0) {
+			CPU_ZERO(&cpuset_tmp);
+			CPU_SET(cpus[i], &cpuset_tmp);
+			DUMP_LOG_DEBUG("setting pool thread to cpu = %2d\n", cpus[i]);
+			if (pthread_attr_setaffinity_np(&attr,
+							sizeof(cpuset_tmp),
+							&cpuset_tmp)) {
+				perror("Error: pthread_attr_setaffinity_np");
+				goto handle_err;
+			}
+		}
+
+		struct thread_pool_arg *targ = malloc(sizeof(*targ));
+		if (!targ) {
+			perror("Error: malloc");
+			goto handle_err;
+		}
+		targ->pool = pool;
+		targ->idx = i;
+
+		if (pthread_create(&pool->threads[i], &attr, thread_pool_loop,
+				   targ)) {
+			perror("Error: pthread_create");
+			free(targ);
+			goto handle_err;
+		}
+	}
+
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return pool;
+
+handle_err:
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	thread_pool_destroy(pool);
+	return NULL;
+}
+
+void thread_pool_destroy(struct thread_pool *pool)
+{
+	thread_pool_wait(pool);
+
+	pool->stop = 1;
+	__atomic_add_fetch(&pool->generation, 1, __ATOMIC_RELEASE);
+	futex_wake(&pool->generation);
+
+	for (int i = 0; i < pool->n_threads; i++) {
+		if (pthread_join(pool->threads[i], NULL))
+			perror("Error: pthread_join");
+	}
+
+	free(pool->threads);
+	free(pool);
+}
+
+int thread_pool_size(struct thread_pool *pool)
+{
+	return pool->n_threads;
+}
+
+void thread_pool_submit(struct thread_pool *pool, thread_pool_func_t func,
+			void *arg)
+{
+	/* Previous job may be left running after signal-exception */
+	thread_pool_wait(pool);
+
+	pool->func = func;
+	pool->arg = arg;
+	__atomic_store_n(&pool->n_running, pool->n_threads, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pool->generation, 1, __ATOMIC_RELEASE);
+	futex_wake(&pool->generation);
+}
+
+void thread_pool_wait(struct thread_pool *pool)
+{
+	uint64_t trace_start = trace_begin();
+	int n;
+	while ((n = __atomic_load_n(&pool->n_running, __ATOMIC_ACQUIRE)) != 0)
+		thread_pool_wait_change(&pool->n_running, n);
+	trace_end(TRACE_join, trace_start, 0);
+}
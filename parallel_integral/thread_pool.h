@@ -0,0 +1,21 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+/* Long-lived pinned threads, one job at a time, futex wakeup */
+
+typedef void (*thread_pool_func_t)(void *arg, int thread_idx);
+
+struct thread_pool;
+
+/* cpus[i] is the cpu of thread i, -1 leaves it unpinned */
+struct thread_pool *thread_pool_create(int n_threads, const int *cpus);
+void thread_pool_destroy(struct thread_pool *pool);
+
+int thread_pool_size(struct thread_pool *pool);
+
+/* Run func(arg, i) on every thread i, waits for previous job first */
+void thread_pool_submit(struct thread_pool *pool, thread_pool_func_t func,
+			void *arg);
+void thread_pool_wait(struct thread_pool *pool);
+
+#endif /* THREAD_POOL_H_ */
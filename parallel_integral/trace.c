@@ -0,0 +1,296 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+enum trace_ring_state {
+	TRACE_RING_USED,
+	TRACE_RING_EXITED, /* owner gone, events left to collect */
+	TRACE_RING_FREE, /* collected, another thread may take it */
+};
+
+/* Single writer: own thread; readers run while writers are idle */
+struct trace_ring {
+	uint64_t head; /* events written so far */
+	uint64_t first; /* events of former owners end here */
+	int state;
+	struct trace_event ev[TRACE_RING];
+};
+
+struct trace_process {
+	char name[32];
+	struct trace_event *events; /* our clock */
+	size_t n_events;
+};
+
+int trace_enabled;
+
+static struct trace_ring *trace_rings[TRACE_MAX_THREADS];
+static int trace_n_rings;
+static __thread struct trace_ring *trace_ring_self;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key; /* ring, handed back at thread exit */
+static int trace_key_ok;
+
+static struct trace_process trace_procs[TRACE_MAX_PROCESSES];
+static int trace_n_procs;
+
+static const char *const trace_names[TRACE_EVENT_COUNT] = {
+#define TRACE_NAME(name) #name,
+	TRACE_EVENTS(TRACE_NAME)
+#undef TRACE_NAME
+};
+
+const char *trace_init(void)
+{
+	const char *path = getenv("INTEGRATE_TRACE");
+	if (path && *path)
+		trace_enable();
+	return path && *path ? path : NULL;
+}
+
+void trace_enable(void)
+{
+	__atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+}
+
+void trace_disable(void)
+{
+	__atomic_store_n(&trace_enabled, 0, __ATOMIC_RELEASE);
+}
+
+uint64_t trace_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Thread exit: trace_collect frees the ring once it took the events */
+static void trace_ring_exit(void *arg)
+{
+	struct trace_ring *ring = arg;
+	trace_ring_self = NULL;
+	__atomic_store_n(&ring->state, TRACE_RING_EXITED, __ATOMIC_RELEASE);
+}
+
+static void trace_key_create(void)
+{
+	trace_key_ok = !pthread_key_create(&trace_key, trace_ring_exit);
+}
+
+/* Free ring of an exited thread, its index in *idx, NULL if none */
+static struct trace_ring *trace_ring_reuse(int *idx)
+{
+	int n_rings = __atomic_load_n(&trace_n_rings, __ATOMIC_ACQUIRE);
+	if (n_rings > TRACE_MAX_THREADS)
+		n_rings = TRACE_MAX_THREADS;
+
+	for (int r = 0; r < n_rings; r++) {
+		struct trace_ring *ring =
+			__atomic_load_n(&trace_rings[r], __ATOMIC_ACQUIRE);
+		int free_state = TRACE_RING_FREE;
+		if (ring && __atomic_compare_exchange_n(&ring->state,
+							&free_state,
+							TRACE_RING_USED, 0,
+							__ATOMIC_ACQUIRE,
+							__ATOMIC_RELAXED)) {
+			__atomic_store_n(&ring->first, ring->head,
+					 __ATOMIC_RELEASE);
+			*idx = r;
+			return ring;
+		}
+	}
+	return NULL;
+}
+
+/* Ring of the calling thread, taken on its first event */
+static struct trace_ring *trace_ring_get(uint16_t *tid)
+{
+	static __thread int self_tid = -1;
+	if (trace_ring_self) {
+		*tid = self_tid;
+		return trace_ring_self;
+	}
+	if (self_tid == -2)
+		return NULL;
+
+	pthread_once(&trace_once, trace_key_create);
+	int idx;
+	struct trace_ring *ring = trace_key_ok ? trace_ring_reuse(&idx) : NULL;
+	if (!ring) {
+		idx = __atomic_fetch_add(&trace_n_rings, 1, __ATOMIC_RELAXED);
+		if (idx < TRACE_MAX_THREADS)
+			ring = calloc(1, sizeof(*ring));
+		if (!ring) {
+			self_tid = -2; /* no more rings, not traced */
+			return NULL;
+		}
+		__atomic_store_n(&trace_rings[idx], ring, __ATOMIC_RELEASE);
+	}
+
+	if (trace_key_ok)
+		pthread_setspecific(trace_key, ring);
+	trace_ring_self = ring;
+	self_tid = idx;
+	*tid = idx;
+	return ring;
+}
+
+void trace_record(int id, uint64_t start, int32_t arg)
+{
+	uint16_t tid;
+	struct trace_ring *ring = trace_ring_get(&tid);
+	if (!ring)
+		return;
+
+	uint64_t head = ring->head;
+	struct trace_event *ev = &ring->ev[head % TRACE_RING];
+	ev->ts = start;
+	ev->dur = trace_now() - start;
+	ev->arg = arg;
+	ev->id = id;
+	ev->tid = tid;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+size_t trace_collect(uint64_t since, struct trace_event **events)
+{
+	int n_rings = __atomic_load_n(&trace_n_rings, __ATOMIC_ACQUIRE);
+	if (n_rings > TRACE_MAX_THREADS)
+		n_rings = TRACE_MAX_THREADS;
+
+	*events = malloc(sizeof(**events) * TRACE_RING *
+			 (n_rings ? n_rings : 1));
+	if (!*events) {
+		perror("Error: malloc");
+		return 0;
+	}
+
+	size_t n = 0;
+	for (int r = 0; r < n_rings; r++) {
+		struct trace_ring *ring =
+			__atomic_load_n(&trace_rings[r], __ATOMIC_ACQUIRE);
+		if (!ring)
+			continue;
+
+		int state = __atomic_load_n(&ring->state, __ATOMIC_ACQUIRE);
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		uint64_t first =
+			__atomic_load_n(&ring->first, __ATOMIC_ACQUIRE);
+		if (head - first > TRACE_RING)
+			first = head - TRACE_RING;
+		for (uint64_t i = first; i < head; i++) {
+			struct trace_event *ev = &ring->ev[i % TRACE_RING];
+			if (ev->ts + ev->dur >= since)
+				(*events)[n++] = *ev;
+		}
+
+		/* The caller has the events of an exited thread now */
+		if (state == TRACE_RING_EXITED)
+			__atomic_store_n(&ring->state, TRACE_RING_FREE,
+					 __ATOMIC_RELEASE);
+	}
+	return n;
+}
+
+int trace_add_process(const char *name, const struct trace_event *events,
+		      size_t n_events, int64_t offset_ns)
+{
+	if (trace_n_procs == TRACE_MAX_PROCESSES) {
+		fprintf(stderr, "Error: too many traced processes\n");
+		return -1;
+	}
+
+	struct trace_process *proc = &trace_procs[trace_n_procs];
+	proc->events = malloc(sizeof(*events) * (n_events ? n_events : 1));
+	if (!proc->events) {
+		perror("Error: malloc");
+		return -1;
+	}
+	snprintf(proc->name, sizeof(proc->name), "%s", name);
+	proc->n_events = n_events;
+	for (size_t i = 0; i < n_events; i++) {
+		proc->events[i] = events[i];
+		proc->events[i].ts -= offset_ns;
+	}
+
+	trace_n_procs++;
+	return 0;
+}
+
+static void trace_dump_events(FILE *file, int pid,
+			      const struct trace_event *events, size_t n,
+			      uint64_t base, const char **sep)
+{
+	for (size_t i = 0; i < n; i++) {
+		const struct trace_event *ev = &events[i];
+		if (ev->id >= TRACE_EVENT_COUNT)
+			continue;
+		fprintf(file,
+			"%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,"
+			"\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+			"\"args\":{\"arg\":%d}}",
+			*sep, trace_names[ev->id], pid, ev->tid,
+			(int64_t)(ev->ts - base) * 1e-3, ev->dur * 1e-3,
+			ev->arg);
+		*sep = ",";
+	}
+}
+
+int trace_dump(const char *path, const char *name)
+{
+	struct trace_event *events;
+	size_t n_events = trace_collect(0, &events);
+	if (!events)
+		return -1;
+
+	/* Timeline starts at the first event of any process */
+	uint64_t base = UINT64_MAX;
+	for (size_t i = 0; i < n_events; i++) {
+		if (events[i].ts < base)
+			base = events[i].ts;
+	}
+	for (int p = 0; p < trace_n_procs; p++) {
+		for (size_t i = 0; i < trace_procs[p].n_events; i++) {
+			if (trace_procs[p].events[i].ts < base)
+				base = trace_procs[p].events[i].ts;
+		}
+	}
+
+	FILE *file = fopen(path, "w");
+	if (!file) {
+		perror("Error: trace fopen");
+		free(events);
+		return -1;
+	}
+
+	const char *sep = "";
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (int p = 0; p <= trace_n_procs; p++) {
+		fprintf(file,
+			"%s\n{\"name\":\"process_name\",\"ph\":\"M\","
+			"\"pid\":%d,\"args\":{\"name\":\"%s\"}}",
+			sep, p, p ? trace_procs[p - 1].name : name);
+		sep = ",";
+	}
+	trace_dump_events(file, 0, events, n_events, base, &sep);
+	for (int p = 0; p < trace_n_procs; p++)
+		trace_dump_events(file, p + 1, trace_procs[p].events,
+				  trace_procs[p].n_events, base, &sep);
+	fprintf(file, "\n]}\n");
+
+	free(events);
+	if (fclose(file)) {
+		perror("Error: trace fclose");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,86 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Timeline of spans in per thread rings, dumped as Chrome trace-event
+ * JSON (chrome://tracing, ui.perfetto.dev). INTEGRATE_TRACE=<file>
+ * enables it, the starter also asks its workers for their spans.
+ */
+
+/* Events kept per thread, older ones are overwritten */
+#define TRACE_RING (1 << 14)
+#define TRACE_MAX_THREADS 256
+#define TRACE_MAX_PROCESSES (1 + 4096) /* starter and its workers */
+
+#define TRACE_EVENTS(X)                                                        \
+	X(pool_task) /* one pool job on a pool thread */                       \
+	X(thread) /* one-shot worker thread */                                 \
+	X(chunk) /* popped chunks, arg: count */                               \
+	X(batch_chunk) /* arg: pack */                                         \
+	X(join) /* waiting for threads */                                      \
+	X(udp_broadcast)                                                       \
+	X(accept) /* arg: workers */                                           \
+	X(speed_exchange)                                                      \
+	X(task_send) /* arg: worker */                                         \
+	X(result_recv) /* arg: worker */                                       \
+	X(request_recv) /* worker side, arg: tasks */                          \
+	X(worker_compute)                                                      \
+	X(result_send)
+
+enum trace_event_id {
+#define TRACE_ENUM(name) TRACE_##name,
+	TRACE_EVENTS(TRACE_ENUM)
+#undef TRACE_ENUM
+	TRACE_EVENT_COUNT
+};
+
+/* Plain data, workers ship it field by field (netw_integrate.c) */
+struct trace_event {
+	uint64_t ts; /* CLOCK_MONOTONIC ns */
+	uint64_t dur;
+	int32_t arg;
+	uint16_t id;
+	uint16_t tid;
+};
+
+extern int trace_enabled;
+
+/* Enables if INTEGRATE_TRACE is set, returns its path or NULL */
+const char *trace_init(void);
+void trace_enable(void);
+/* Stops recording, events in the rings are kept */
+void trace_disable(void);
+
+uint64_t trace_now(void);
+
+/* Span [start, now) of the calling thread */
+void trace_record(int id, uint64_t start, int32_t arg);
+
+static inline uint64_t trace_begin(void)
+{
+	return trace_enabled ? trace_now() : 0;
+}
+
+static inline void trace_end(int id, uint64_t start, int32_t arg)
+{
+	if (trace_enabled)
+		trace_record(id, start, arg);
+}
+
+/*
+ * Malloc'ed events of all threads ending after since, returns number.
+ * Rings of exited threads are reused afterwards, collected once.
+ */
+size_t trace_collect(uint64_t since, struct trace_event **events);
+
+/* Another process in the dump, offset_ns: its clock minus ours */
+int trace_add_process(const char *name, const struct trace_event *events,
+		      size_t n_events, int64_t offset_ns);
+
+/* This process (named name) and added ones to path */
+int trace_dump(const char *path, const char *name);
+
+#endif /* TRACE_H_ */